@@ -0,0 +1,145 @@
+/*******************************************************************************************************************//**
+ * @file alpha_blend.h
+ * @brief Vectorized per-pixel alpha blending kernels for 8-bit BGR rows and premultiplied BGRA layer rows
+ **********************************************************************************************************************/
+
+#ifndef ALPHA_BLEND_H
+#define ALPHA_BLEND_H
+
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "opencv2/core/hal/intrin.hpp"
+
+// round(x / 255) for 0 <= x <= 255 * 255
+inline int divide255(int x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Blend a single color over n BGR pixels, pixel i weighted by alpha[i] / 255
+ **********************************************************************************************************************/
+inline void blendColorRow(uchar* dst, const uchar* alpha, cv::Vec3b color, int n) {
+    int x = 0;
+#if CV_SIMD128
+    const cv::v_uint16x8 full = cv::v_setall_u16(255);
+    const cv::v_uint16x8 half = cv::v_setall_u16(128);
+    const cv::v_uint16x8 cb = cv::v_setall_u16(color[0]);
+    const cv::v_uint16x8 cg = cv::v_setall_u16(color[1]);
+    const cv::v_uint16x8 cr = cv::v_setall_u16(color[2]);
+    for (; x <= n - 16; x += 16) {
+        cv::v_uint8x16 b, g, r;
+        cv::v_load_deinterleave(dst + 3 * x, b, g, r);
+        cv::v_uint16x8 a0, a1, b0, b1, g0, g1, r0, r1;
+        cv::v_expand(cv::v_load(alpha + x), a0, a1);
+        cv::v_uint16x8 ia0 = full - a0, ia1 = full - a1;
+        cv::v_expand(b, b0, b1);
+        cv::v_expand(g, g0, g1);
+        cv::v_expand(r, r0, r1);
+        // every product is at most 255 * 255, so these sums stay inside 16 bits
+        b0 = b0 * ia0 + cb * a0 + half;  b1 = b1 * ia1 + cb * a1 + half;
+        g0 = g0 * ia0 + cg * a0 + half;  g1 = g1 * ia1 + cg * a1 + half;
+        r0 = r0 * ia0 + cr * a0 + half;  r1 = r1 * ia1 + cr * a1 + half;
+        b = cv::v_pack((b0 + (b0 >> 8)) >> 8, (b1 + (b1 >> 8)) >> 8);
+        g = cv::v_pack((g0 + (g0 >> 8)) >> 8, (g1 + (g1 >> 8)) >> 8);
+        r = cv::v_pack((r0 + (r0 >> 8)) >> 8, (r1 + (r1 >> 8)) >> 8);
+        cv::v_store_interleave(dst + 3 * x, b, g, r);
+    }
+#endif
+    for (; x < n; x++) {
+        int a = alpha[x];
+        if (a == 0) continue;
+        for (int c = 0; c < 3; c++) {
+            dst[3 * x + c] = (uchar) divide255(dst[3 * x + c] * (255 - a) + color[c] * a);
+        }
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Blend an opaque color over n premultiplied BGRA pixels, pixel i weighted by alpha[i] / 255
+ *
+ * The alpha channel is blended towards 255 with the same weight, so the pixel stays premultiplied and a weight means
+ * the same thing on a layer as on the image.
+ **********************************************************************************************************************/
+inline void blendLayerRow(uchar* dst, const uchar* alpha, cv::Vec3b color, int n) {
+    int x = 0;
+#if CV_SIMD128
+    const cv::v_uint16x8 full = cv::v_setall_u16(255);
+    const cv::v_uint16x8 half = cv::v_setall_u16(128);
+    const cv::v_uint16x8 cb = cv::v_setall_u16(color[0]);
+    const cv::v_uint16x8 cg = cv::v_setall_u16(color[1]);
+    const cv::v_uint16x8 cr = cv::v_setall_u16(color[2]);
+    for (; x <= n - 16; x += 16) {
+        cv::v_uint8x16 b, g, r, a;
+        cv::v_load_deinterleave(dst + 4 * x, b, g, r, a);
+        cv::v_uint16x8 w0, w1, b0, b1, g0, g1, r0, r1, a0, a1;
+        cv::v_expand(cv::v_load(alpha + x), w0, w1);
+        cv::v_uint16x8 iw0 = full - w0, iw1 = full - w1;
+        cv::v_expand(b, b0, b1);
+        cv::v_expand(g, g0, g1);
+        cv::v_expand(r, r0, r1);
+        cv::v_expand(a, a0, a1);
+        b0 = b0 * iw0 + cb * w0 + half;    b1 = b1 * iw1 + cb * w1 + half;
+        g0 = g0 * iw0 + cg * w0 + half;    g1 = g1 * iw1 + cg * w1 + half;
+        r0 = r0 * iw0 + cr * w0 + half;    r1 = r1 * iw1 + cr * w1 + half;
+        a0 = a0 * iw0 + full * w0 + half;  a1 = a1 * iw1 + full * w1 + half;
+        b = cv::v_pack((b0 + (b0 >> 8)) >> 8, (b1 + (b1 >> 8)) >> 8);
+        g = cv::v_pack((g0 + (g0 >> 8)) >> 8, (g1 + (g1 >> 8)) >> 8);
+        r = cv::v_pack((r0 + (r0 >> 8)) >> 8, (r1 + (r1 >> 8)) >> 8);
+        a = cv::v_pack((a0 + (a0 >> 8)) >> 8, (a1 + (a1 >> 8)) >> 8);
+        cv::v_store_interleave(dst + 4 * x, b, g, r, a);
+    }
+#endif
+    for (; x < n; x++) {
+        int w = alpha[x];
+        if (w == 0) continue;
+        for (int c = 0; c < 3; c++) {
+            dst[4 * x + c] = (uchar) divide255(dst[4 * x + c] * (255 - w) + color[c] * w);
+        }
+        dst[4 * x + 3] = (uchar) divide255(dst[4 * x + 3] * (255 - w) + 255 * w);
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Composite n premultiplied BGRA layer pixels over n BGR pixels
+ **********************************************************************************************************************/
+inline void compositeRow(uchar* dst, const uchar* layer, int n) {
+    int x = 0;
+#if CV_SIMD128
+    const cv::v_uint16x8 full = cv::v_setall_u16(255);
+    const cv::v_uint16x8 half = cv::v_setall_u16(128);
+    const cv::v_uint8x16 clear = cv::v_setzero_u8();
+    for (; x <= n - 16; x += 16) {
+        cv::v_uint8x16 lb, lg, lr, la;
+        cv::v_load_deinterleave(layer + 4 * x, lb, lg, lr, la);
+        // v_check_any only looks at the top bit of each lane, so compare first
+        if (!cv::v_check_any(la != clear)) continue;
+        cv::v_uint8x16 b, g, r;
+        cv::v_load_deinterleave(dst + 3 * x, b, g, r);
+        cv::v_uint16x8 ia0, ia1, b0, b1, g0, g1, r0, r1;
+        cv::v_expand(la, ia0, ia1);
+        ia0 = full - ia0;
+        ia1 = full - ia1;
+        cv::v_expand(b, b0, b1);
+        cv::v_expand(g, g0, g1);
+        cv::v_expand(r, r0, r1);
+        b0 = b0 * ia0 + half;  b1 = b1 * ia1 + half;
+        g0 = g0 * ia0 + half;  g1 = g1 * ia1 + half;
+        r0 = r0 * ia0 + half;  r1 = r1 * ia1 + half;
+        // the layer is premultiplied, so its color only has to be added, saturating in case rounding went over
+        b = lb + cv::v_pack((b0 + (b0 >> 8)) >> 8, (b1 + (b1 >> 8)) >> 8);
+        g = lg + cv::v_pack((g0 + (g0 >> 8)) >> 8, (g1 + (g1 >> 8)) >> 8);
+        r = lr + cv::v_pack((r0 + (r0 >> 8)) >> 8, (r1 + (r1 >> 8)) >> 8);
+        cv::v_store_interleave(dst + 3 * x, b, g, r);
+    }
+#endif
+    for (; x < n; x++) {
+        int a = layer[4 * x + 3];
+        if (a == 0) continue;
+        for (int c = 0; c < 3; c++) {
+            dst[3 * x + c] = (uchar) std::min(255, layer[4 * x + c] + divide255(dst[3 * x + c] * (255 - a)));
+        }
+    }
+}
+
+#endif // ALPHA_BLEND_H
@@ -0,0 +1,228 @@
+/*******************************************************************************************************************//**
+ * @file area_sampler.h
+ * @brief Mean and median colors over square windows of the edited image
+ **********************************************************************************************************************/
+
+#ifndef AREA_SAMPLER_H
+#define AREA_SAMPLER_H
+
+#include <map>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "tile_store.h"
+
+#define SAMPLER_TILE_SIZE 64
+#define SAMPLER_CACHED_TILES 64
+
+/*******************************************************************************************************************//**
+ * @class AreaSampler
+ *
+ * @brief Summed-area table split into tiles so an edit only invalidates the tiles it touched
+ *
+ * A plain integral image would have to be rebuilt below and right of every edited pixel. Here the prefix sum at
+ * (x, y) is put together from four parts: whole tiles above and left of it, the strip of tile rows left of it, the
+ * strip of tile columns above it, and the inside of its own tile. Each tile keeps only its cumulative row and column
+ * sums; the strips and the tile grid are prefix sums over those, and the inside of a tile comes from a small
+ * cv::integral of that one tile, cached for the tiles recently sampled. A window sum is four prefix sums whatever its
+ * size, and after an edit only the stale tiles are rescanned, plus the cheap prefix sums over the rows and columns of
+ * tiles they sit in.
+ **********************************************************************************************************************/
+class AreaSampler {
+    private:
+        cv::Mat source;
+        int tiles_x;
+        int tiles_y;
+        std::vector<uchar> stale;       // one flag per tile
+        bool any_stale;
+        std::vector<int64> row_sums;    // per tile, the sum of its first ly rows for ly = 0..T, 3 channels each
+        std::vector<int64> col_sums;    // per tile, the sum of its first lx columns
+        std::vector<int64> row_strips;  // per tile row and ly, running totals of row_sums over tiles to the left
+        std::vector<int64> col_strips;  // per tile column and lx, running totals of col_sums over tiles above
+        std::vector<int64> grid;        // running totals of whole tiles, (tiles_y + 1) x (tiles_x + 1)
+        std::map<int, cv::Mat> local;   // integral images of recently sampled tiles
+
+        cv::Rect tileRect(int tx, int ty) const {
+            cv::Rect rect(tx * SAMPLER_TILE_SIZE, ty * SAMPLER_TILE_SIZE, SAMPLER_TILE_SIZE, SAMPLER_TILE_SIZE);
+            return rect & cv::Rect(0, 0, source.cols, source.rows);
+        }
+
+        // recompute the row and column sums of one tile
+        void scanTile(int tx, int ty, TileStore* store) {
+            cv::Rect rect = tileRect(tx, ty);
+            if (store) store->access(source, rect);
+            const int T = SAMPLER_TILE_SIZE;
+            int64* rows = &row_sums[((size_t) ty * tiles_x + tx) * (T + 1) * 3];
+            int64* cols = &col_sums[((size_t) ty * tiles_x + tx) * (T + 1) * 3];
+            std::vector<int64> columns(rect.width * 3, 0);
+            for (int c = 0; c < 3; c++) rows[c] = 0;
+            for (int y = 0; y < rect.height; y++) {
+                const uchar* p = source.ptr<uchar>(rect.y + y) + 3 * rect.x;
+                int sum[3] = {0, 0, 0};
+                for (int x = 0; x < rect.width; x++) {
+                    for (int c = 0; c < 3; c++) {
+                        sum[c] += p[3 * x + c];
+                        columns[3 * x + c] += p[3 * x + c];
+                    }
+                }
+                for (int c = 0; c < 3; c++) rows[3 * (y + 1) + c] = rows[3 * y + c] + sum[c];
+            }
+            for (int c = 0; c < 3; c++) cols[c] = 0;
+            for (int x = 0; x < rect.width; x++) {
+                for (int c = 0; c < 3; c++) cols[3 * (x + 1) + c] = cols[3 * x + c] + columns[3 * x + c];
+            }
+            // partial tiles at the image edge repeat their total past their last row or column
+            for (int i = rect.height + 1; i <= T; i++) for (int c = 0; c < 3; c++) rows[3 * i + c] = rows[3 * rect.height + c];
+            for (int i = rect.width + 1; i <= T; i++) for (int c = 0; c < 3; c++) cols[3 * i + c] = cols[3 * rect.width + c];
+            local.erase(ty * tiles_x + tx);
+        }
+
+        // rescan stale tiles and rebuild the strips and grid that depend on them
+        void refresh(TileStore* store) {
+            if (!any_stale) return;
+            const int T = SAMPLER_TILE_SIZE;
+            std::vector<uchar> stale_rows(tiles_y, 0), stale_cols(tiles_x, 0);
+            for (int ty = 0; ty < tiles_y; ty++) {
+                for (int tx = 0; tx < tiles_x; tx++) {
+                    if (!stale[(size_t) ty * tiles_x + tx]) continue;
+                    scanTile(tx, ty, store);
+                    stale[(size_t) ty * tiles_x + tx] = 0;
+                    stale_rows[ty] = stale_cols[tx] = 1;
+                }
+            }
+            for (int ty = 0; ty < tiles_y; ty++) {
+                if (!stale_rows[ty]) continue;
+                for (int ly = 0; ly <= T; ly++) {
+                    int64* strip = &row_strips[(((size_t) ty * (T + 1) + ly) * (tiles_x + 1)) * 3];
+                    for (int c = 0; c < 3; c++) strip[c] = 0;
+                    for (int tx = 0; tx < tiles_x; tx++) {
+                        const int64* rows = &row_sums[((size_t) ty * tiles_x + tx) * (T + 1) * 3];
+                        for (int c = 0; c < 3; c++) strip[3 * (tx + 1) + c] = strip[3 * tx + c] + rows[3 * ly + c];
+                    }
+                }
+            }
+            for (int tx = 0; tx < tiles_x; tx++) {
+                if (!stale_cols[tx]) continue;
+                for (int lx = 0; lx <= T; lx++) {
+                    int64* strip = &col_strips[(((size_t) tx * (T + 1) + lx) * (tiles_y + 1)) * 3];
+                    for (int c = 0; c < 3; c++) strip[c] = 0;
+                    for (int ty = 0; ty < tiles_y; ty++) {
+                        const int64* cols = &col_sums[((size_t) ty * tiles_x + tx) * (T + 1) * 3];
+                        for (int c = 0; c < 3; c++) strip[3 * (ty + 1) + c] = strip[3 * ty + c] + cols[3 * lx + c];
+                    }
+                }
+            }
+            for (int ty = 0; ty < tiles_y; ty++) {
+                for (int tx = 0; tx < tiles_x; tx++) {
+                    const int64* total = &row_sums[(((size_t) ty * tiles_x + tx) * (T + 1) + T) * 3];
+                    int64* out = &grid[((size_t) (ty + 1) * (tiles_x + 1) + tx + 1) * 3];
+                    const int64* up = out - (tiles_x + 1) * 3;
+                    for (int c = 0; c < 3; c++) out[c] = total[c] + up[c] + out[c - 3] - up[c - 3];
+                }
+            }
+            any_stale = false;
+        }
+
+        // sum of the pixels in [0, x) x [0, y)
+        void prefix(int x, int y, TileStore* store, int64 sum[3]) {
+            const int T = SAMPLER_TILE_SIZE;
+            int tx = x / T, lx = x % T, ty = y / T, ly = y % T;
+            const int64* whole = &grid[((size_t) ty * (tiles_x + 1) + tx) * 3];
+            for (int c = 0; c < 3; c++) sum[c] = whole[c];
+            if (ly > 0) {
+                const int64* strip = &row_strips[(((size_t) ty * (T + 1) + ly) * (tiles_x + 1) + tx) * 3];
+                for (int c = 0; c < 3; c++) sum[c] += strip[c];
+            }
+            if (lx > 0) {
+                const int64* strip = &col_strips[(((size_t) tx * (T + 1) + lx) * (tiles_y + 1) + ty) * 3];
+                for (int c = 0; c < 3; c++) sum[c] += strip[c];
+            }
+            if (lx > 0 && ly > 0) {
+                int key = ty * tiles_x + tx;
+                std::map<int, cv::Mat>::iterator cached = local.find(key);
+                if (cached == local.end()) {
+                    if (local.size() >= SAMPLER_CACHED_TILES) local.clear();
+                    cv::Rect rect = tileRect(tx, ty);
+                    if (store) store->access(source, rect);
+                    cv::Mat integral;
+                    cv::integral(source(rect), integral, CV_32S);
+                    cached = local.insert(std::make_pair(key, integral)).first;
+                }
+                const cv::Vec3i& inside = cached->second.at<cv::Vec3i>(ly, lx);
+                for (int c = 0; c < 3; c++) sum[c] += inside[c];
+            }
+        }
+
+    public:
+        AreaSampler() : tiles_x(0), tiles_y(0), any_stale(false) {}
+
+        // start over unless image is the image the sums were built from
+        void attach(const cv::Mat& image) {
+            if (image.data == source.data && image.rows == source.rows && image.cols == source.cols &&
+                image.step == source.step) {
+                return;
+            }
+            const int T = SAMPLER_TILE_SIZE;
+            source = image;
+            tiles_x = (image.cols + T - 1) / T;
+            tiles_y = (image.rows + T - 1) / T;
+            size_t tiles = (size_t) tiles_x * tiles_y;
+            stale.assign(tiles, 1);
+            any_stale = tiles > 0;
+            row_sums.assign(tiles * (T + 1) * 3, 0);
+            col_sums.assign(tiles * (T + 1) * 3, 0);
+            row_strips.assign((size_t) tiles_y * (T + 1) * (tiles_x + 1) * 3, 0);
+            col_strips.assign((size_t) tiles_x * (T + 1) * (tiles_y + 1) * 3, 0);
+            grid.assign((size_t) (tiles_y + 1) * (tiles_x + 1) * 3, 0);
+            local.clear();
+        }
+
+        // pixels in region changed, the tiles under it are rescanned before the next sample
+        void invalidate(cv::Rect region) {
+            region &= cv::Rect(0, 0, source.cols, source.rows);
+            if (region.area() <= 0) return;
+            const int T = SAMPLER_TILE_SIZE;
+            for (int ty = region.y / T; ty <= (region.y + region.height - 1) / T; ty++) {
+                for (int tx = region.x / T; tx <= (region.x + region.width - 1) / T; tx++) {
+                    stale[(size_t) ty * tiles_x + tx] = 1;
+                }
+            }
+            any_stale = true;
+        }
+
+        // rounded mean color of window, which must lie inside the attached image
+        cv::Vec3b mean(cv::Rect window, TileStore* store = NULL) {
+            refresh(store);
+            int64 a[3], b[3], c[3], d[3];
+            prefix(window.x + window.width, window.y + window.height, store, a);
+            prefix(window.x, window.y + window.height, store, b);
+            prefix(window.x + window.width, window.y, store, c);
+            prefix(window.x, window.y, store, d);
+            int64 area = window.area();
+            cv::Vec3b color;
+            for (int ch = 0; ch < 3; ch++) color[ch] = (uchar) ((a[ch] - b[ch] - c[ch] + d[ch] + area / 2) / area);
+            return color;
+        }
+
+        // per-channel median of a block of pixels, found with one histogram pass
+        static cv::Vec3b median(const cv::Mat& block) {
+            int histogram[3][256] = {{0}};
+            for (int y = 0; y < block.rows; y++) {
+                const uchar* p = block.ptr<uchar>(y);
+                for (int x = 0; x < 3 * block.cols; x += 3) {
+                    histogram[0][p[x]]++;
+                    histogram[1][p[x + 1]]++;
+                    histogram[2][p[x + 2]]++;
+                }
+            }
+            int half = ((int) block.total() + 1) / 2;
+            cv::Vec3b color;
+            for (int c = 0; c < 3; c++) {
+                int seen = 0, value = 0;
+                while (value < 255 && (seen += histogram[c][value]) < half) value++;
+                color[c] = (uchar) value;
+            }
+            return color;
+        }
+};
+
+#endif // AREA_SAMPLER_H
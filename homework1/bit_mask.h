@@ -0,0 +1,154 @@
+/*******************************************************************************************************************//**
+ * @file bit_mask.h
+ * @brief Bit-packed per-pixel mask with word-at-a-time run scanning
+ **********************************************************************************************************************/
+
+#ifndef BIT_MASK_H
+#define BIT_MASK_H
+
+#include <vector>
+#include <stdint.h>
+#include "opencv2/opencv.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*******************************************************************************************************************//**
+ * @class BitMask
+ *
+ * @brief One bit per pixel, rows padded to whole 64-bit words
+ *
+ * Runs of set or clear bits are found a word at a time with count-trailing-zeros, so scanning a 6000 pixel row
+ * touches roughly 94 words instead of 6000 pixels. Padding bits past the last column are always kept clear.
+ **********************************************************************************************************************/
+class BitMask {
+    private:
+        int mask_rows;
+        int mask_cols;
+        int words_per_row;
+        std::vector<uint64_t> bits;
+
+        static int countTrailingZeros(uint64_t word) {
+            return __builtin_ctzll(word);
+        }
+        static int countLeadingZeros(uint64_t word) {
+            return __builtin_clzll(word);
+        }
+        // bits [lo, hi) of a word, with 0 <= lo < hi <= 64
+        static uint64_t wordRange(int lo, int hi) {
+            uint64_t upper = (hi == 64) ? ~0ULL : ((1ULL << hi) - 1);
+            return upper & ~((1ULL << lo) - 1);
+        }
+    public:
+        BitMask() : mask_rows(0), mask_cols(0), words_per_row(0) {}
+        BitMask(int rows, int cols) { reset(rows, cols); }
+
+        void reset(int rows, int cols) {
+            mask_rows = rows;
+            mask_cols = cols;
+            words_per_row = (cols + 63) / 64;
+            bits.assign((size_t) rows * words_per_row, 0);
+        }
+
+        int rows() const { return mask_rows; }
+        int cols() const { return mask_cols; }
+        uint64_t* row(int y) { return &bits[(size_t) y * words_per_row]; }
+        const uint64_t* row(int y) const { return &bits[(size_t) y * words_per_row]; }
+
+        bool test(int x, int y) const {
+            return (row(y)[x >> 6] >> (x & 63)) & 1;
+        }
+
+        void set(int x, int y) {
+            row(y)[x >> 6] |= 1ULL << (x & 63);
+        }
+
+        // set bits [x0, x1) of row y
+        void setRange(int y, int x0, int x1) {
+            uint64_t* r = row(y);
+            while (x0 < x1) {
+                int w = x0 >> 6;
+                int hi = std::min(x1 - (w << 6), 64);
+                r[w] |= wordRange(x0 & 63, hi);
+                x0 = (w << 6) + hi;
+            }
+        }
+
+        // clear bits [x0, x1) of row y
+        void clearRange(int y, int x0, int x1) {
+            uint64_t* r = row(y);
+            while (x0 < x1) {
+                int w = x0 >> 6;
+                int hi = std::min(x1 - (w << 6), 64);
+                r[w] &= ~wordRange(x0 & 63, hi);
+                x0 = (w << 6) + hi;
+            }
+        }
+
+        // first set bit in [x0, x1) of row y, or x1 if there is none
+        int findSet(int y, int x0, int x1) const {
+            const uint64_t* r = row(y);
+            while (x0 < x1) {
+                int w = x0 >> 6;
+                uint64_t word = r[w] & ~((1ULL << (x0 & 63)) - 1);
+                if (word) return std::min((w << 6) + countTrailingZeros(word), x1);
+                x0 = (w + 1) << 6;
+            }
+            return x1;
+        }
+
+        // first clear bit in [x0, x1) of row y, or x1 if there is none
+        int findClear(int y, int x0, int x1) const {
+            const uint64_t* r = row(y);
+            while (x0 < x1) {
+                int w = x0 >> 6;
+                uint64_t word = ~r[w] & ~((1ULL << (x0 & 63)) - 1);
+                if (word) return std::min((w << 6) + countTrailingZeros(word), x1);
+                x0 = (w + 1) << 6;
+            }
+            return x1;
+        }
+
+        // last clear bit in [x0, x1) of row y, or x0 - 1 if there is none
+        int findLastClear(int y, int x0, int x1) const {
+            const uint64_t* r = row(y);
+            int x = x1 - 1;
+            while (x >= x0) {
+                int w = x >> 6;
+                uint64_t word = ~r[w] & wordRange(0, (x & 63) + 1);
+                if (word) return std::max((w << 6) + 63 - countLeadingZeros(word), x0 - 1);
+                x = (w << 6) - 1;
+            }
+            return x0 - 1;
+        }
+
+        // clear every bit that is clear in other, which must have the same size
+        void intersect(const BitMask& other) {
+            for (size_t i = 0; i < bits.size(); i++) bits[i] &= other.bits[i];
+        }
+
+        // overwrite row y from a byte row where any value with the high bit set (e.g. 255) means set
+        void packRow(int y, const uchar* bytes) {
+            uint64_t* r = row(y);
+            int x = 0;
+            for (int w = 0; w < words_per_row; w++) {
+                uint64_t word = 0;
+                int n = std::min(64, mask_cols - x);
+#if defined(__SSE2__)
+                int b = 0;
+                for (; b + 16 <= n; b += 16) {
+                    __m128i v = _mm_loadu_si128((const __m128i*) (bytes + x + b));
+                    word |= (uint64_t) (uint16_t) _mm_movemask_epi8(v) << b;
+                }
+                for (; b < n; b++) word |= (uint64_t) (bytes[x + b] >> 7) << b;
+#else
+                for (int b = 0; b < n; b++) word |= (uint64_t) (bytes[x + b] >> 7) << b;
+#endif
+                r[w] = word;
+                x += 64;
+            }
+        }
+};
+
+#endif // BIT_MASK_H
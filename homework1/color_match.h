@@ -0,0 +1,86 @@
+/*******************************************************************************************************************//**
+ * @file color_match.h
+ * @brief Row-at-a-time color similarity tests shared by the fill tools
+ **********************************************************************************************************************/
+
+#ifndef COLOR_MATCH_H
+#define COLOR_MATCH_H
+
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "opencv2/core/hal/intrin.hpp"
+
+enum ToleranceMode {tolerance_exact, tolerance_channel, tolerance_euclidean};
+
+/*******************************************************************************************************************//**
+ * @brief How close a pixel has to be to a target color to count as a match
+ *
+ * tolerance_channel accepts pixels whose every channel is within amount of the target, tolerance_euclidean accepts
+ * pixels whose BGR distance is at most amount. Euclidean amounts are clamped to 255 so squared sums fit in 16 bits.
+ **********************************************************************************************************************/
+struct ColorTolerance {
+    ToleranceMode mode;
+    int amount;
+    ColorTolerance(ToleranceMode mode = tolerance_exact, int amount = 0) : mode(mode), amount(amount) {}
+};
+
+inline std::ostream& operator<<(std::ostream& out, const ColorTolerance& tolerance) {
+    switch (tolerance.mode) {
+        case tolerance_channel:
+            return out << "per-channel +/-" << tolerance.amount;
+        case tolerance_euclidean:
+            return out << "euclidean " << tolerance.amount;
+        default:
+            return out << "exact";
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Write 255 to out[i] for every pixel of row[0..n) matching target, 0 otherwise
+ **********************************************************************************************************************/
+inline void matchRow(const cv::Vec3b* row, int n, cv::Vec3b target, const ColorTolerance& tolerance, uchar* out) {
+    cv::Mat src(1, n, CV_8UC3, (void*) row);
+    cv::Mat dst(1, n, CV_8UC1, out);
+
+    if (tolerance.mode != tolerance_euclidean) {
+        int amount = (tolerance.mode == tolerance_channel) ? tolerance.amount : 0;
+        cv::Scalar lower, upper;
+        for (int c = 0; c < 3; c++) {
+            lower[c] = std::max(0, target[c] - amount);
+            upper[c] = std::min(255, target[c] + amount);
+        }
+        cv::inRange(src, lower, upper, dst);
+        return;
+    }
+
+    const uchar* p = (const uchar*) row;
+    int amount = std::min(std::max(tolerance.amount, 0), 255);
+    int limit = amount * amount;
+    int x = 0;
+#if CV_SIMD128
+    const cv::v_uint8x16 vb = cv::v_setall_u8(target[0]);
+    const cv::v_uint8x16 vg = cv::v_setall_u8(target[1]);
+    const cv::v_uint8x16 vr = cv::v_setall_u8(target[2]);
+    const cv::v_uint16x8 vlimit = cv::v_setall_u16((ushort) limit);
+    for (; x <= n - 16; x += 16) {
+        cv::v_uint8x16 b, g, r;
+        cv::v_load_deinterleave(p + 3 * x, b, g, r);
+        cv::v_uint16x8 b0, b1, g0, g1, r0, r1;
+        cv::v_expand(cv::v_absdiff(b, vb), b0, b1);
+        cv::v_expand(cv::v_absdiff(g, vg), g0, g1);
+        cv::v_expand(cv::v_absdiff(r, vr), r0, r1);
+        // 16-bit adds saturate at 65535, which is above any limit we allow
+        cv::v_uint16x8 d0 = b0 * b0 + g0 * g0 + r0 * r0;
+        cv::v_uint16x8 d1 = b1 * b1 + g1 * g1 + r1 * r1;
+        cv::v_store(out + x, cv::v_pack(d0 <= vlimit, d1 <= vlimit));
+    }
+#endif
+    for (; x < n; x++) {
+        int db = p[3 * x] - target[0];
+        int dg = p[3 * x + 1] - target[1];
+        int dr = p[3 * x + 2] - target[2];
+        out[x] = (db * db + dg * dg + dr * dr <= limit) ? 255 : 0;
+    }
+}
+
+#endif // COLOR_MATCH_H
@@ -0,0 +1,195 @@
+/*******************************************************************************************************************//**
+ * @file color_replace.h
+ * @brief Multi-threaded replacement of every pixel matching a color, wherever it is in the image
+ **********************************************************************************************************************/
+
+#ifndef COLOR_REPLACE_H
+#define COLOR_REPLACE_H
+
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "opencv2/core/hal/intrin.hpp"
+#include "color_match.h"
+
+// same as HISTORY_TILE_SIZE, so every tile found is exactly one history patch
+#define REPLACE_TILE_SIZE 64
+
+// true when any of the n match flags is set
+inline bool anyMatch(const uchar* mask, int n) {
+    int x = 0;
+#if CV_SIMD128
+    for (; x <= n - 16; x += 16) {
+        if (cv::v_check_any(cv::v_load(mask + x))) return true;
+    }
+#endif
+    for (; x < n; x++) {
+        if (mask[x]) return true;
+    }
+    return false;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Write color over the n BGR pixels whose match flag is set
+ **********************************************************************************************************************/
+inline void replaceColorRow(uchar* dst, const uchar* mask, cv::Vec3b color, int n) {
+    int x = 0;
+#if CV_SIMD128
+    const cv::v_uint8x16 cb = cv::v_setall_u8(color[0]);
+    const cv::v_uint8x16 cg = cv::v_setall_u8(color[1]);
+    const cv::v_uint8x16 cr = cv::v_setall_u8(color[2]);
+    for (; x <= n - 16; x += 16) {
+        cv::v_uint8x16 m = cv::v_load(mask + x);
+        if (!cv::v_check_any(m)) continue;
+        cv::v_uint8x16 b, g, r;
+        cv::v_load_deinterleave(dst + 3 * x, b, g, r);
+        cv::v_store_interleave(dst + 3 * x, cv::v_select(m, cb, b), cv::v_select(m, cg, g), cv::v_select(m, cr, r));
+    }
+#endif
+    for (; x < n; x++) {
+        if (!mask[x]) continue;
+        dst[3 * x] = color[0];
+        dst[3 * x + 1] = color[1];
+        dst[3 * x + 2] = color[2];
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Make the n premultiplied BGRA pixels whose match flag is set an opaque color
+ **********************************************************************************************************************/
+inline void replaceLayerRow(uchar* dst, const uchar* mask, cv::Vec3b color, int n) {
+    int x = 0;
+#if CV_SIMD128
+    const cv::v_uint8x16 cb = cv::v_setall_u8(color[0]);
+    const cv::v_uint8x16 cg = cv::v_setall_u8(color[1]);
+    const cv::v_uint8x16 cr = cv::v_setall_u8(color[2]);
+    const cv::v_uint8x16 opaque = cv::v_setall_u8(255);
+    for (; x <= n - 16; x += 16) {
+        cv::v_uint8x16 m = cv::v_load(mask + x);
+        if (!cv::v_check_any(m)) continue;
+        cv::v_uint8x16 b, g, r, a;
+        cv::v_load_deinterleave(dst + 4 * x, b, g, r, a);
+        cv::v_store_interleave(dst + 4 * x, cv::v_select(m, cb, b), cv::v_select(m, cg, g), cv::v_select(m, cr, r),
+                               cv::v_select(m, opaque, a));
+    }
+#endif
+    for (; x < n; x++) {
+        if (!mask[x]) continue;
+        dst[4 * x] = color[0];
+        dst[4 * x + 1] = color[1];
+        dst[4 * x + 2] = color[2];
+        dst[4 * x + 3] = 255;
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @class ColorReplace
+ *
+ * @brief Recolors every pixel within tolerance of a target color, connected or not
+ *
+ * Work is split by rows of tiles. A first read-only pass finds the tiles that hold any match, which lets the caller
+ * save exactly those tiles for undo; the second pass matches again and blends the new color in, skipping tiles with
+ * nothing to change. Both passes use the vectorized kernels and run on all cores, so the cost is about two reads and
+ * one write of the changed tiles. The new color can be written to a separate BGRA layer of the same size instead of
+ * the image that is matched.
+ **********************************************************************************************************************/
+class ColorReplace {
+    private:
+        cv::Mat image;
+        cv::Mat output;                 // image itself, or a BGRA layer over it
+        ColorTolerance tolerance;
+        cv::Vec3b target;
+        cv::Vec3b color;
+        int tiles_x;
+        int tiles_y;
+        std::vector<uchar> found;       // one flag per tile
+        std::vector<cv::Rect> tiles;
+
+        class FindTilesBody : public cv::ParallelLoopBody {
+            private:
+                ColorReplace& replace;
+            public:
+                explicit FindTilesBody(ColorReplace& replace) : replace(replace) {}
+                void operator()(const cv::Range& range) const {
+                    const cv::Mat& image = replace.image;
+                    std::vector<uchar> mask(image.cols);
+                    for (int ty = range.start; ty < range.end; ty++) {
+                        uchar* flags = &replace.found[(size_t) ty * replace.tiles_x];
+                        int y_end = std::min(image.rows, (ty + 1) * REPLACE_TILE_SIZE);
+                        for (int y = ty * REPLACE_TILE_SIZE; y < y_end; y++) {
+                            matchRow(image.ptr<cv::Vec3b>(y), image.cols, replace.target, replace.tolerance, &mask[0]);
+                            for (int tx = 0; tx < replace.tiles_x; tx++) {
+                                if (flags[tx]) continue;
+                                int x0 = tx * REPLACE_TILE_SIZE;
+                                flags[tx] = anyMatch(&mask[x0], std::min(REPLACE_TILE_SIZE, image.cols - x0));
+                            }
+                        }
+                    }
+                }
+        };
+
+        class ReplaceBody : public cv::ParallelLoopBody {
+            private:
+                ColorReplace& replace;
+            public:
+                explicit ReplaceBody(ColorReplace& replace) : replace(replace) {}
+                void operator()(const cv::Range& range) const {
+                    const cv::Mat& image = replace.image;
+                    cv::Mat& output = replace.output;
+                    std::vector<uchar> mask(image.cols);
+                    for (int ty = range.start; ty < range.end; ty++) {
+                        const uchar* flags = &replace.found[(size_t) ty * replace.tiles_x];
+                        int y_end = std::min(image.rows, (ty + 1) * REPLACE_TILE_SIZE);
+                        // runs of neighbouring found tiles are handled as one stretch of each row
+                        for (int tx0 = 0; tx0 < replace.tiles_x; tx0++) {
+                            if (!flags[tx0]) continue;
+                            int tx1 = tx0 + 1;
+                            while (tx1 < replace.tiles_x && flags[tx1]) tx1++;
+                            int x0 = tx0 * REPLACE_TILE_SIZE;
+                            int n = std::min(image.cols, tx1 * REPLACE_TILE_SIZE) - x0;
+                            for (int y = ty * REPLACE_TILE_SIZE; y < y_end; y++) {
+                                matchRow(image.ptr<cv::Vec3b>(y) + x0, n, replace.target, replace.tolerance, &mask[0]);
+                                if (output.channels() == 4) {
+                                    replaceLayerRow(output.ptr<uchar>(y) + 4 * x0, &mask[0], replace.color, n);
+                                } else {
+                                    replaceColorRow(output.ptr<uchar>(y) + 3 * x0, &mask[0], replace.color, n);
+                                }
+                            }
+                            tx0 = tx1;
+                        }
+                    }
+                }
+        };
+
+    public:
+        ColorReplace(const cv::Mat& image, const ColorTolerance& tolerance = ColorTolerance())
+            : image(image), tolerance(tolerance), tiles_x(0), tiles_y(0) {}
+
+        // the tiles holding at least one pixel within tolerance of target
+        const std::vector<cv::Rect>& findTiles(cv::Vec3b target) {
+            this->target = target;
+            tiles_x = (image.cols + REPLACE_TILE_SIZE - 1) / REPLACE_TILE_SIZE;
+            tiles_y = (image.rows + REPLACE_TILE_SIZE - 1) / REPLACE_TILE_SIZE;
+            found.assign((size_t) tiles_x * tiles_y, 0);
+            cv::parallel_for_(cv::Range(0, tiles_y), FindTilesBody(*this));
+
+            tiles.clear();
+            for (int ty = 0; ty < tiles_y; ty++) {
+                for (int tx = 0; tx < tiles_x; tx++) {
+                    if (!found[(size_t) ty * tiles_x + tx]) continue;
+                    cv::Rect tile(tx * REPLACE_TILE_SIZE, ty * REPLACE_TILE_SIZE, REPLACE_TILE_SIZE, REPLACE_TILE_SIZE);
+                    tiles.push_back(tile & cv::Rect(0, 0, image.cols, image.rows));
+                }
+            }
+            return tiles;
+        }
+
+        // recolor the matches in the tiles found by the last findTiles() call, in output when it is given
+        void replace(cv::Vec3b color, const cv::Mat& output = cv::Mat()) {
+            this->color = color;
+            this->output = output.empty() ? image : output;
+            if (tiles.empty()) return;
+            cv::parallel_for_(cv::Range(0, tiles_y), ReplaceBody(*this));
+        }
+};
+
+#endif // COLOR_REPLACE_H
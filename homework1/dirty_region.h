@@ -0,0 +1,88 @@
+/*******************************************************************************************************************//**
+ * @file dirty_region.h
+ * @brief Small set of merged rectangles describing which pixels changed since they were last consumed
+ **********************************************************************************************************************/
+
+#ifndef DIRTY_REGION_H
+#define DIRTY_REGION_H
+
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+#define DIRTY_REGION_MAX_RECTS 16
+
+/*******************************************************************************************************************//**
+ * @class DirtyRegion
+ *
+ * @brief Accumulates changed rectangles, merging ones that touch
+ *
+ * A pencil stroke reports thousands of 1x1 rectangles, which collapse into a handful of bounding boxes here. Once the
+ * list reaches DIRTY_REGION_MAX_RECTS, a new rectangle is folded into whichever existing one grows the least.
+ **********************************************************************************************************************/
+class DirtyRegion {
+    private:
+        std::vector<cv::Rect> rects;
+
+        static bool touches(const cv::Rect& a, const cv::Rect& b) {
+            return a.x <= b.x + b.width && b.x <= a.x + a.width && a.y <= b.y + b.height && b.y <= a.y + a.height;
+        }
+
+    public:
+        void add(cv::Rect rect) {
+            if (rect.width <= 0 || rect.height <= 0) return;
+
+            // absorb every rectangle the new one touches, repeating since the union may reach further
+            bool merged = true;
+            while (merged) {
+                merged = false;
+                for (size_t i = 0; i < rects.size(); i++) {
+                    if (touches(rects[i], rect)) {
+                        rect |= rects[i];
+                        rects[i] = rects.back();
+                        rects.pop_back();
+                        merged = true;
+                        break;
+                    }
+                }
+            }
+
+            if (rects.size() < DIRTY_REGION_MAX_RECTS) {
+                rects.push_back(rect);
+                return;
+            }
+            size_t best = 0;
+            double best_growth = -1;
+            for (size_t i = 0; i < rects.size(); i++) {
+                double growth = (double) (rects[i] | rect).area() - rects[i].area();
+                if (best_growth < 0 || growth < best_growth) {
+                    best = i;
+                    best_growth = growth;
+                }
+            }
+            rects[best] |= rect;
+        }
+
+        void add(const DirtyRegion& other) {
+            for (size_t i = 0; i < other.rects.size(); i++) add(other.rects[i]);
+        }
+
+        bool empty() const { return rects.empty(); }
+
+        void clear() { rects.clear(); }
+
+        const std::vector<cv::Rect>& getRects() const { return rects; }
+
+        cv::Rect bounds() const {
+            cv::Rect all;
+            for (size_t i = 0; i < rects.size(); i++) all = all.area() ? (all | rects[i]) : rects[i];
+            return all;
+        }
+
+        // hand the accumulated rectangles to out and start over
+        void take(DirtyRegion& out) {
+            out.rects.swap(rects);
+            rects.clear();
+        }
+};
+
+#endif // DIRTY_REGION_H
@@ -0,0 +1,235 @@
+/*******************************************************************************************************************//**
+ * @file edit_history.h
+ * @brief Tiled undo/redo history that stores only the tiles each edit touched
+ **********************************************************************************************************************/
+
+#ifndef EDIT_HISTORY_H
+#define EDIT_HISTORY_H
+
+#include <deque>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "dirty_region.h"
+#include "layer_stack.h"
+#include "tile_store.h"
+
+#define HISTORY_TILE_SIZE 64
+#define HISTORY_MAX_STEPS 100
+
+/*******************************************************************************************************************//**
+ * @class EditHistory
+ *
+ * @brief Undo/redo stack of tile patches and image swaps
+ *
+ * Tools call capture() for every region they are about to write, and the first capture of a tile in an edit copies that
+ * one tile aside. Undoing or redoing swaps each stored tile with the live pixels, so a step holds one copy per touched
+ * tile no matter how often it is replayed, and tiles nobody touched are never copied. Crop and reset do not write
+ * pixels at all; they only swap the image header, and reset also swaps the painted tiles of a LayerStack for empty
+ * ones, so the previous buffer and tiles stay shared rather than duplicated. Stored tiles come from a TilePool when one
+ * is set, as for a tiled image, so undo data pages out to disk like the image itself instead of growing with every edit
+ * in RAM.
+ **********************************************************************************************************************/
+class EditHistory {
+    private:
+        struct TilePatch {
+            cv::Rect rect;      // tile position within the image undo reports changes in
+            cv::Mat live;       // header into the edited image, sharing its pixels
+            cv::Mat stored;     // the other version of the same tile
+        };
+
+        struct Edit {
+            std::string name;
+            std::vector<TilePatch> patches;
+            bool swaps_image;
+            cv::Mat image;      // the other image header, for crop and reset
+            LayerStack* layers;                 // the stack reset took the painted tiles of, NULL for other edits
+            LayerStack::TileSet layer_tiles;    // the other set of painted tiles, for reset
+            Edit() : swaps_image(false), layers(NULL) {}
+        };
+
+        std::deque<Edit> undo_stack;
+        std::vector<Edit> redo_stack;
+        Edit pending;
+        bool recording;
+        // tiles already captured by the pending edit, one flag per tile, keyed by the target's first pixel
+        std::map<const uchar*, std::vector<uchar> > captured;
+        TilePool* pool;
+
+        // exchange the live and stored pixels in place, so the stored tile keeps its slot
+        void swapTile(TilePatch& patch) {
+            if (pool) {
+                pool->touch(patch.live);
+                pool->touch(patch.stored);
+            }
+            size_t row_bytes = patch.live.cols * patch.live.elemSize();
+            for (int y = 0; y < patch.live.rows; y++) {
+                uchar* live = patch.live.ptr<uchar>(y);
+                std::swap_ranges(live, live + row_bytes, patch.stored.ptr<uchar>(y));
+            }
+        }
+
+        // give back the stored tiles of an edit that is being forgotten
+        void release(const Edit& edit) {
+            if (!pool) return;
+            for (size_t i = 0; i < edit.patches.size(); i++) pool->free(edit.patches[i].stored);
+            LayerStack::TileSet::const_iterator layer;
+            for (layer = edit.layer_tiles.begin(); layer != edit.layer_tiles.end(); ++layer) {
+                std::map<int, cv::Mat>::const_iterator tile;
+                for (tile = layer->second.begin(); tile != layer->second.end(); ++tile) pool->free(tile->second);
+            }
+        }
+
+        static size_t patchBytes(const Edit& edit) {
+            size_t total = 0;
+            for (size_t i = 0; i < edit.patches.size(); i++) {
+                total += edit.patches[i].stored.total() * edit.patches[i].stored.elemSize();
+            }
+            return total;
+        }
+
+        void apply(Edit& edit, cv::Mat& image, DirtyRegion& changed) {
+            for (size_t i = 0; i < edit.patches.size(); i++) {
+                swapTile(edit.patches[i]);
+                changed.add(edit.patches[i].rect);
+            }
+            if (edit.layers) edit.layers->swapTiles(edit.layer_tiles);
+            if (edit.swaps_image) {
+                std::swap(image, edit.image);
+                changed.add(cv::Rect(0, 0, image.cols, image.rows));
+            }
+        }
+
+    public:
+        EditHistory() : recording(false), pool(NULL) {}
+
+        // keep stored tiles in pool from now on, which must outlive the history; NULL keeps them on the heap
+        void setPool(TilePool* pool) {
+            clear();
+            this->pool = pool;
+        }
+
+        void begin(const std::string& name) {
+            if (recording) release(pending);
+            pending = Edit();
+            pending.name = name;
+            captured.clear();
+            recording = true;
+        }
+
+        bool isRecording() const { return recording; }
+
+        // copy aside every tile of target overlapping region that this edit has not captured yet; origin is where
+        // target lies in the image undo and redo report changed rectangles in, for a target that is one layer tile
+        void capture(const cv::Mat& target, cv::Rect region, cv::Point origin = cv::Point()) {
+            if (!recording) return;
+            region &= cv::Rect(0, 0, target.cols, target.rows);
+            if (region.area() <= 0) return;
+
+            int tiles_x = (target.cols + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE;
+            int tiles_y = (target.rows + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE;
+            std::vector<uchar>& flags = captured[target.ptr()];
+            if (flags.empty()) flags.assign((size_t) tiles_x * tiles_y, 0);
+
+            int tx0 = region.x / HISTORY_TILE_SIZE, tx1 = (region.x + region.width - 1) / HISTORY_TILE_SIZE;
+            int ty0 = region.y / HISTORY_TILE_SIZE, ty1 = (region.y + region.height - 1) / HISTORY_TILE_SIZE;
+            for (int ty = ty0; ty <= ty1; ty++) {
+                for (int tx = tx0; tx <= tx1; tx++) {
+                    uchar& flag = flags[(size_t) ty * tiles_x + tx];
+                    if (flag) continue;
+                    flag = 1;
+                    cv::Rect tile(tx * HISTORY_TILE_SIZE, ty * HISTORY_TILE_SIZE, HISTORY_TILE_SIZE, HISTORY_TILE_SIZE);
+                    tile &= cv::Rect(0, 0, target.cols, target.rows);
+                    TilePatch patch;
+                    patch.rect = cv::Rect(tile.tl() + origin, tile.size());
+                    patch.live = target(tile);
+                    if (pool) {
+                        patch.stored = pool->allocate(tile.height, tile.width, target.type());
+                        patch.live.copyTo(patch.stored);
+                    } else {
+                        patch.stored = patch.live.clone();
+                    }
+                    pending.patches.push_back(patch);
+                }
+            }
+        }
+
+        // record that the edit replaces the whole image header, keeping previous for undo
+        void replaceImage(const cv::Mat& previous) {
+            if (!recording) return;
+            pending.swaps_image = true;
+            pending.image = previous;
+        }
+
+        // record that the edit takes every painted tile out of layers, leaving them empty; the tiles are kept rather
+        // than copied and go back into the stack on undo
+        void replaceLayers(LayerStack& layers) {
+            if (!recording) return;
+            pending.layers = &layers;
+            layers.swapTiles(pending.layer_tiles);
+        }
+
+        void commit() {
+            if (!recording) return;
+            recording = false;
+            captured.clear();
+            if (pending.patches.empty() && !pending.swaps_image && !pending.layers) return;
+            undo_stack.push_back(pending);
+            pending = Edit();
+            for (size_t i = 0; i < redo_stack.size(); i++) release(redo_stack[i]);
+            redo_stack.clear();
+            while (undo_stack.size() > HISTORY_MAX_STEPS) {
+                release(undo_stack.front());
+                undo_stack.pop_front();
+            }
+        }
+
+        // restore the state before the last edit, returning false when there is nothing to undo
+        bool undo(cv::Mat& image, DirtyRegion& changed) {
+            if (recording) commit();
+            if (undo_stack.empty()) return false;
+            Edit edit = undo_stack.back();
+            undo_stack.pop_back();
+            std::cout << "Undoing " << edit.name << std::endl;
+            apply(edit, image, changed);
+            redo_stack.push_back(edit);
+            return true;
+        }
+
+        // reapply the last undone edit, returning false when there is nothing to redo
+        bool redo(cv::Mat& image, DirtyRegion& changed) {
+            if (recording) commit();
+            if (redo_stack.empty()) return false;
+            Edit edit = redo_stack.back();
+            redo_stack.pop_back();
+            std::cout << "Redoing " << edit.name << std::endl;
+            apply(edit, image, changed);
+            undo_stack.push_back(edit);
+            return true;
+        }
+
+        // forget every edit, for when the pixels they point into are rewritten underneath them
+        void clear() {
+            for (size_t i = 0; i < undo_stack.size(); i++) release(undo_stack[i]);
+            for (size_t i = 0; i < redo_stack.size(); i++) release(redo_stack[i]);
+            if (recording) release(pending);
+            undo_stack.clear();
+            redo_stack.clear();
+            pending = Edit();
+            captured.clear();
+            recording = false;
+        }
+
+        // bytes held by stored tiles, which excludes image headers shared with live buffers
+        size_t storedBytes() const {
+            size_t total = 0;
+            for (size_t i = 0; i < undo_stack.size(); i++) total += patchBytes(undo_stack[i]);
+            for (size_t i = 0; i < redo_stack.size(); i++) total += patchBytes(redo_stack[i]);
+            return total;
+        }
+};
+
+#endif // EDIT_HISTORY_H
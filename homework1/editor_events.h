@@ -0,0 +1,132 @@
+/*******************************************************************************************************************//**
+ * @file editor_events.h
+ * @brief Compact input events and the lock-free queue that carries them to the editing thread
+ **********************************************************************************************************************/
+
+#ifndef EDITOR_EVENTS_H
+#define EDITOR_EVENTS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <chrono>
+#include <vector>
+
+#define EVENT_QUEUE_CAPACITY 4096
+
+enum EditorEventType {mouse_event, key_event};
+
+// one HighGUI mouse callback or key press, small enough to copy by value
+struct EditorEvent {
+    short type;
+    short code;     // cv::EVENT_* for mouse events, the key for key events
+    int x;
+    int y;
+    int flags;
+    EditorEvent(short type = mouse_event, short code = 0, int x = 0, int y = 0, int flags = 0)
+        : type(type), code(code), x(x), y(y), flags(flags) {}
+};
+
+/*******************************************************************************************************************//**
+ * @class SpscQueue
+ *
+ * @brief Fixed-capacity ring buffer for exactly one producer thread and one consumer thread
+ *
+ * Each index is written by only one side, so push and pop are a handful of loads and stores with acquire/release
+ * ordering and never take a lock. Capacity must be a power of two.
+ **********************************************************************************************************************/
+template<typename T, unsigned Capacity>
+class SpscQueue {
+    private:
+        T slots[Capacity];
+        alignas(64) std::atomic<unsigned> head;    // next slot to read, advanced by the consumer
+        alignas(64) std::atomic<unsigned> tail;    // next slot to write, advanced by the producer
+
+    public:
+        SpscQueue() : head(0), tail(0) {}
+
+        bool push(const T& item) {
+            unsigned t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) == Capacity) return false;
+            slots[t & (Capacity - 1)] = item;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(T& item) {
+            unsigned h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) return false;
+            item = slots[h & (Capacity - 1)];
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool empty() const {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        }
+};
+
+/*******************************************************************************************************************//**
+ * @class EventInbox
+ *
+ * @brief Lossless hand-off of input events from the HighGUI thread to the editing thread
+ *
+ * post() never waits on the editing thread. If the editing thread falls so far behind that the ring fills up, events
+ * wait in an overflow list owned by the posting thread and are moved over, in order, on later posts or retry() calls.
+ * A sleeping consumer is woken with a condition variable. The producer takes the wake lock around the notify, so the
+ * consumer cannot miss a post between finding the ring empty and going to sleep, and may sleep without a timeout.
+ **********************************************************************************************************************/
+class EventInbox {
+    private:
+        SpscQueue<EditorEvent, EVENT_QUEUE_CAPACITY> queue;
+        std::vector<EditorEvent> overflow;
+        std::mutex wake_lock;
+        std::condition_variable wake;
+        bool closed;
+
+        void notify() {
+            std::lock_guard<std::mutex> lock(wake_lock);
+            wake.notify_one();
+        }
+
+    public:
+        EventInbox() : closed(false) {}
+
+        // producer side
+        void post(const EditorEvent& event) {
+            retry();
+            if (!overflow.empty() || !queue.push(event)) overflow.push_back(event);
+            notify();
+        }
+
+        // producer side, moves as much of the overflow list into the ring as fits
+        void retry() {
+            size_t moved = 0;
+            while (moved < overflow.size() && queue.push(overflow[moved])) moved++;
+            if (moved == 0) return;
+            overflow.erase(overflow.begin(), overflow.begin() + moved);
+            notify();
+        }
+
+        // producer side, wakes the consumer for good so it can see it should stop
+        void close() {
+            std::lock_guard<std::mutex> lock(wake_lock);
+            closed = true;
+            wake.notify_one();
+        }
+
+        // consumer side
+        bool next(EditorEvent& event) {
+            return queue.pop(event);
+        }
+
+        // consumer side, sleeps until an event is posted, the inbox is closed or millis pass (never, if negative)
+        void waitFor(int millis) {
+            std::unique_lock<std::mutex> lock(wake_lock);
+            if (!queue.empty() || closed) return;
+            if (millis < 0) wake.wait(lock);
+            else wake.wait_for(lock, std::chrono::milliseconds(millis));
+        }
+};
+
+#endif // EDITOR_EVENTS_H
@@ -0,0 +1,67 @@
+/*******************************************************************************************************************//**
+ * @file frame_mailbox.h
+ * @brief Double-buffered hand-off of finished frames from the editing thread to the display thread
+ **********************************************************************************************************************/
+
+#ifndef FRAME_MAILBOX_H
+#define FRAME_MAILBOX_H
+
+#include <mutex>
+#include <string>
+#include "opencv2/opencv.hpp"
+#include "dirty_region.h"
+
+/*******************************************************************************************************************//**
+ * @class FrameMailbox
+ *
+ * @brief Keeps the frame on screen stable while the next one is prepared
+ *
+ * The editing thread writes into a back buffer without holding the lock, copying only the rectangles that changed
+ * since that buffer was last written (this frame's and the previous frame's dirty regions). Publishing swaps the
+ * buffers under the lock, so the display thread is never held up by more than a pointer swap.
+ **********************************************************************************************************************/
+class FrameMailbox {
+    private:
+        std::mutex lock;
+        cv::Mat front;
+        cv::Mat back;
+        DirtyRegion back_stale;     // changed in the front buffer since back was last written
+        bool fresh;
+
+    public:
+        FrameMailbox() : fresh(false) {}
+
+        // editing thread
+        void publish(const cv::Mat& image, const DirtyRegion& dirty) {
+            if (back.rows != image.rows || back.cols != image.cols) {
+                back = image.clone();
+                back_stale.clear();
+                back_stale.add(cv::Rect(0, 0, image.cols, image.rows));
+            } else {
+                DirtyRegion copy = back_stale;
+                copy.add(dirty);
+                const std::vector<cv::Rect>& rects = copy.getRects();
+                for (size_t i = 0; i < rects.size(); i++) {
+                    cv::Rect rect = rects[i] & cv::Rect(0, 0, image.cols, image.rows);
+                    if (rect.area() > 0) image(rect).copyTo(back(rect));
+                }
+                back_stale = dirty;
+            }
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                cv::swap(front, back);
+                fresh = true;
+            }
+        }
+
+        // display thread, shows the newest frame if it has not been shown yet
+        bool show(const std::string& window_name) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!fresh) return false;
+            cv::imshow(window_name, front);
+            fresh = false;
+            return true;
+        }
+};
+
+#endif // FRAME_MAILBOX_H
@@ -24,8 +24,16 @@
 // include necessary dependencies
 #include <iostream>
 #include <string>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
 #include "opencv2/opencv.hpp"
 #include "image_state.cpp"
+#include "render_scheduler.h"
+#include "editor_events.h"
+#include "frame_mailbox.h"
+#include "viewport.h"
+#include "image_loader.h"
 
 // function prototypes
 static void clickCallback(int event, int x, int y, int flags, void* userdata);
@@ -33,7 +41,13 @@ static void eyedropperTool(int event, int x, int y, int flags, void* userdata);
 static void cropTool(int event, int x, int y, int flags, void* userdata);
 static void pencilTool(int event, int x, int y, int flags, void* userdata);
 static void paintBucketTool(int event, int x, int y, int flags, void* userdata);
+static void replaceAllTool(int event, int x, int y, int flags, void* userdata);
+static void magicWandTool(int event, int x, int y, int flags, void* userdata);
 static void resetTool(int event, int x, int y, int flags, void* userdata);
+static void keyCommand(int key, ImageState* imageStateRef);
+static bool viewCommand(int key, Viewport* viewport);
+static int runReplay(const std::string& logPath, const std::string& inputDir, const std::string& outputDir, int threads);
+static void queueCallback(int event, int x, int y, int flags, void* userdata);
 
 static void eyedropperTool(int event, int x, int y, int flags, void* userdata) {
     ImageState* imageStateRef = (ImageState*) userdata;
@@ -51,6 +65,9 @@ static void eyedropperTool(int event, int x, int y, int flags, void* userdata) {
     }
     else if(event == cv::EVENT_MBUTTONDOWN)
     {
+        imageStateRef->cycleEyedropperSize();
+        std::cout << "Eyedropper now samples " << imageStateRef->getEyedropperSize() << "x"
+                  << imageStateRef->getEyedropperSize() << " pixels" << std::endl;
     }
     else if(event == cv::EVENT_MOUSEMOVE)
     {
@@ -91,6 +108,11 @@ static void pencilTool(int event, int x, int y, int flags, void* userdata) {
     {
         if(imageStateRef->getPencilActive()) imageStateRef->pencilDraw(x,y);
     } 
+    else if(event == cv::EVENT_MBUTTONDOWN)
+    {
+        imageStateRef->cycleBrushRadius();
+        std::cout << "Pencil brush is now " << imageStateRef->getBrush() << std::endl;
+    }
     else if(event == cv::EVENT_RBUTTONDOWN)
     {
         imageStateRef->toggleTool();
@@ -106,6 +128,52 @@ static void paintBucketTool(int event, int x, int y, int flags, void* userdata)
     {
         imageStateRef->paintBucketFill(x,y);
     }
+    else if(event == cv::EVENT_MBUTTONDOWN)
+    {
+        imageStateRef->cycleFillTolerance();
+        std::cout << "Paint bucket tolerance is now " << imageStateRef->getFillTolerance() << std::endl;
+    }
+    else if(event == cv::EVENT_RBUTTONDOWN)
+    {
+        imageStateRef->toggleTool();
+        std::cout << "Tool is now set to " << imageStateRef->getTool() << std::endl;
+    }
+}
+
+
+static void replaceAllTool(int event, int x, int y, int flags, void* userdata) {
+    ImageState* imageStateRef = (ImageState*) userdata;
+
+    if(event == cv::EVENT_LBUTTONDOWN)
+    {
+        imageStateRef->replaceAll(x,y);
+    }
+    else if(event == cv::EVENT_MBUTTONDOWN)
+    {
+        imageStateRef->cycleFillTolerance();
+        std::cout << "Replace tolerance is now " << imageStateRef->getFillTolerance() << std::endl;
+    }
+    else if(event == cv::EVENT_RBUTTONDOWN)
+    {
+        imageStateRef->toggleTool();
+        std::cout << "Tool is now set to " << imageStateRef->getTool() << std::endl;
+    }
+}
+
+
+static void magicWandTool(int event, int x, int y, int flags, void* userdata) {
+    ImageState* imageStateRef = (ImageState*) userdata;
+
+    if(event == cv::EVENT_LBUTTONDOWN)
+    {
+        // ctrl-click adds to the selection
+        imageStateRef->selectRegion(x, y, (flags & cv::EVENT_FLAG_CTRLKEY) != 0);
+    }
+    else if(event == cv::EVENT_MBUTTONDOWN)
+    {
+        imageStateRef->cycleFillTolerance();
+        std::cout << "Selection tolerance is now " << imageStateRef->getFillTolerance() << std::endl;
+    }
     else if(event == cv::EVENT_RBUTTONDOWN)
     {
         imageStateRef->toggleTool();
@@ -156,6 +224,12 @@ static void clickCallback(int event, int x, int y, int flags, void* userdata)
         case paint_bucket:
             paintBucketTool(event, x, y, flags, userdata);
             break;
+        case replace_all:
+            replaceAllTool(event, x, y, flags, userdata);
+            break;
+        case magic_wand:
+            magicWandTool(event, x, y, flags, userdata);
+            break;
         case reset:
             resetTool(event, x, y, flags, userdata);
             break;
@@ -165,6 +239,246 @@ static void clickCallback(int event, int x, int y, int flags, void* userdata)
     }
 }
 
+/*******************************************************************************************************************//**
+ * @brief prints the layer stack from the top down, marking the selected layer and the hidden ones
+ * @param[in] imageStateRef image state owned by the editing thread
+ **********************************************************************************************************************/
+static void printLayers(ImageState* imageStateRef)
+{
+    if(imageStateRef->getLayerCount() == 0)
+    {
+        std::cout << "No layers yet, each tool adds its own layer the first time it paints" << std::endl;
+        return;
+    }
+    std::cout << "Layers, top first:" << std::endl;
+    for(int i = imageStateRef->getLayerCount() - 1; i >= 0; i--)
+    {
+        std::cout << (i == imageStateRef->getSelectedLayer() ? " > " : "   ") << imageStateRef->getLayerName(i)
+                  << (imageStateRef->getLayerVisible(i) ? "" : " (hidden)") << std::endl;
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief handler for keys that are not tied to the current tool
+ * @param[in] key key code returned by cv::waitKey
+ * @param[in] imageStateRef image state owned by the editing thread
+ **********************************************************************************************************************/
+static void keyCommand(int key, ImageState* imageStateRef)
+{
+    if(key == 'u') imageStateRef->undo();
+    else if(key == 'r') imageStateRef->redo();
+    else if(key == 'd')
+    {
+        imageStateRef->clearSelection();
+        std::cout << "Nothing is selected" << std::endl;
+    }
+    else if(key == 'm')
+    {
+        imageStateRef->toggleEyedropperMedian();
+        std::cout << "Eyedropper now takes the " << (imageStateRef->getEyedropperMedian() ? "median" : "mean")
+                  << " color" << std::endl;
+    }
+    else if(key == 'o' || key == 'a')
+    {
+        if(key == 'o') imageStateRef->cycleBrushOpacity();
+        else imageStateRef->toggleBrushAntialiasing();
+        std::cout << "Pencil brush is now " << imageStateRef->getBrush() << std::endl;
+    }
+    else if(key == 'n' || key == 'h' || key == 'f' || key == 'b')
+    {
+        if(key == 'n') imageStateRef->selectNextLayer();
+        else if(key == 'h') imageStateRef->toggleLayer();
+        else imageStateRef->moveLayer(key == 'f' ? 1 : -1);
+        printLayers(imageStateRef);
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief handler for keys that move the view, '+' and '-' zoom, 'i' 'j' 'k' 'l' pan and '0' shows the whole image
+ * @param[in] key key code returned by cv::waitKey
+ * @param[in] viewport view of the image owned by the editing thread
+ * @return true when the key changed the view
+ **********************************************************************************************************************/
+static bool viewCommand(int key, Viewport* viewport)
+{
+    cv::Size size = viewport->getFrameSize();
+    cv::Point center(size.width / 2, size.height / 2);
+    if(key == '+' || key == '=') viewport->zoomBy(1, center);
+    else if(key == '-') viewport->zoomBy(-1, center);
+    else if(key == '0') viewport->fit();
+    else if(key == 'i') viewport->pan(0, -size.height / 4);
+    else if(key == 'k') viewport->pan(0, size.height / 4);
+    else if(key == 'j') viewport->pan(-size.width / 4, 0);
+    else if(key == 'l') viewport->pan(size.width / 4, 0);
+    else return false;
+    return true;
+}
+
+// state shared between the HighGUI thread and the editing thread
+struct EditorSession {
+    ImageState* imageState;
+    EventInbox inbox;
+    FrameMailbox mailbox;
+    std::atomic<bool> running;
+    double frameRate;
+};
+
+/*******************************************************************************************************************//**
+ * @brief HighGUI mouse callback, only queues the event for the editing thread
+ * @param[in] event mouse event type
+ * @param[in] x column of the mouse in the window
+ * @param[in] y row of the mouse in the window
+ * @param[in] flags mouse event flags
+ * @param[in] userdata the EditorSession
+ **********************************************************************************************************************/
+static void queueCallback(int event, int x, int y, int flags, void* userdata)
+{
+    EditorSession* session = (EditorSession*) userdata;
+    session->inbox.post(EditorEvent(mouse_event, (short) event, x, y, flags));
+}
+
+/*******************************************************************************************************************//**
+ * @brief editing thread, the only thread that touches the ImageState
+ *
+ * Runs every queued event through the tools, coalescing runs of mouse moves that no tool needs one by one, then
+ * rasterizes pending pencil samples and publishes a frame when the scheduler says one is due. Mouse positions are
+ * window pixels of the viewport and are mapped to image pixels before any tool sees them.
+ *
+ * @param[in] session state shared with the HighGUI thread
+ **********************************************************************************************************************/
+static void editorWorker(EditorSession* session)
+{
+    ImageState* imageState = session->imageState;
+    RenderScheduler renderer(session->frameRate);
+    Viewport viewport;
+    DirtyRegion frameDirty;
+    std::vector<EditorEvent> batch;
+
+    while(session->running)
+    {
+        batch.clear();
+        EditorEvent event;
+        while(session->inbox.next(event)) batch.push_back(event);
+
+        for(size_t i = 0; i < batch.size(); i++)
+        {
+            const EditorEvent& e = batch[i];
+            if(e.type == key_event)
+            {
+                if(viewCommand(e.code, &viewport)) renderer.invalidate();
+                else keyCommand(e.code, imageState);
+                continue;
+            }
+            if(e.code == cv::EVENT_MOUSEWHEEL)
+            {
+                viewport.zoomBy(cv::getMouseWheelDelta(e.flags) > 0 ? 1 : -1, cv::Point(e.x, e.y));
+                renderer.invalidate();
+                continue;
+            }
+            bool nextIsMove = i + 1 < batch.size() && batch[i + 1].type == mouse_event &&
+                              batch[i + 1].code == cv::EVENT_MOUSEMOVE;
+            if(e.code == cv::EVENT_MOUSEMOVE && nextIsMove && !imageState->getPencilActive()) continue;
+            cv::Point p = viewport.toImage(e.x, e.y);
+            clickCallback(e.code, p.x, p.y, e.flags, imageState);
+        }
+
+        // pencil samples gathered since the last pass are rasterized as one batch
+        imageState->flushPencil();
+        if(renderer.frameDue(imageState->getDirtyRegion()))
+        {
+            frameDirty.clear();
+            const cv::Mat& frame = viewport.render(imageState->getCurrentImage(), imageState->getTileStore(),
+                                                   renderer.getPending(), frameDirty);
+            session->mailbox.publish(frame, frameDirty);
+            renderer.presented();
+        }
+        // an idle editor sleeps until the next event, a pending frame only until it is due
+        session->inbox.waitFor(renderer.waitMillis());
+    }
+}
+
+// work shared by the replay threads
+struct ReplayJob {
+    std::vector<Operation> operations;
+    std::vector<cv::String> inputs;
+    std::string outputDir;
+    std::atomic<size_t> next;
+    std::atomic<int> failures;
+};
+
+/*******************************************************************************************************************//**
+ * @brief replay thread, takes the next unclaimed image until none are left
+ *
+ * Every thread decodes, edits and encodes its own image, so while one thread is blocked on a file another is editing
+ * and the three stages overlap across the pool without any hand-off between threads.
+ *
+ * @param[in] job images to edit and the operations to apply to each
+ **********************************************************************************************************************/
+static void replayWorker(ReplayJob* job)
+{
+    for(size_t i = job->next++; i < job->inputs.size(); i = job->next++)
+    {
+        const std::string path = job->inputs[i];
+        cv::Mat image = cv::imread(path, CV_LOAD_IMAGE_COLOR);
+        if(!image.data)
+        {
+            std::cout << "Error while opening file " << path << std::endl;
+            job->failures++;
+            continue;
+        }
+
+        ImageState state(image);
+        for(size_t op = 0; op < job->operations.size(); op++) state.applyOperation(job->operations[op]);
+
+        std::string outputPath = job->outputDir + "/" + path.substr(path.find_last_of("/\\") + 1);
+        if(!cv::imwrite(outputPath, state.getCurrentImage()))
+        {
+            std::cout << "Error while writing file " << outputPath << std::endl;
+            job->failures++;
+        }
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief applies a recorded operation log to every image in a directory without opening any windows
+ * @param[in] logPath operation log written with --record
+ * @param[in] inputDir directory of images to edit
+ * @param[in] outputDir existing directory the edited images are written to under their original names
+ * @param[in] threads number of images edited at once, 0 for one per core
+ * @return return code (0 when every image was edited and written)
+ **********************************************************************************************************************/
+static int runReplay(const std::string& logPath, const std::string& inputDir, const std::string& outputDir, int threads)
+{
+    ReplayJob job;
+    if(!OperationLog::load(logPath, job.operations)) return 1;
+    cv::glob(inputDir + "/*", job.inputs, false);
+    if(job.inputs.empty())
+    {
+        std::cout << "No images found in " << inputDir << std::endl;
+        return 1;
+    }
+    job.outputDir = outputDir;
+    job.next = 0;
+    job.failures = 0;
+
+    if(threads <= 0) threads = cv::getNumberOfCPUs();
+    threads = std::max(1, std::min(threads, (int) job.inputs.size()));
+    // the pool already keeps every core busy, OpenCV's own loops only get what is left over
+    cv::setNumThreads(std::max(1, cv::getNumberOfCPUs() / threads));
+
+    std::cout << "Replaying " << job.operations.size() << " operations on " << job.inputs.size() << " images with "
+              << threads << " threads" << std::endl;
+    int64 start = cv::getTickCount();
+    std::vector<std::thread> pool;
+    for(int i = 0; i < threads; i++) pool.push_back(std::thread(replayWorker, &job));
+    for(size_t i = 0; i < pool.size(); i++) pool[i].join();
+    double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+    std::cout << "Edited " << job.inputs.size() - job.failures << " of " << job.inputs.size() << " images in "
+              << seconds << " s (" << job.inputs.size() / seconds << " images/s)" << std::endl;
+    return job.failures > 0 ? 1 : 0;
+}
+
 /*******************************************************************************************************************//**
  * @brief program entry point
  * @param[in] argc number of command line arguments
@@ -174,24 +488,134 @@ static void clickCallback(int event, int x, int y, int flags, void* userdata)
  **********************************************************************************************************************/
 int main(int argc, char **argv)
 {
-    // open the input image
+    // the image to edit comes first, test.png when it is left out, e.g. ./homework1 photo.jpg --fps 30
+    // --tiled keeps the image in memory-mapped files instead of RAM, --cache-mb N bounds how much of it stays resident
+    // --record ops.log writes every edit to a log, --replay ops.log in_dir out_dir applies it to a directory of images
+    // --fresh ignores the autosave journal of the last session instead of recovering it
+    double frameRate = DEFAULT_RENDER_FPS;
+    bool tiled = false;
+    size_t cacheBytes = DEFAULT_TILE_CACHE_BYTES;
+    std::string recordPath;
+    bool fresh = false;
+    int replayThreads = 0;
+    std::vector<std::string> replayArgs;
     std::string inputFileName = "test.png";
-	cv::Mat imageIn;
-	imageIn = cv::imread(inputFileName, CV_LOAD_IMAGE_COLOR);
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if(arg == "--fps" && i + 1 < argc)
+        {
+            // from 1 frame a second up to the 1 ms poll of the HighGUI loop; 0 from a non-number and NaN fail both
+            frameRate = atof(argv[++i]);
+            if(!(frameRate >= 1)) frameRate = 1;
+            if(!(frameRate <= 1000)) frameRate = 1000;
+        }
+        else if(arg == "--tiled") tiled = true;
+        else if(arg == "--cache-mb" && i + 1 < argc) cacheBytes = (size_t) atol(argv[++i]) << 20;
+        else if(arg == "--record" && i + 1 < argc) recordPath = argv[++i];
+        else if(arg == "--fresh") fresh = true;
+        else if(arg == "--threads" && i + 1 < argc) replayThreads = atoi(argv[++i]);
+        else if(arg == "--replay" && i + 3 < argc)
+        {
+            replayArgs.assign(argv + i + 1, argv + i + 4);
+            i += 3;
+        }
+        else if(!arg.empty() && arg[0] != '-') inputFileName = arg;
+    }
+    if(!replayArgs.empty()) return runReplay(replayArgs[0], replayArgs[1], replayArgs[2], replayThreads);
 
-	// check for file error
-	if(!imageIn.data)
-	{
-		std::cout << "Error while opening file " << inputFileName << std::endl;
-		return 0;
-	}
+    // open the input image
+    EditorSession session;
+    TileStore* tileStore = NULL;
+    Journal journal;
+    if(tiled)
+    {
+        tileStore = new TileStore();
+        if(!tileStore->open(inputFileName, cacheBytes))
+        {
+            std::cout << "Error while opening file " << inputFileName << std::endl;
+            delete tileStore;
+            return 0;
+        }
+        session.imageState = new ImageState(tileStore);
+    }
+    else
+    {
+        // a preview goes up at once while the image decodes, the tools only start once the whole image is in;
+        // autosave to a journal next to the image, tiled images are left out as a checkpoint holds the whole image
+        std::string journalPath = inputFileName + ".journal";
+        int64 start = cv::getTickCount();
+        ImageLoader loader;
+        loader.start(inputFileName, fresh ? std::string() : journalPath);
+        if(!loader.getPreview().empty())
+        {
+            cv::namedWindow("imageIn", cv::WINDOW_AUTOSIZE);
+            cv::imshow("imageIn", loader.getPreview());
+            std::cout << "Showing a preview after " << (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency()
+                      << " ms, the tools start once " << inputFileName << " is loaded" << std::endl;
+            while(!loader.ready())
+            {
+                int key = cv::waitKey(10);
+                if(key == 27 || key == 'q' || cv::getWindowProperty("imageIn", cv::WND_PROP_AUTOSIZE) < 0)
+                {
+                    loader.abandon();
+                    return 0;
+                }
+            }
+        }
+        cv::Mat imageIn = loader.wait();
 
-    ImageState* imageState = new ImageState(imageIn);
+        // check for file error
+        if(!imageIn.data)
+        {
+            std::cout << "Error while opening file " << inputFileName << std::endl;
+            return 0;
+        }
+        std::cout << "Loaded " << imageIn.cols << "x" << imageIn.rows << " pixels after "
+                  << (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency() << " ms" << std::endl;
+        if(loader.wasRecovered())
+        {
+            std::cout << "Recovered the last session from " << journalPath << ", run with --fresh to discard it" << std::endl;
+        }
 
-	
-    // display the input image
-	cv::imshow("imageIn", imageState->getCurrentImage());
-	cv::setMouseCallback("imageIn", clickCallback, imageState);
-	cv::waitKey();
-}
+        session.imageState = new ImageState(imageIn);
+        if(journal.open(journalPath, inputFileName, imageIn)) session.imageState->setJournal(&journal);
+        else std::cout << "Error while opening journal " << journalPath << std::endl;
+    }
+    session.running = true;
+    OperationLog operationLog;
+    if(!recordPath.empty())
+    {
+        if(operationLog.open(recordPath)) session.imageState->setOperationLog(&operationLog);
+        else std::cout << "Error while opening operation log " << recordPath << std::endl;
+    }
+    session.frameRate = frameRate;
+
+    // the editing thread publishes the first frame as soon as it starts
+	cv::namedWindow("imageIn", cv::WINDOW_AUTOSIZE);
+	cv::setMouseCallback("imageIn", queueCallback, &session);
+    std::thread worker(editorWorker, &session);
 
+    // this thread only moves input to the editing thread and shows the frames it publishes
+    // 'u' undoes and 'r' redoes the last edit, 'o' and 'a' change pencil opacity and antialiasing, escape or 'q' quits
+    // 'm' switches the eyedropper between the mean and median of its window
+    // 'n' selects a layer, 'h' hides or shows it, 'f' and 'b' move it up or down the stack
+    // 'd' clears the magic wand selection
+    // the mouse wheel, '+' and '-' zoom, 'i' 'j' 'k' 'l' pan and '0' fits the whole image in the window
+    int pollMillis = std::max(1, (int) (1000.0 / frameRate));
+    int key = 0;
+    while(key != 27 && key != 'q') {
+        key = cv::waitKey(pollMillis);
+        if(key >= 0) session.inbox.post(EditorEvent(key_event, (short) key));
+        if(cv::getWindowProperty("imageIn", cv::WND_PROP_AUTOSIZE) < 0) break;
+        session.inbox.retry();
+        session.mailbox.show("imageIn");
+    }
+
+    session.running = false;
+    session.inbox.close();
+    worker.join();
+    delete session.imageState;
+    journal.close();
+    delete tileStore;
+}
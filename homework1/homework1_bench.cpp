@@ -0,0 +1,383 @@
+/*******************************************************************************************************************//**
+ * @file homework1_bench.cpp
+ * @brief Headless benchmark of the ImageState editing operations, reported as JSON
+ *
+ * Every operation is timed on synthetic images of each size and content type. A fresh ImageState is made before each
+ * timed call that changes the image, so every sample measures the same amount of work. Each case runs in a child
+ * process of its own, whose peak resident set is reset once its image is made, so the memory a case reports is its
+ * own rather than the high-water mark of every case before it. Results go to standard output as one JSON document (or
+ * to --out), while the editor's own progress messages are discarded.
+ *
+ * usage: homework1_bench [--sizes 512,2048] [--iterations 15] [--photo test.png] [--out results.json]
+ **********************************************************************************************************************/
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "image_state.cpp"
+
+#define BENCH_DEFAULT_ITERATIONS 15
+#define BENCH_STROKE_SAMPLES 256
+#define BENCH_STROKE_BATCH 16
+
+// the color every benchmark image has at (0, 0), picked so fills always have something to change
+static const cv::Vec3b markerColor(0, 0, 255);
+
+struct BenchResult {
+    std::string operation;
+    std::string content;
+    cv::Size size;
+    std::vector<double> millis;
+    long peakRssKb;         // resident set at its highest while the case ran, -1 when unknown
+    long rssGrowthKb;       // how far that peak rose above the resident set before the case
+};
+
+// a line of /proc/self/status in kB, VmRSS for the resident set now or VmHWM for its peak, -1 when unknown
+static long statusKb(const char* field)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    size_t length = strlen(field);
+    while(std::getline(status, line))
+    {
+        if(line.compare(0, length, field) == 0 && line.size() > length && line[length] == ':')
+        {
+            return atol(line.c_str() + length + 1);
+        }
+    }
+    return -1;
+}
+
+// make VmHWM start again from the current resident set
+static void resetPeakRss()
+{
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5";
+}
+
+static bool writeAll(int fd, const void* data, size_t bytes)
+{
+    const char* next = (const char*) data;
+    while(bytes > 0)
+    {
+        ssize_t written = write(fd, next, bytes);
+        if(written <= 0) return false;
+        next += written;
+        bytes -= written;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t bytes)
+{
+    char* next = (char*) data;
+    while(bytes > 0)
+    {
+        ssize_t got = read(fd, next, bytes);
+        if(got <= 0) return false;
+        next += got;
+        bytes -= got;
+    }
+    return true;
+}
+
+static double elapsedMillis(int64 start)
+{
+    return (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+}
+
+/*******************************************************************************************************************//**
+ * @brief makes a benchmark image
+ * @param[in] content one of flat, noisy, checkerboard or photo
+ * @param[in] size width and height of the image
+ * @param[in] photo image resized for the photo content, synthetic smooth noise is used when it is empty
+ * @return the image, with markerColor at (0, 0)
+ **********************************************************************************************************************/
+static cv::Mat makeImage(const std::string& content, cv::Size size, const cv::Mat& photo)
+{
+    cv::Mat image(size, CV_8UC3, cv::Scalar(128, 128, 128));
+    cv::RNG rng(12345);
+    if(content == "noisy")
+    {
+        rng.fill(image, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+    }
+    else if(content == "checkerboard")
+    {
+        for(int y = 0; y < size.height; y++)
+        {
+            for(int x = 0; x < size.width; x++)
+            {
+                if(((x >> 3) + (y >> 3)) & 1) image.at<cv::Vec3b>(y, x) = cv::Vec3b(32, 32, 32);
+            }
+        }
+    }
+    else if(content == "photo")
+    {
+        if(!photo.empty())
+        {
+            cv::resize(photo, image, size, 0, 0, cv::INTER_LINEAR);
+        }
+        else
+        {
+            cv::Mat coarse(std::max(1, size.height / 32), std::max(1, size.width / 32), CV_8UC3);
+            rng.fill(coarse, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+            cv::resize(coarse, image, size, 0, 0, cv::INTER_LINEAR);
+        }
+    }
+    image.at<cv::Vec3b>(0, 0) = markerColor;
+    return image;
+}
+
+/*******************************************************************************************************************//**
+ * @brief times one operation on one image
+ * @param[in] operation name of the ImageState operation to time
+ * @param[in] image benchmark image, left unchanged
+ * @param[in] iterations number of timed calls
+ * @return one latency sample per call
+ **********************************************************************************************************************/
+static std::vector<double> timeOperation(const std::string& operation, const cv::Mat& image, int iterations)
+{
+    std::vector<double> millis;
+    int cx = image.cols / 2, cy = image.rows / 2;
+    if(operation == "eyedropper" || operation == "eyedropper_mean_15")
+    {
+        // picks reuse one state so the cost of repeated picks is measured, as in the editor
+        ImageState picker(image);
+        if(operation == "eyedropper_mean_15") while(picker.getEyedropperSize() != 15) picker.cycleEyedropperSize();
+        for(int i = 0; i < iterations; i++)
+        {
+            int x = (cx + i * 37) % image.cols, y = (cy + i * 53) % image.rows;
+            int64 start = cv::getTickCount();
+            picker.setEyedropperColor(x, y);
+            millis.push_back(elapsedMillis(start));
+        }
+        return millis;
+    }
+
+    for(int i = 0; i < iterations; i++)
+    {
+        ImageState state(image);
+        if(operation == "paint_bucket_fill")
+        {
+            state.setEyedropperColor(0, 0);
+            int64 start = cv::getTickCount();
+            state.paintBucketFill(cx, cy);
+            millis.push_back(elapsedMillis(start));
+        }
+        else if(operation == "replace_all")
+        {
+            state.setEyedropperColor(0, 0);
+            int64 start = cv::getTickCount();
+            state.replaceAll(cx, cy);
+            millis.push_back(elapsedMillis(start));
+        }
+        else if(operation == "pencil_stroke")
+        {
+            // a circle drawn in the batches the editing thread would rasterize
+            int radius = std::min(image.cols, image.rows) / 3;
+            int64 start = cv::getTickCount();
+            state.setPencilActive(true);
+            for(int s = 0; s < BENCH_STROKE_SAMPLES; s++)
+            {
+                double angle = 2 * CV_PI * s / BENCH_STROKE_SAMPLES;
+                state.pencilDraw(cx + (int) (radius * cos(angle)), cy + (int) (radius * sin(angle)));
+                if(s % BENCH_STROKE_BATCH == BENCH_STROKE_BATCH - 1) state.flushPencil();
+            }
+            state.setPencilActive(false);
+            millis.push_back(elapsedMillis(start));
+        }
+        else if(operation == "crop")
+        {
+            state.cropLeftClicked(image.cols / 4, image.rows / 4);
+            int64 start = cv::getTickCount();
+            state.executeCrop(3 * image.cols / 4, 3 * image.rows / 4);
+            millis.push_back(elapsedMillis(start));
+        }
+        else if(operation == "reset")
+        {
+            int64 start = cv::getTickCount();
+            state.resetImage();
+            millis.push_back(elapsedMillis(start));
+        }
+    }
+    return millis;
+}
+
+/*******************************************************************************************************************//**
+ * @brief makes the image for one case and times one operation on it
+ * @param[in,out] result case to run, its samples and memory figures are filled in
+ * @param[in] photo image resized for the photo content
+ * @param[in] iterations number of timed calls
+ **********************************************************************************************************************/
+static void measureCase(BenchResult& result, const cv::Mat& photo, int iterations)
+{
+    cv::Mat image = makeImage(result.content, result.size, photo);
+    resetPeakRss();
+    long before = statusKb("VmRSS");
+    result.millis = timeOperation(result.operation, image, iterations);
+    result.peakRssKb = statusKb("VmHWM");
+    result.rssGrowthKb = (before >= 0 && result.peakRssKb >= 0) ? result.peakRssKb - before : -1;
+}
+
+/*******************************************************************************************************************//**
+ * @brief runs one case in a child process, so memory it leaves behind cannot count against later cases
+ * @param[in,out] result case to run, its samples and memory figures are filled in
+ * @param[in] photo image resized for the photo content
+ * @param[in] iterations number of timed calls
+ * @return false when the child failed to report back
+ **********************************************************************************************************************/
+static bool runCase(BenchResult& result, const cv::Mat& photo, int iterations)
+{
+    int channel[2];
+    if(pipe(channel) != 0) return false;
+    pid_t child = fork();
+    if(child < 0)
+    {
+        close(channel[0]);
+        close(channel[1]);
+        return false;
+    }
+    if(child == 0)
+    {
+        close(channel[0]);
+        measureCase(result, photo, iterations);
+        int count = (int) result.millis.size();
+        bool sent = writeAll(channel[1], &count, sizeof(count)) &&
+                    writeAll(channel[1], &result.millis[0], count * sizeof(double)) &&
+                    writeAll(channel[1], &result.peakRssKb, sizeof(long)) &&
+                    writeAll(channel[1], &result.rssGrowthKb, sizeof(long));
+        _exit(sent ? 0 : 1);
+    }
+    close(channel[1]);
+    int count = 0;
+    bool received = readAll(channel[0], &count, sizeof(count)) && count > 0;
+    if(received)
+    {
+        result.millis.resize(count);
+        received = readAll(channel[0], &result.millis[0], count * sizeof(double)) &&
+                   readAll(channel[0], &result.peakRssKb, sizeof(long)) &&
+                   readAll(channel[0], &result.rssGrowthKb, sizeof(long));
+    }
+    close(channel[0]);
+    int status = 0;
+    waitpid(child, &status, 0);
+    return received && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static double percentile(std::vector<double> values, double p)
+{
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t) (p / 100.0 * (values.size() - 1) + 0.5);
+    return values[std::min(index, values.size() - 1)];
+}
+
+static void writeJson(std::ostream& out, const std::vector<BenchResult>& results)
+{
+    out << "{\n  \"benchmark\": \"homework1\",\n  \"threads\": " << cv::getNumThreads() << ",\n  \"results\": [\n";
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        double total = 0;
+        for(size_t s = 0; s < r.millis.size(); s++) total += r.millis[s];
+        double mean = total / r.millis.size();
+        double megapixels = r.size.area() / 1e6;
+        out << "    {\"operation\": \"" << r.operation << "\", \"content\": \"" << r.content << "\", "
+            << "\"width\": " << r.size.width << ", \"height\": " << r.size.height << ", "
+            << "\"iterations\": " << r.millis.size() << ", "
+            << "\"ops_per_second\": " << (mean > 0 ? 1000.0 / mean : 0) << ", "
+            << "\"megapixels_per_second\": " << (mean > 0 ? megapixels * 1000.0 / mean : 0) << ", "
+            << "\"latency_ms\": {\"mean\": " << mean << ", \"p50\": " << percentile(r.millis, 50)
+            << ", \"p90\": " << percentile(r.millis, 90) << ", \"p99\": " << percentile(r.millis, 99) << "}, "
+            << "\"peak_rss_kb\": " << r.peakRssKb << ", \"rss_growth_kb\": " << r.rssGrowthKb << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+/*******************************************************************************************************************//**
+ * @brief program entry point
+ * @param[in] argc number of command line arguments
+ * @param[in] argv string array of command line arguments
+ * @return return code (0 for normal termination)
+ **********************************************************************************************************************/
+int main(int argc, char **argv)
+{
+    std::vector<int> sizes;
+    int iterations = BENCH_DEFAULT_ITERATIONS;
+    std::string photoPath = "test.png";
+    std::string outPath;
+    for(int i = 1; i + 1 < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if(arg == "--sizes")
+        {
+            std::stringstream list(argv[++i]);
+            std::string size;
+            while(std::getline(list, size, ',')) sizes.push_back(atoi(size.c_str()));
+        }
+        else if(arg == "--iterations") iterations = std::max(1, atoi(argv[++i]));
+        else if(arg == "--photo") photoPath = argv[++i];
+        else if(arg == "--out") outPath = argv[++i];
+    }
+    if(sizes.empty())
+    {
+        sizes.push_back(512);
+        sizes.push_back(2048);
+    }
+    cv::Mat photo = cv::imread(photoPath, CV_LOAD_IMAGE_COLOR);
+
+    static const char* contents[] = {"flat", "noisy", "checkerboard", "photo"};
+    static const char* operations[] = {"paint_bucket_fill", "replace_all", "pencil_stroke", "crop", "reset", "eyedropper",
+                                       "eyedropper_mean_15"};
+
+    // the editor reports every operation on standard output, which would get in the way of the JSON; the images are
+    // made in the children, so this process never starts OpenCV's worker threads and is safe to fork
+    std::ostringstream discarded;
+    std::streambuf* console = std::cout.rdbuf(discarded.rdbuf());
+    std::vector<BenchResult> results;
+    for(size_t s = 0; s < sizes.size(); s++)
+    {
+        for(size_t c = 0; c < sizeof(contents) / sizeof(contents[0]); c++)
+        {
+            for(size_t o = 0; o < sizeof(operations) / sizeof(operations[0]); o++)
+            {
+                BenchResult result;
+                result.operation = operations[o];
+                result.content = contents[c];
+                result.size = cv::Size(sizes[s], sizes[s]);
+                if(runCase(result, photo, iterations))
+                {
+                    results.push_back(result);
+                }
+                else
+                {
+                    std::cerr << "Error while running " << operations[o] << " on " << contents[c] << " " << sizes[s]
+                              << "x" << sizes[s] << std::endl;
+                }
+                discarded.str("");
+            }
+        }
+    }
+    std::cout.rdbuf(console);
+
+    if(outPath.empty())
+    {
+        writeJson(std::cout, results);
+    }
+    else
+    {
+        std::ofstream out(outPath.c_str());
+        writeJson(out, results);
+    }
+    return 0;
+}
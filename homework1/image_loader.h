@@ -0,0 +1,121 @@
+/*******************************************************************************************************************//**
+ * @file image_loader.h
+ * @brief Background decoding of the input image behind a reduced-resolution preview
+ **********************************************************************************************************************/
+
+#ifndef IMAGE_LOADER_H
+#define IMAGE_LOADER_H
+
+#include <sys/stat.h>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include "opencv2/opencv.hpp"
+#include "journal.h"
+#include "viewport.h"
+
+// smaller files decode quickly enough that a preview would only flash up before the image
+#define PREVIEW_MIN_FILE_BYTES ((off_t) 1 << 20)
+
+/*******************************************************************************************************************//**
+ * @class ImageLoader
+ *
+ * @brief Decodes an image on its own thread, after decoding a preview of it at an eighth of its size
+ *
+ * The JPEG decoder can scale by 1/2, 1/4 or 1/8 while it decodes, and at 1/8 it only needs the average of each 8x8
+ * block, so a preview of even a very large JPEG is ready long before the image. Other formats are only reduced after
+ * a full decode, so they get no preview. The last session's journal, when there is one, is recovered on the same thread
+ * in place of decoding the image. Neither can be interrupted, so quitting during the load abandons the thread instead:
+ * everything it writes is shared with it rather than owned by the loader, and the process exits without waiting.
+ **********************************************************************************************************************/
+class ImageLoader {
+    private:
+        // what the thread works on, kept alive by the thread itself once it is abandoned
+        struct Load {
+            std::string path;
+            std::string journal_path;
+            cv::Mat image;
+            bool recovered;
+            std::atomic<bool> done;
+            Load() : recovered(false), done(false) {}
+        };
+
+        cv::Mat preview;
+        std::shared_ptr<Load> load;
+        std::thread worker;
+
+        ImageLoader(const ImageLoader&);
+        ImageLoader& operator=(const ImageLoader&);
+
+        // true for a JPEG large enough to be worth a preview
+        static bool wantsPreview(const std::string& path) {
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0 || info.st_size < PREVIEW_MIN_FILE_BYTES) return false;
+            FILE* in = fopen(path.c_str(), "rb");
+            if (!in) return false;
+            unsigned char magic[3] = {0, 0, 0};
+            size_t read = fread(magic, 1, 3, in);
+            fclose(in);
+            return read == 3 && magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF;
+        }
+
+        // scale a 1/8 preview to the size the viewport first shows the whole image at
+        static cv::Mat fitPreview(const cv::Mat& reduced) {
+            int cols = reduced.cols * 8, rows = reduced.rows * 8;
+            while (cols > VIEWPORT_MAX_COLS || rows > VIEWPORT_MAX_ROWS) {
+                cols = (cols + 1) / 2;
+                rows = (rows + 1) / 2;
+            }
+            cv::Mat fitted;
+            int interpolation = (cols < reduced.cols) ? cv::INTER_AREA : cv::INTER_LINEAR;
+            cv::resize(reduced, fitted, cv::Size(cols, rows), 0, 0, interpolation);
+            return fitted;
+        }
+
+        static void run(std::shared_ptr<Load> load) {
+            load->recovered = !load->journal_path.empty() &&
+                              Journal::recover(load->journal_path, load->path, load->image);
+            if (!load->recovered) load->image = cv::imread(load->path, cv::IMREAD_COLOR);
+            load->done = true;
+        }
+
+    public:
+        ImageLoader() : load(new Load()) {}
+        ~ImageLoader() { wait(); }
+
+        // decode the preview, if path has one, then start decoding path or recovering journal_path unless it is empty
+        void start(const std::string& path, const std::string& journal_path) {
+            load.reset(new Load());
+            load->path = path;
+            load->journal_path = journal_path;
+            if (wantsPreview(path)) {
+                cv::Mat reduced = cv::imread(path, cv::IMREAD_REDUCED_COLOR_8);
+                if (reduced.data) preview = fitPreview(reduced);
+            }
+            worker = std::thread(&ImageLoader::run, load);
+        }
+
+        // empty when the format has no cheap preview
+        const cv::Mat& getPreview() const { return preview; }
+
+        bool ready() const { return load->done; }
+
+        // block until the image is decoded; it is empty when decoding failed
+        cv::Mat& wait() {
+            if (worker.joinable()) worker.join();
+            return load->image;
+        }
+
+        // stop waiting for a load that is no longer wanted, so quitting does not wait for the decode to finish
+        void abandon() {
+            if (worker.joinable()) worker.detach();
+            load.reset(new Load());
+        }
+
+        // the image came from the journal of the last session rather than from the file
+        bool wasRecovered() const { return load->recovered; }
+};
+
+#endif // IMAGE_LOADER_H
@@ -1,8 +1,23 @@
 #include <iostream>
 #include <string>
 #include "opencv2/opencv.hpp"
+#include "scanline_fill.h"
+#include "parallel_fill.h"
+#include "edit_history.h"
+#include "dirty_region.h"
+#include "pencil_stroke.h"
+#include "tile_store.h"
+#include "operation_log.h"
+#include "area_sampler.h"
+#include "color_replace.h"
+#include "layer_stack.h"
+#include "journal.h"
+#include "magic_wand.h"
 
-enum Tool {eyedropper, crop, pencil, paint_bucket, reset};
+// images at least this large are filled with ParallelFill when more than one thread is available
+#define PARALLEL_FILL_MIN_PIXELS (1 << 20)
+
+enum Tool {eyedropper, crop, pencil, paint_bucket, replace_all, magic_wand, reset};
 
 class ImageState {
     private:
@@ -12,32 +27,99 @@ class ImageState {
         int image_cols;
         Tool current_tool;
         cv::Vec3b eyedropper_color;
+        int eyedropper_size;
+        bool eyedropper_median;
+        AreaSampler area_sampler;
         cv::Point initial_crop_location;
         cv::Point final_crop_location;
         cv::Point updated_rectangle_point;
         cv::Rect crop_rectangle;
         bool pencil_active;
         cv::Vec3b anti_color;
+        ColorTolerance fill_tolerance;
+        EditHistory history;
+        DirtyRegion dirty_region;
+        PencilStroke pencil_stroke;
+        BrushSettings brush;
+        TileStore* tile_store;
+        OperationLog* operation_log;
+        Journal* journal;
+        std::vector<cv::Point> stroke_samples;
+        LayerStack layers;
+        int selected_layer;
+        MagicWand wand;
+        BitMask selection;
+        cv::Rect selection_bounds;      // empty when nothing is selected
+        void imageReplaced(bool recompose);
+        void access(cv::Rect region);
+        void record(const Operation& op);
+        void markDirty(cv::Rect region, bool recompose = true);
+        cv::Rect viewRect();
+        int toolLayer(const std::string& name);
+        void prepareLayer(int index, cv::Rect region);
+        void readLayer(int index, cv::Rect region, cv::Mat& window);
+        void writeLayer(int index, cv::Rect region, const cv::Mat& window);
+        void layersChanged(const std::vector<cv::Rect>& tiles);
     public:
         ImageState(cv::Mat image) : current_image(image.clone()), original_image(image),
             image_rows(image.rows), image_cols(image.cols), 
             current_tool(eyedropper), eyedropper_color(cv::Vec3b(255,255,255)), 
-            pencil_active(false), anti_color(cv::Vec3b(0,0,0)) {}
+            eyedropper_size(1), eyedropper_median(false), pencil_active(false), anti_color(cv::Vec3b(0,0,0)), fill_tolerance(), tile_store(NULL), operation_log(NULL),
+            journal(NULL), selected_layer(0) { layers.attach(original_image, current_image); }
+        // edit an image kept in a TileStore, which must outlive the ImageState
+        ImageState(TileStore* store) : current_image(store->getWorking()), original_image(store->getOriginal()),
+            image_rows(current_image.rows), image_cols(current_image.cols),
+            current_tool(eyedropper), eyedropper_color(cv::Vec3b(255,255,255)),
+            eyedropper_size(1), eyedropper_median(false), pencil_active(false), anti_color(cv::Vec3b(0,0,0)), fill_tolerance(), tile_store(store), operation_log(NULL),
+            journal(NULL), selected_layer(0) {
+            layers.attach(original_image, current_image, &store->getScratch());
+            history.setPool(&store->getScratch());
+        }
         cv::Mat getCurrentImage();
         cv::Mat getOriginalImage();
+        TileStore* getTileStore();
         void toggleTool();
         Tool getTool();
         void setEyedropperColor(int x, int y);
         cv::Vec3b getEyedropperColor();
+        void cycleEyedropperSize();
+        void toggleEyedropperMedian();
+        int getEyedropperSize();
+        bool getEyedropperMedian();
         void cropLeftClicked(int x, int y);
         void executeCrop(int x, int y);
         void setPencilActive(bool active);
         bool getPencilActive();
         void pencilDraw(int x, int y);
+        void flushPencil();
+        void cycleBrushRadius();
+        void cycleBrushOpacity();
+        void toggleBrushAntialiasing();
+        BrushSettings getBrush();
         void paintBucketFill(int x, int y);
-        void paintBucketFillRecursive(int x, int y);
+        void cycleFillTolerance();
+        ColorTolerance getFillTolerance();
+        void fillSpans(const std::vector<Span>& spans);
+        void replaceAll(int x, int y);
+        void selectRegion(int x, int y, bool extend);
+        void clearSelection();
+        bool hasSelection();
+        cv::Rect getSelectionBounds();
         void resetImage();
+        bool undo();
+        bool redo();
         bool inRange(int x, int y);
+        DirtyRegion& getDirtyRegion();
+        void setOperationLog(OperationLog* log);
+        void setJournal(Journal* journal);
+        void applyOperation(const Operation& op);
+        int getLayerCount();
+        std::string getLayerName(int index);
+        bool getLayerVisible(int index);
+        int getSelectedLayer();
+        void selectNextLayer();
+        void toggleLayer();
+        void moveLayer(int delta);
 };
 
 cv::Mat ImageState::getCurrentImage() {
@@ -48,6 +130,16 @@ cv::Mat ImageState::getOriginalImage() {
     return original_image;
 }
 
+// the store backing current_image, or NULL when it is an ordinary in-memory image
+TileStore* ImageState::getTileStore() {
+    return tile_store;
+}
+
+// every tool calls this for the pixels it is about to read or write, so a tiled image can page them in
+void ImageState::access(cv::Rect region) {
+    if(tile_store) tile_store->access(current_image, region);
+}
+
 void ImageState::toggleTool() {
     if (current_tool != reset) {
         int tool_int = current_tool;
@@ -62,13 +154,55 @@ Tool ImageState::getTool() {
 }
 
 void ImageState::setEyedropperColor(int x, int y) {
-    eyedropper_color = current_image.at<cv::Vec3b>(y, x);
+    if(!inRange(x,y)) return;
+    Operation op(op_pick);
+    op.a = cv::Point(x,y);
+    op.sample_size = eyedropper_size;
+    op.sample_median = eyedropper_median;
+    record(op);
+    if(eyedropper_size <= 1) {
+        access(cv::Rect(x, y, 1, 1));
+        eyedropper_color = current_image.at<cv::Vec3b>(y, x);
+        return;
+    }
+    // the window is centred on the click and clipped to the image
+    int half = eyedropper_size / 2;
+    cv::Rect window = cv::Rect(x - half, y - half, eyedropper_size, eyedropper_size) & cv::Rect(0, 0, image_cols, image_rows);
+    if(eyedropper_median) {
+        access(window);
+        eyedropper_color = AreaSampler::median(current_image(window));
+    } else {
+        area_sampler.attach(current_image);
+        eyedropper_color = area_sampler.mean(window, tile_store);
+    }
 }
 
 cv::Vec3b ImageState::getEyedropperColor() {
     return eyedropper_color;
 }
 
+void ImageState::cycleEyedropperSize() {
+    static const int sizes[] = {1, 3, 5, 9, 15, 31};
+    const int size_count = sizeof(sizes) / sizeof(sizes[0]);
+    int next = 0;
+    for(int i = 0; i < size_count; i++) {
+        if(sizes[i] == eyedropper_size) next = (i + 1) % size_count;
+    }
+    eyedropper_size = sizes[next];
+}
+
+void ImageState::toggleEyedropperMedian() {
+    eyedropper_median = !eyedropper_median;
+}
+
+int ImageState::getEyedropperSize() {
+    return eyedropper_size;
+}
+
+bool ImageState::getEyedropperMedian() {
+    return eyedropper_median;
+}
+
 void ImageState::cropLeftClicked(int x, int y) {
     std::cout << "New initial crop location set to row: " << y << "col: " << x << std::endl;
     initial_crop_location = cv::Point(x,y);
@@ -77,12 +211,37 @@ void ImageState::cropLeftClicked(int x, int y) {
 void ImageState::executeCrop(int x, int y) {
     std::cout << "Left Mouse Click Released...  Attempting to execute crop from" << initial_crop_location << " to row: " << y << " col: " << x << std::endl;
     final_crop_location = cv::Point(x,y);
-    crop_rectangle = cv::Rect(initial_crop_location, final_crop_location);
+    crop_rectangle = cv::Rect(initial_crop_location, final_crop_location) & cv::Rect(0, 0, image_cols, image_rows);
+    // with a selection a click crops to it, and a dragged rectangle is cut down to it
+    if(hasSelection()) crop_rectangle = (crop_rectangle.area() > 0) ? (crop_rectangle & selection_bounds) : selection_bounds;
+    if(crop_rectangle.area() <= 0) return;
+    Operation op(op_crop);
+    op.a = initial_crop_location;
+    op.b = final_crop_location;
+    record(op);
+    history.begin("crop");
+    history.replaceImage(current_image);
     current_image = current_image(crop_rectangle);
-    cv::imshow("imageIn", current_image);
+    history.commit();
+    // the layers are cropped along with the composite, so nothing needs compositing again
+    imageReplaced(false);
 }
 
 void ImageState::setPencilActive(bool active) {
+    if(active && !pencil_active) {
+        history.begin("pencil stroke");
+        pencil_stroke.begin(current_image.size());
+        stroke_samples.clear();
+    }
+    if(!active && pencil_active) {
+        flushPencil();
+        pencil_stroke.end();
+        history.commit();
+        Operation op(op_stroke);
+        op.brush = brush;
+        op.points.swap(stroke_samples);
+        record(op);
+    }
     pencil_active = active;
 }
 
@@ -90,37 +249,429 @@ bool ImageState::getPencilActive() {
     return pencil_active;
 }
 
+// samples are only queued here, flushPencil() rasterizes everything queued since the last flush in one pass
 void ImageState::pencilDraw(int x, int y) {
-    current_image.at<cv::Vec3b>(y,x) = eyedropper_color;
-    cv::imshow("imageIn", current_image);
+    if(!pencil_active) return;
+    pencil_stroke.addSample(cv::Point(x,y));
+    if(operation_log) stroke_samples.push_back(cv::Point(x,y));
+}
+
+void ImageState::flushPencil() {
+    if(!pencil_active || !pencil_stroke.hasPending()) return;
+    cv::Rect bounds = pencil_stroke.pendingBounds(brush);
+    // one batch only covers what the mouse crossed since the last frame, so it is painted through a single window
+    int index = toolLayer("pencil");
+    prepareLayer(index, bounds);
+    cv::Mat window;
+    readLayer(index, bounds, window);
+    pencil_stroke.rasterize(window, bounds, brush, eyedropper_color, hasSelection() ? &selection : NULL, bounds.tl());
+    writeLayer(index, bounds, window);
+    markDirty(bounds);
+}
+
+void ImageState::cycleBrushRadius() {
+    static const int radii[] = {0, 1, 2, 4, 8, 16};
+    const int radius_count = sizeof(radii) / sizeof(radii[0]);
+    int next = 0;
+    for(int i = 0; i < radius_count; i++) {
+        if(radii[i] == brush.radius) next = (i + 1) % radius_count;
+    }
+    brush.radius = radii[next];
+}
+
+void ImageState::cycleBrushOpacity() {
+    brush.opacity = (brush.opacity > 64) ? brush.opacity / 2 : 255;
+}
+
+void ImageState::toggleBrushAntialiasing() {
+    brush.antialiased = !brush.antialiased;
+}
+
+BrushSettings ImageState::getBrush() {
+    return brush;
 }
 
 bool ImageState::inRange(int x, int y) {
-    return (y <= image_rows && y >= 0) && (x <= image_cols && x >= 0);
+    return (y < image_rows && y >= 0) && (x < image_cols && x >= 0);
 }
 
 void ImageState::paintBucketFill(int x, int y) {
+    if(!inRange(x,y)) return;
+    Operation op(op_fill);
+    op.a = cv::Point(x,y);
+    op.tolerance = fill_tolerance;
+    record(op);
+    // a fill can reach any pixel, so the whole image is paged in
+    access(cv::Rect(0, 0, image_cols, image_rows));
     anti_color = current_image.at<cv::Vec3b>(y,x);
-    std::cout << "Attempting paint bucket fill..." << std::endl;
-    paintBucketFillRecursive(x,y);
-    cv::imshow("imageIn", current_image);
+    std::cout << "Attempting paint bucket fill with " << fill_tolerance << " tolerance..." << std::endl;
+    if(anti_color == eyedropper_color && fill_tolerance.mode == tolerance_exact) return;
+    if(hasSelection() && !selection.test(x,y)) {
+        std::cout << "Fill starts outside the selection" << std::endl;
+        return;
+    }
+
+    history.begin("paint bucket fill");
+    if(hasSelection()) {
+        // only the labeling fill can keep the region inside the selection
+        ParallelFill fill(current_image, fill_tolerance);
+        fillSpans(fill.findRegion(cv::Point(x,y), &selection));
+    } else if(current_image.total() >= PARALLEL_FILL_MIN_PIXELS && cv::getNumThreads() > 1) {
+        ParallelFill fill(current_image, fill_tolerance);
+        fillSpans(fill.findRegion(cv::Point(x,y)));
+    } else {
+        ScanlineFill fill(current_image, fill_tolerance);
+        fillSpans(fill.findRegion(cv::Point(x,y)));
+    }
+    history.commit();
 }
 
-void ImageState::paintBucketFillRecursive(int x, int y) {
-    //does will not access out of range values due to short-circuit eval
-    if(!inRange(x,y) || current_image.at<cv::Vec3b>(y,x) != anti_color) {
-        return;
+// paint spans into the paint bucket layer a band of rows at a time, so the window stays small however far they reach
+void ImageState::fillSpans(const std::vector<Span>& spans) {
+    if(spans.empty()) return;
+    int band_rows = LayerStack::bandRows(image_cols);
+    std::vector<std::vector<Span> > bands((image_rows + band_rows - 1) / band_rows);
+    for(size_t i = 0; i < spans.size(); i++) bands[spans[i].y / band_rows].push_back(spans[i]);
+
+    int index = toolLayer("paint bucket");
+    cv::Scalar color(eyedropper_color[0], eyedropper_color[1], eyedropper_color[2], 255);
+    for(size_t b = 0; b < bands.size(); b++) {
+        std::vector<Span>& band = bands[b];
+        if(band.empty()) continue;
+        cv::Rect bounds;
+        for(size_t i = 0; i < band.size(); i++) {
+            cv::Rect span(band[i].x0, band[i].y, band[i].x1 - band[i].x0, 1);
+            bounds = (i == 0) ? span : (bounds | span);
+            prepareLayer(index, span);
+        }
+        cv::Mat window;
+        readLayer(index, bounds, window);
+        for(size_t i = 0; i < band.size(); i++) {
+            band[i] = Span(band[i].y - bounds.y, band[i].x0 - bounds.x, band[i].x1 - bounds.x);
+        }
+        paintSpans(window, band, color);
+        writeLayer(index, bounds, window);
+        markDirty(bounds);
+    }
+}
+
+// recolor every pixel matching the clicked color within the fill tolerance, connected to the click or not
+void ImageState::replaceAll(int x, int y) {
+    if(!inRange(x,y)) return;
+    Operation op(op_replace);
+    op.a = cv::Point(x,y);
+    op.tolerance = fill_tolerance;
+    record(op);
+    access(cv::Rect(0, 0, image_cols, image_rows));
+    anti_color = current_image.at<cv::Vec3b>(y,x);
+    std::cout << "Attempting to replace every " << anti_color << " with " << fill_tolerance << " tolerance..." << std::endl;
+    if(anti_color == eyedropper_color && fill_tolerance.mode == tolerance_exact) return;
+
+    ColorReplace replace(current_image, fill_tolerance);
+    const std::vector<cv::Rect>& tiles = replace.findTiles(anti_color);
+    if(tiles.empty()) return;
+    // matches can be anywhere, so the layer is painted a band of tile rows at a time through a window over the tiles
+    // found in that band, which the band's pixels are matched again for
+    int index = toolLayer("replace all");
+    int band_rows = LayerStack::bandRows(image_cols);
+    history.begin("replace all");
+    for(size_t first = 0; first < tiles.size();) {
+        int band = tiles[first].y / band_rows;
+        cv::Rect bounds = tiles[first];
+        size_t last = first;
+        for(; last < tiles.size() && tiles[last].y / band_rows == band; last++) {
+            bounds |= tiles[last];
+            prepareLayer(index, tiles[last]);
+        }
+        cv::Mat window;
+        readLayer(index, bounds, window);
+        ColorReplace part(current_image(bounds), fill_tolerance);
+        part.findTiles(anti_color);
+        part.replace(eyedropper_color, window);
+        writeLayer(index, bounds, window);
+        first = last;
+    }
+    history.commit();
+    for(size_t i = 0; i < tiles.size(); i++) markDirty(tiles[i]);
+}
+
+// select the region of similar color under (x, y) with the fill tolerance, adding it to the selection when extend is set
+void ImageState::selectRegion(int x, int y, bool extend) {
+    if(!inRange(x,y)) return;
+    Operation op(op_select);
+    op.a = cv::Point(x,y);
+    op.tolerance = fill_tolerance;
+    op.extend = extend;
+    record(op);
+    access(cv::Rect(0, 0, image_cols, image_rows));
+    if(!extend || !hasSelection()) {
+        selection.reset(image_rows, image_cols);
+        selection_bounds = cv::Rect();
+    }
+    cv::Rect region = wand.select(current_image, cv::Point(x,y), fill_tolerance, selection);
+    selection_bounds = (selection_bounds.area() > 0) ? (selection_bounds | region) : region;
+    std::cout << "Selection now spans " << selection_bounds << std::endl;
+}
+
+void ImageState::clearSelection() {
+    if(!hasSelection()) return;
+    record(Operation(op_deselect));
+    selection.reset(0, 0);
+    selection_bounds = cv::Rect();
+}
+
+// while something is selected the pencil, the paint bucket and crop only act inside it
+bool ImageState::hasSelection() {
+    return selection_bounds.area() > 0;
+}
+
+cv::Rect ImageState::getSelectionBounds() {
+    return selection_bounds;
+}
+
+void ImageState::cycleFillTolerance() {
+    static const ColorTolerance presets[] = {
+        ColorTolerance(tolerance_exact, 0),
+        ColorTolerance(tolerance_channel, 8),
+        ColorTolerance(tolerance_channel, 24),
+        ColorTolerance(tolerance_euclidean, 16),
+        ColorTolerance(tolerance_euclidean, 48),
+    };
+    const int preset_count = sizeof(presets) / sizeof(presets[0]);
+    int next = 0;
+    for(int i = 0; i < preset_count; i++) {
+        if(presets[i].mode == fill_tolerance.mode && presets[i].amount == fill_tolerance.amount) {
+            next = (i + 1) % preset_count;
+        }
     }
-    
-    current_image.at<cv::Vec3b>(y,x) = eyedropper_color;
-    paintBucketFillRecursive(x-1,y);
-    paintBucketFillRecursive(x,y-1);
-    paintBucketFillRecursive(x+1,y);
-    paintBucketFillRecursive(x,y+1);
+    fill_tolerance = presets[next];
+}
+
+ColorTolerance ImageState::getFillTolerance() {
+    return fill_tolerance;
 }
 
 void ImageState::resetImage() {
     std::cout << "Attempting reset..." << std::endl;
-    current_image = original_image.clone();
-    cv::imshow("imageIn", current_image);
-}
\ No newline at end of file
+    record(Operation(op_reset));
+    if(tile_store) {
+        // tiled images are edited in place, so there is no previous image to swap back in and history ends here
+        if(pencil_active) setPencilActive(false);
+        tile_store->discardEdits();
+        history.clear();
+        layers.clear();
+        current_image = tile_store->getWorking();
+        imageReplaced(false);
+        return;
+    }
+    // the base is never edited, so reset hands the painted layer tiles to the history, which keeps them without a
+    // copy, and goes back to the uncropped composite
+    history.begin("reset");
+    history.replaceLayers(layers);
+    history.replaceImage(current_image);
+    current_image = layers.getComposite();
+    history.commit();
+    imageReplaced(false);
+}
+
+bool ImageState::undo() {
+    if(pencil_active) setPencilActive(false);
+    record(Operation(op_undo));
+    DirtyRegion changed;
+    if(!history.undo(current_image, changed)) {
+        std::cout << "Nothing to undo" << std::endl;
+        return false;
+    }
+    // layer tiles reach past the edges of a cropped view
+    cv::Rect image(0, 0, current_image.cols, current_image.rows);
+    for(size_t i = 0; i < changed.getRects().size(); i++) markDirty(changed.getRects()[i] & image);
+    // a crop or a reset that changed the size was undone, and the selection was made at the other size
+    if(image.size() != cv::Size(image_cols, image_rows)) imageReplaced(false);
+    return true;
+}
+
+bool ImageState::redo() {
+    if(pencil_active) setPencilActive(false);
+    record(Operation(op_redo));
+    DirtyRegion changed;
+    if(!history.redo(current_image, changed)) {
+        std::cout << "Nothing to redo" << std::endl;
+        return false;
+    }
+    // layer tiles reach past the edges of a cropped view
+    cv::Rect image(0, 0, current_image.cols, current_image.rows);
+    for(size_t i = 0; i < changed.getRects().size(); i++) markDirty(changed.getRects()[i] & image);
+    // a crop or a reset that changed the size was redone, and the selection was made at the other size
+    if(image.size() != cv::Size(image_cols, image_rows)) imageReplaced(false);
+    return true;
+}
+// refresh cached dimensions after current_image was swapped for a different header
+void ImageState::imageReplaced(bool recompose) {
+    image_rows = current_image.rows;
+    image_cols = current_image.cols;
+    // the selection was made on the old image
+    selection.reset(0, 0);
+    selection_bounds = cv::Rect();
+    markDirty(cv::Rect(0, 0, image_cols, image_rows), recompose);
+}
+
+// pixels in region changed, for the display and for anything cached about them; recompose when the layers under
+// region changed and current_image has to be composited again
+void ImageState::markDirty(cv::Rect region, bool recompose) {
+    if(recompose) {
+        cv::Point offset = viewRect().tl();
+        layers.compose(cv::Rect(region.tl() + offset, region.size()), tile_store);
+    }
+    dirty_region.add(region);
+    area_sampler.invalidate(region);
+    wand.invalidate();
+    if(journal) journal->record(current_image, region);
+}
+
+// where current_image, which may be cropped, lies in the full-size composite and layers
+cv::Rect ImageState::viewRect() {
+    cv::Size whole;
+    cv::Point offset;
+    current_image.locateROI(whole, offset);
+    return cv::Rect(offset, current_image.size());
+}
+
+// the layer a tool paints into, brought to the top of the stack and shown first so its output is never hidden by
+// another tool's layer; the selected layer stays the same one
+int ImageState::toolLayer(const std::string& name) {
+    int index = layers.find(name);
+    if(index == layers.count() - 1 && layers.isVisible(index)) return index;
+    layersChanged(layers.raise(index));
+    if(selected_layer == index) selected_layer = layers.count() - 1;
+    else if(selected_layer > index) selected_layer--;
+    return layers.count() - 1;
+}
+
+// make the tiles of a layer under region, in current_image coordinates, hold data and save them for undo before a
+// tool paints there
+void ImageState::prepareLayer(int index, cv::Rect region) {
+    cv::Point view = viewRect().tl();
+    std::vector<int> tiles = layers.prepare(index, cv::Rect(region.tl() + view, region.size()));
+    for(size_t i = 0; i < tiles.size(); i++) {
+        cv::Mat tile = layers.getTile(index, tiles[i]);
+        history.capture(tile, cv::Rect(0, 0, tile.cols, tile.rows), layers.tileRect(tiles[i]).tl() - view);
+    }
+}
+
+// copy region of a layer, in current_image coordinates, into a window a tool can paint
+void ImageState::readLayer(int index, cv::Rect region, cv::Mat& window) {
+    layers.read(index, cv::Rect(region.tl() + viewRect().tl(), region.size()), window);
+}
+
+// store a painted window back into the tiles prepareLayer() readied
+void ImageState::writeLayer(int index, cv::Rect region, const cv::Mat& window) {
+    layers.write(index, cv::Rect(region.tl() + viewRect().tl(), region.size()), window);
+}
+
+// composite again the tiles a change to the layer stack affected, given in full-size coordinates
+void ImageState::layersChanged(const std::vector<cv::Rect>& tiles) {
+    cv::Rect view = viewRect();
+    for(size_t i = 0; i < tiles.size(); i++) {
+        cv::Rect visible = tiles[i] & view;
+        layers.compose(tiles[i], tile_store);
+        if(visible.area() > 0) markDirty(cv::Rect(visible.tl() - view.tl(), visible.size()), false);
+    }
+}
+
+int ImageState::getLayerCount() {
+    return layers.count();
+}
+
+std::string ImageState::getLayerName(int index) {
+    return layers.getName(index);
+}
+
+bool ImageState::getLayerVisible(int index) {
+    return layers.isVisible(index);
+}
+
+// the layer the layer keys act on, layers are numbered from the bottom of the stack
+int ImageState::getSelectedLayer() {
+    return selected_layer;
+}
+
+void ImageState::selectNextLayer() {
+    if(layers.count() > 0) selected_layer = (selected_layer + 1) % layers.count();
+}
+
+void ImageState::toggleLayer() {
+    if(selected_layer >= layers.count()) return;
+    layersChanged(layers.toggle(selected_layer));
+}
+
+// move the selected layer delta places up the stack, it stays selected
+void ImageState::moveLayer(int delta) {
+    if(selected_layer >= layers.count()) return;
+    int target = selected_layer + delta;
+    if(target < 0 || target >= layers.count()) return;
+    layersChanged(layers.move(selected_layer, delta));
+    selected_layer = target;
+}
+
+DirtyRegion& ImageState::getDirtyRegion() {
+    return dirty_region;
+}
+
+// every operation applied from now on is appended to log, NULL stops recording
+void ImageState::setOperationLog(OperationLog* log) {
+    operation_log = log;
+}
+
+// every change to current_image from now on is queued for journal to autosave, NULL stops journaling
+void ImageState::setJournal(Journal* journal) {
+    this->journal = journal;
+}
+
+void ImageState::record(const Operation& op) {
+    if(operation_log) operation_log->record(op);
+}
+
+// repeat a recorded operation the way the editor applied it
+void ImageState::applyOperation(const Operation& op) {
+    switch(op.type) {
+        case op_pick:
+            eyedropper_size = op.sample_size;
+            eyedropper_median = op.sample_median;
+            setEyedropperColor(op.a.x, op.a.y);
+            break;
+        case op_crop:
+            cropLeftClicked(op.a.x, op.a.y);
+            executeCrop(op.b.x, op.b.y);
+            break;
+        case op_fill:
+            fill_tolerance = op.tolerance;
+            paintBucketFill(op.a.x, op.a.y);
+            break;
+        case op_replace:
+            fill_tolerance = op.tolerance;
+            replaceAll(op.a.x, op.a.y);
+            break;
+        case op_stroke:
+            brush = op.brush;
+            setPencilActive(true);
+            for(size_t i = 0; i < op.points.size(); i++) pencilDraw(op.points[i].x, op.points[i].y);
+            setPencilActive(false);
+            break;
+        case op_select:
+            fill_tolerance = op.tolerance;
+            selectRegion(op.a.x, op.a.y, op.extend);
+            break;
+        case op_deselect:
+            clearSelection();
+            break;
+        case op_reset:
+            resetImage();
+            break;
+        case op_undo:
+            undo();
+            break;
+        case op_redo:
+            redo();
+            break;
+    }
+}
@@ -0,0 +1,295 @@
+/*******************************************************************************************************************//**
+ * @file journal.h
+ * @brief Background autosave of the edited image as a journal of changed tiles
+ **********************************************************************************************************************/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+#define JOURNAL_MAGIC "UTACVJ01"
+#define JOURNAL_TILE_SIZE 64
+// a checkpoint replaces the journal once this much tile data was appended, or after this long with anything appended
+#define JOURNAL_CHECKPOINT_BYTES ((size_t) 64 << 20)
+#define JOURNAL_CHECKPOINT_SECONDS 30
+
+// start of a journal, identifying the image file the session was editing
+struct JournalHeader {
+    char magic[8];
+    int64_t source_size;
+    int64_t source_mtime;
+};
+
+// one entry of a journal, followed by bytes of payload
+struct JournalRecord {
+    char kind;          // 'C' checkpoint (PNG of the whole image), 'S' new image size, 'T' tile (raw BGR rows)
+    char reserved[3];
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+    uint32_t bytes;
+};
+
+/*******************************************************************************************************************//**
+ * @class Journal
+ *
+ * @brief Appends the tiles of the image that changed to a file from a background thread
+ *
+ * The editing thread only marks the changed tiles in a queue and keeps a header of the image, so recording an edit
+ * costs a few map updates however large it is, and a crop, reset or undo of the whole image never copies it on the
+ * editing thread. The writer thread copies the marked tiles out of the image itself. Every mark carries a generation,
+ * and a tile leaves the queue only if it was not marked again while it was being copied, so a tile copied while an
+ * edit was still writing it is copied again once that edit is recorded. The writer appends the copies and syncs the
+ * file, and also applies them to its own copy of the image. From that copy it writes a checkpoint every so often: a
+ * new journal holding the whole image as a PNG, renamed over the old one, so the journal stays short. A session is
+ * recovered by decoding the last checkpoint and applying the tiles after it, stopping at a record cut short by a crash.
+ **********************************************************************************************************************/
+class Journal {
+    private:
+        struct Tile {
+            cv::Rect rect;
+            uint64_t generation;    // of the last mark, in the queue
+            cv::Mat pixels;         // the copy, in a batch taken from the queue
+        };
+
+        std::string path;
+        FILE* file;
+        JournalHeader header;
+        cv::Mat shadow;                     // the image as the journal describes it, writer thread only
+        size_t bytes_since_checkpoint;      // writer thread only
+        std::chrono::steady_clock::time_point last_checkpoint;
+        std::thread writer;
+
+        std::mutex lock;                    // guards the members below
+        std::condition_variable wake;
+        std::map<int64_t, Tile> pending;
+        cv::Mat image;                      // the image as last recorded, sharing the editing thread's pixels
+        uint64_t generation;
+        cv::Size size;
+        bool resized;
+        bool stopping;
+
+        Journal(const Journal&);
+        Journal& operator=(const Journal&);
+
+        static bool sourceInfo(const std::string& source, int64_t& size, int64_t& mtime) {
+            struct stat info;
+            if (stat(source.c_str(), &info) != 0) return false;
+            size = (int64_t) info.st_size;
+            mtime = (int64_t) info.st_mtime;
+            return true;
+        }
+
+        static bool writeRecord(FILE* out, char kind, cv::Rect rect, const uchar* payload, size_t bytes) {
+            JournalRecord record;
+            std::memset(&record, 0, sizeof(record));
+            record.kind = kind;
+            record.x = rect.x;
+            record.y = rect.y;
+            record.width = rect.width;
+            record.height = rect.height;
+            record.bytes = (uint32_t) bytes;
+            if (fwrite(&record, sizeof(record), 1, out) != 1) return false;
+            return bytes == 0 || fwrite(payload, 1, bytes, out) == bytes;
+        }
+
+        // replace the journal with one holding only the shadow image
+        bool writeCheckpoint() {
+            std::vector<uchar> png;
+            std::vector<int> params;
+            params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+            params.push_back(1);
+            if (!cv::imencode(".png", shadow, png, params)) return false;
+
+            std::string temporary = path + ".tmp";
+            FILE* out = fopen(temporary.c_str(), "wb");
+            if (!out) return false;
+            bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+                      writeRecord(out, 'C', cv::Rect(0, 0, shadow.cols, shadow.rows), &png[0], png.size()) &&
+                      fflush(out) == 0 && fsync(fileno(out)) == 0;
+            fclose(out);
+            if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+                remove(temporary.c_str());
+                return false;
+            }
+            if (file) fclose(file);
+            file = fopen(path.c_str(), "ab");
+            bytes_since_checkpoint = 0;
+            last_checkpoint = std::chrono::steady_clock::now();
+            return file != NULL;
+        }
+
+        // append one batch taken from the queue and apply it to the shadow image
+        void writeBatch(bool resize, cv::Size new_size, const std::map<int64_t, Tile>& tiles) {
+            if (resize) {
+                shadow.create(new_size, CV_8UC3);
+                if (file) writeRecord(file, 'S', cv::Rect(0, 0, new_size.width, new_size.height), NULL, 0);
+            }
+            for (std::map<int64_t, Tile>::const_iterator it = tiles.begin(); it != tiles.end(); ++it) {
+                const Tile& tile = it->second;
+                tile.pixels.copyTo(shadow(tile.rect));
+                size_t bytes = tile.pixels.total() * tile.pixels.elemSize();
+                if (file) writeRecord(file, 'T', tile.rect, tile.pixels.data, bytes);
+                bytes_since_checkpoint += bytes;
+            }
+            if (file && (resize || !tiles.empty())) {
+                fflush(file);
+                fdatasync(fileno(file));
+            }
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> guard(lock);
+            bool checkpoint_due = true;
+            while (true) {
+                if (!checkpoint_due) {
+                    wake.wait_for(guard, std::chrono::seconds(JOURNAL_CHECKPOINT_SECONDS),
+                                  [this] { return stopping || resized || !pending.empty(); });
+                }
+                bool resize = resized;
+                cv::Size new_size = size;
+                std::map<int64_t, Tile> tiles = pending;
+                cv::Mat source = image;
+                resized = false;
+                bool stop = stopping;
+                guard.unlock();
+
+                for (std::map<int64_t, Tile>::iterator it = tiles.begin(); it != tiles.end(); ++it) {
+                    source(it->second.rect).copyTo(it->second.pixels);
+                }
+                guard.lock();
+                // a tile marked again meanwhile may have been copied halfway through an edit, and stays queued
+                for (std::map<int64_t, Tile>::iterator it = tiles.begin(); it != tiles.end();) {
+                    std::map<int64_t, Tile>::iterator queued = pending.find(it->first);
+                    if (queued != pending.end() && queued->second.generation == it->second.generation) {
+                        pending.erase(queued);
+                        ++it;
+                    } else {
+                        tiles.erase(it++);
+                    }
+                }
+                guard.unlock();
+
+                writeBatch(resize, new_size, tiles);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_checkpoint).count();
+                checkpoint_due = checkpoint_due || bytes_since_checkpoint >= JOURNAL_CHECKPOINT_BYTES ||
+                                 (bytes_since_checkpoint > 0 && (stop || seconds >= JOURNAL_CHECKPOINT_SECONDS));
+                if (checkpoint_due) {
+                    if (!writeCheckpoint()) std::cout << "Error while writing checkpoint to journal " << path << std::endl;
+                    checkpoint_due = false;
+                }
+
+                guard.lock();
+                if (stop && pending.empty() && !resized) break;
+            }
+        }
+
+    public:
+        Journal() : file(NULL), bytes_since_checkpoint(0), generation(0), resized(false), stopping(false) {}
+        ~Journal() { close(); }
+
+        // start a new journal at path for an editing session on image, which was loaded from source
+        bool open(const std::string& path, const std::string& source, const cv::Mat& image) {
+            close();
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, JOURNAL_MAGIC, 8);
+            if (!sourceInfo(source, header.source_size, header.source_mtime)) return false;
+            this->path = path;
+            shadow = image.clone();
+            this->image = image;
+            size = image.size();
+            resized = false;
+            stopping = false;
+            pending.clear();
+            last_checkpoint = std::chrono::steady_clock::now();
+            writer = std::thread(&Journal::run, this);
+            return true;
+        }
+
+        // write whatever is queued, checkpoint, and stop the writer thread
+        void close() {
+            if (!writer.joinable()) return;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            writer.join();
+            if (file) fclose(file);
+            file = NULL;
+            image.release();
+        }
+
+        // editing thread; queue the tiles of image under region, the whole image must follow a change of size. image is
+        // read by the writer thread until the next call, so it must stay allocated and only be written by new edits
+        void record(const cv::Mat& image, cv::Rect region) {
+            region &= cv::Rect(0, 0, image.cols, image.rows);
+            if (region.area() <= 0 || !writer.joinable()) return;
+            const int T = JOURNAL_TILE_SIZE;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (image.size() != size) {
+                    // tiles queued at the old size are covered by the new image
+                    pending.clear();
+                    size = image.size();
+                    resized = true;
+                }
+                this->image = image;
+                for (int ty = region.y / T; ty <= (region.y + region.height - 1) / T; ty++) {
+                    for (int tx = region.x / T; tx <= (region.x + region.width - 1) / T; tx++) {
+                        Tile& tile = pending[((int64_t) ty << 32) | tx];
+                        tile.rect = cv::Rect(tx * T, ty * T, T, T) & cv::Rect(0, 0, image.cols, image.rows);
+                        tile.generation = ++generation;
+                    }
+                }
+            }
+            wake.notify_one();
+        }
+
+        // rebuild the image a journal at path describes, if it was written for the current version of source
+        static bool recover(const std::string& path, const std::string& source, cv::Mat& image) {
+            FILE* in = fopen(path.c_str(), "rb");
+            if (!in) return false;
+            JournalHeader stored;
+            int64_t size = 0, mtime = 0;
+            bool ok = fread(&stored, sizeof(stored), 1, in) == 1 && std::memcmp(stored.magic, JOURNAL_MAGIC, 8) == 0 &&
+                      sourceInfo(source, size, mtime) && stored.source_size == size && stored.source_mtime == mtime;
+            cv::Mat recovered;
+            JournalRecord record;
+            std::vector<uchar> payload;
+            while (ok && fread(&record, sizeof(record), 1, in) == 1) {
+                payload.resize(record.bytes);
+                if (record.bytes > 0 && fread(&payload[0], 1, record.bytes, in) != record.bytes) break;
+                cv::Rect rect(record.x, record.y, record.width, record.height);
+                if (record.kind == 'C') {
+                    recovered = cv::imdecode(payload, cv::IMREAD_COLOR);
+                } else if (record.kind == 'S') {
+                    recovered = cv::Mat::zeros(rect.height, rect.width, CV_8UC3);
+                } else if (record.kind == 'T' && !recovered.empty() && (rect & cv::Rect(0, 0, recovered.cols,
+                           recovered.rows)) == rect && record.bytes == (uint32_t) rect.area() * 3) {
+                    cv::Mat(rect.height, rect.width, CV_8UC3, &payload[0]).copyTo(recovered(rect));
+                }
+            }
+            fclose(in);
+            if (recovered.empty()) return false;
+            image = recovered;
+            return true;
+        }
+};
+
+#endif // JOURNAL_H
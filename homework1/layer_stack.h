@@ -0,0 +1,304 @@
+/*******************************************************************************************************************//**
+ * @file layer_stack.h
+ * @brief Edit layers kept apart from the image they are painted over, composited tile by tile
+ **********************************************************************************************************************/
+
+#ifndef LAYER_STACK_H
+#define LAYER_STACK_H
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "alpha_blend.h"
+#include "tile_store.h"
+
+// same as HISTORY_TILE_SIZE, so undo saves a layer tile as a patch of its own
+#define LAYER_TILE_SIZE 64
+// largest window of a layer a tool paints through at once, larger edits are painted a band of rows at a time
+#define LAYER_WINDOW_BYTES ((size_t) 32 << 20)
+
+/*******************************************************************************************************************//**
+ * @class LayerStack
+ *
+ * @brief Premultiplied BGRA layers over a base image that is never written
+ *
+ * Each layer covers the base image but is sparse: it is a grid of LAYER_TILE_SIZE tiles, and a tile only exists once
+ * a tool paints into it, so a layer takes memory in proportion to what is painted on it. Tools paint through a window,
+ * a plain BGRA image read out of the tiles under a rectangle and written back into them afterwards, which any cv::Mat
+ * code can draw into. With a TilePool, as for a tiled image, the tiles live in its scratch file rather than in RAM.
+ * The composite is the base with every visible layer blended over it in order, bottom first. It is only recomputed
+ * for the tiles an edit touched, and a tile is built from the base and the layers that hold data there, so hiding a
+ * layer or moving it up or down costs in proportion to what is painted on it rather than to the image.
+ **********************************************************************************************************************/
+class LayerStack {
+    private:
+        struct Layer {
+            std::string name;
+            bool visible;
+            std::map<int, cv::Mat> tiles;   // painted tiles, by index in the grid over the base
+        };
+
+        cv::Mat base;
+        cv::Mat composite;
+        int tiles_x;
+        std::vector<Layer> layers;      // bottom first
+        TilePool* pool;
+
+        class ComposeBody : public cv::ParallelLoopBody {
+            private:
+                const LayerStack& stack;
+                const std::vector<int>& tiles;
+            public:
+                ComposeBody(const LayerStack& stack, const std::vector<int>& tiles) : stack(stack), tiles(tiles) {}
+                void operator()(const cv::Range& range) const {
+                    for (int i = range.start; i < range.end; i++) {
+                        cv::Rect rect = stack.tileRect(tiles[i]);
+                        cv::Mat out = stack.composite(rect);
+                        stack.base(rect).copyTo(out);
+                        for (size_t l = 0; l < stack.layers.size(); l++) {
+                            const Layer& layer = stack.layers[l];
+                            if (!layer.visible) continue;
+                            std::map<int, cv::Mat>::const_iterator tile = layer.tiles.find(tiles[i]);
+                            if (tile == layer.tiles.end()) continue;
+                            for (int y = 0; y < rect.height; y++) {
+                                compositeRow(out.ptr<uchar>(y), tile->second.ptr<uchar>(y), rect.width);
+                            }
+                        }
+                    }
+                }
+        };
+
+        // indices of the tiles overlapping rect, which must already be clipped to the base
+        std::vector<int> tilesUnder(cv::Rect rect) const {
+            std::vector<int> tiles;
+            if (rect.area() <= 0) return tiles;
+            for (int ty = rect.y / LAYER_TILE_SIZE; ty <= (rect.y + rect.height - 1) / LAYER_TILE_SIZE; ty++) {
+                for (int tx = rect.x / LAYER_TILE_SIZE; tx <= (rect.x + rect.width - 1) / LAYER_TILE_SIZE; tx++) {
+                    tiles.push_back(ty * tiles_x + tx);
+                }
+            }
+            return tiles;
+        }
+
+        void releaseTiles() {
+            for (size_t l = 0; l < layers.size() && pool; l++) {
+                std::map<int, cv::Mat>::iterator tile;
+                for (tile = layers[l].tiles.begin(); tile != layers[l].tiles.end(); ++tile) pool->free(tile->second);
+            }
+            layers.clear();
+        }
+
+    public:
+        // painted tiles of every layer, by layer name
+        typedef std::map<std::string, std::map<int, cv::Mat> > TileSet;
+
+        LayerStack() : tiles_x(0), pool(NULL) {}
+        ~LayerStack() { releaseTiles(); }
+
+        // start with no layers over base, compositing into composite, which must have the same size; tiles come from
+        // pool when it is given, which must outlive the stack
+        void attach(const cv::Mat& base, const cv::Mat& composite, TilePool* pool = NULL) {
+            releaseTiles();
+            this->base = base;
+            this->composite = composite;
+            this->pool = pool;
+            tiles_x = (base.cols + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE;
+        }
+
+        int count() const { return (int) layers.size(); }
+        const std::string& getName(int index) const { return layers[index].name; }
+        bool isVisible(int index) const { return layers[index].visible; }
+
+        cv::Mat getComposite() const { return composite; }
+
+        // rows of a window as wide as cols that fit in LAYER_WINDOW_BYTES, a whole number of tiles
+        static int bandRows(int cols) {
+            size_t rows = LAYER_WINDOW_BYTES / ((size_t) std::max(cols, 1) * 4);
+            return (int) std::max<size_t>(LAYER_TILE_SIZE, rows / LAYER_TILE_SIZE * LAYER_TILE_SIZE);
+        }
+
+        // where a tile lies in the composite
+        cv::Rect tileRect(int tile) const {
+            int tx = tile % tiles_x, ty = tile / tiles_x;
+            cv::Rect rect(tx * LAYER_TILE_SIZE, ty * LAYER_TILE_SIZE, LAYER_TILE_SIZE, LAYER_TILE_SIZE);
+            return rect & cv::Rect(0, 0, base.cols, base.rows);
+        }
+
+        // the pixels of a painted tile, one of those usedTiles() or prepare() returned, to save for undo; they keep the
+        // same address for as long as the stack
+        cv::Mat getTile(int index, int tile) {
+            const cv::Mat& pixels = layers[index].tiles.find(tile)->second;
+            if (pool) pool->touch(pixels);
+            return pixels;
+        }
+
+        // index of the layer called name, added at the top of the stack the first time it is asked for
+        int find(const std::string& name) {
+            for (size_t i = 0; i < layers.size(); i++) {
+                if (layers[i].name == name) return (int) i;
+            }
+            Layer layer;
+            layer.name = name;
+            layer.visible = true;
+            layers.push_back(layer);
+            return (int) layers.size() - 1;
+        }
+
+        // make every tile of a layer under rect hold data, returning the tiles under rect
+        std::vector<int> prepare(int index, cv::Rect rect) {
+            rect &= cv::Rect(0, 0, base.cols, base.rows);
+            std::vector<int> tiles = tilesUnder(rect);
+            Layer& layer = layers[index];
+            for (size_t i = 0; i < tiles.size(); i++) {
+                cv::Mat& tile = layer.tiles[tiles[i]];
+                if (!tile.empty()) continue;
+                cv::Rect area = tileRect(tiles[i]);
+                tile = pool ? pool->allocate(area.height, area.width, CV_8UC4) : cv::Mat(area.size(), CV_8UC4);
+                tile.setTo(cv::Scalar::all(0));
+            }
+            return tiles;
+        }
+
+        // copy rect of a layer into window, transparent where nothing was painted
+        void read(int index, cv::Rect rect, cv::Mat& window) {
+            window.create(rect.size(), CV_8UC4);
+            window.setTo(cv::Scalar::all(0));
+            std::vector<int> tiles = tilesUnder(rect & cv::Rect(0, 0, base.cols, base.rows));
+            for (size_t i = 0; i < tiles.size(); i++) {
+                std::map<int, cv::Mat>::const_iterator found = layers[index].tiles.find(tiles[i]);
+                if (found == layers[index].tiles.end()) continue;
+                const cv::Mat& tile = found->second;
+                if (pool) pool->touch(tile);
+                cv::Rect area = tileRect(tiles[i]);
+                cv::Rect part = area & rect;
+                tile(cv::Rect(part.tl() - area.tl(), part.size())).copyTo(window(cv::Rect(part.tl() - rect.tl(),
+                                                                                          part.size())));
+            }
+        }
+
+        // copy window back over rect of a layer, which prepare() must have covered
+        void write(int index, cv::Rect rect, const cv::Mat& window) {
+            std::vector<int> tiles = tilesUnder(rect & cv::Rect(0, 0, base.cols, base.rows));
+            for (size_t i = 0; i < tiles.size(); i++) {
+                std::map<int, cv::Mat>::iterator found = layers[index].tiles.find(tiles[i]);
+                if (found == layers[index].tiles.end()) continue;
+                cv::Mat& tile = found->second;
+                if (pool) pool->touch(tile);
+                cv::Rect area = tileRect(tiles[i]);
+                cv::Rect part = area & rect;
+                cv::Mat target = tile(cv::Rect(part.tl() - area.tl(), part.size()));
+                window(cv::Rect(part.tl() - rect.tl(), part.size())).copyTo(target);
+            }
+        }
+
+        // tiles of a layer that hold data
+        std::vector<int> usedTiles(int index) const {
+            std::vector<int> tiles;
+            std::map<int, cv::Mat>::const_iterator tile;
+            for (tile = layers[index].tiles.begin(); tile != layers[index].tiles.end(); ++tile) {
+                tiles.push_back(tile->first);
+            }
+            return tiles;
+        }
+
+        // make every layer transparent again, the tiles stay in use so pixels restored into them by undo still show
+        void clear() {
+            for (size_t l = 0; l < layers.size(); l++) {
+                std::map<int, cv::Mat>::iterator tile;
+                for (tile = layers[l].tiles.begin(); tile != layers[l].tiles.end(); ++tile) {
+                    if (pool) pool->touch(tile->second);
+                    tile->second.setTo(cv::Scalar::all(0));
+                }
+            }
+        }
+
+        // exchange the painted tiles of every layer with the ones kept under its name in tiles, and composite again
+        // wherever either set was painted; reset hands the tiles to the undo history this way instead of copying them,
+        // and undo and redo hand them back; for in-memory images only, as the tiles are not paged in first
+        void swapTiles(TileSet& tiles) {
+            std::vector<int> changed;
+            for (size_t l = 0; l < layers.size(); l++) {
+                std::swap(layers[l].tiles, tiles[layers[l].name]);
+                std::vector<int> used = usedTiles((int) l);
+                changed.insert(changed.end(), used.begin(), used.end());
+                std::map<int, cv::Mat>::const_iterator tile;
+                for (tile = tiles[layers[l].name].begin(); tile != tiles[layers[l].name].end(); ++tile) {
+                    changed.push_back(tile->first);
+                }
+            }
+            std::sort(changed.begin(), changed.end());
+            changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+            cv::parallel_for_(cv::Range(0, (int) changed.size()), ComposeBody(*this, changed));
+        }
+
+        // show or hide a layer, returning the tiles whose composite changed
+        std::vector<cv::Rect> toggle(int index) {
+            layers[index].visible = !layers[index].visible;
+            std::vector<int> used = usedTiles(index);
+            std::vector<cv::Rect> tiles;
+            for (size_t i = 0; i < used.size(); i++) tiles.push_back(tileRect(used[i]));
+            return tiles;
+        }
+
+        // swap a layer with the one delta (1 or -1) places above it, returning the tiles whose composite changed
+        std::vector<cv::Rect> move(int index, int delta) {
+            std::vector<cv::Rect> tiles;
+            int other = index + delta;
+            if (other < 0 || other >= count()) return tiles;
+            std::swap(layers[index], layers[other]);
+            // the order only matters where both layers show something
+            if (!layers[index].visible || !layers[other].visible) return tiles;
+            std::map<int, cv::Mat>::const_iterator tile;
+            for (tile = layers[index].tiles.begin(); tile != layers[index].tiles.end(); ++tile) {
+                if (layers[other].tiles.count(tile->first)) tiles.push_back(tileRect(tile->first));
+            }
+            return tiles;
+        }
+
+        // move a layer to the top of the stack and show it, so what is painted on it next is not hidden by the layers
+        // that were above it, returning the tiles whose composite changed
+        std::vector<cv::Rect> raise(int index) {
+            std::vector<cv::Rect> tiles;
+            Layer layer = layers[index];
+            bool shown = layer.visible;
+            layers.erase(layers.begin() + index);
+            layer.visible = true;
+            layers.push_back(layer);
+            std::map<int, cv::Mat>::const_iterator tile;
+            for (tile = layer.tiles.begin(); tile != layer.tiles.end(); ++tile) {
+                // once shown, only the tiles it shares with a visible layer it passed over look different
+                bool changed = !shown;
+                for (int l = index; l < count() - 1 && !changed; l++) {
+                    changed = layers[l].visible && layers[l].tiles.count(tile->first);
+                }
+                if (changed) tiles.push_back(tileRect(tile->first));
+            }
+            return tiles;
+        }
+
+        // recompute the composite over every painted tile touching rect, paging those tiles in first for a tiled image
+        void compose(cv::Rect rect, TileStore* store = NULL) {
+            rect &= cv::Rect(0, 0, base.cols, base.rows);
+            std::vector<int> under = tilesUnder(rect);
+            std::vector<int> tiles;
+            for (size_t i = 0; i < under.size(); i++) {
+                // a tile no layer was ever painted on still holds the base
+                int t = under[i];
+                bool painted = false;
+                for (size_t l = 0; l < layers.size(); l++) {
+                    std::map<int, cv::Mat>::const_iterator tile = layers[l].tiles.find(t);
+                    if (tile == layers[l].tiles.end()) continue;
+                    if (pool) pool->touch(tile->second);
+                    painted = true;
+                }
+                if (!painted) continue;
+                tiles.push_back(t);
+                if (store) store->access(composite, tileRect(t));
+            }
+            cv::parallel_for_(cv::Range(0, (int) tiles.size()), ComposeBody(*this, tiles));
+        }
+};
+
+#endif // LAYER_STACK_H
@@ -0,0 +1,111 @@
+/*******************************************************************************************************************//**
+ * @file magic_wand.h
+ * @brief Selection of similarly colored regions, answered from one labeling of the whole image
+ **********************************************************************************************************************/
+
+#ifndef MAGIC_WAND_H
+#define MAGIC_WAND_H
+
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "bit_mask.h"
+#include "color_match.h"
+#include "run_labeler.h"
+
+/*******************************************************************************************************************//**
+ * @class MagicWand
+ *
+ * @brief Selects the connected region of similar color under a click
+ *
+ * Colors are sorted into classes by cutting each channel into buckets as wide as the tolerance allows, so any two
+ * pixels of one class are within tolerance of each other. The RunLabeler then labels the regions of every class in a
+ * single parallel pass, and the runs are grouped by label. After that a click costs a lookup of the run under it plus
+ * setting the bits of its region, however many clicks follow, until the image or the tolerance changes. Pixels just
+ * either side of a bucket edge fall in different classes even when their colors are close, which is the price of
+ * answering every click from one pass.
+ **********************************************************************************************************************/
+class MagicWand {
+    private:
+        RunLabeler labeler;
+        std::vector<int> label_first;   // runs of each label are label_runs[label_first[l] .. label_first[l + 1])
+        std::vector<int> label_runs;
+        ColorTolerance tolerance;
+        cv::Size size;
+        bool stale;
+
+        class ClassifyBody : public cv::ParallelLoopBody {
+            private:
+                const cv::Mat& image;
+                cv::Mat& classes;
+                int width;
+            public:
+                ClassifyBody(const cv::Mat& image, cv::Mat& classes, int width)
+                    : image(image), classes(classes), width(width) {}
+                void operator()(const cv::Range& range) const {
+                    for (int y = range.start; y < range.end; y++) {
+                        const uchar* p = image.ptr<uchar>(y);
+                        int* out = classes.ptr<int>(y);
+                        for (int x = 0; x < image.cols; x++, p += 3) {
+                            out[x] = (p[0] / width) | (p[1] / width) << 8 | (p[2] / width) << 16;
+                        }
+                    }
+                }
+        };
+
+        // channel bucket width that keeps every pair of colors in a bucket within tolerance
+        static int bucketWidth(const ColorTolerance& tolerance) {
+            if (tolerance.mode == tolerance_channel) return 1 + std::max(tolerance.amount, 0);
+            // a cube of side w - 1 has a diagonal of (w - 1) * sqrt(3)
+            if (tolerance.mode == tolerance_euclidean) return 1 + std::min(std::max(tolerance.amount, 0), 255) * 577 / 1000;
+            return 1;
+        }
+
+        void build(const cv::Mat& image) {
+            cv::Mat classes(image.rows, image.cols, CV_32SC1);
+            cv::parallel_for_(cv::Range(0, image.rows), ClassifyBody(image, classes, bucketWidth(tolerance)));
+            labeler.label(classes);
+
+            // group the runs by label, a counting sort since labels are run indices
+            int runs = labeler.runCount();
+            label_first.assign(runs + 1, 0);
+            for (int r = 0; r < runs; r++) label_first[labeler.labelOf(r) + 1]++;
+            for (int l = 0; l < runs; l++) label_first[l + 1] += label_first[l];
+            label_runs.resize(runs);
+            std::vector<int> next(label_first.begin(), label_first.end() - 1);
+            for (int r = 0; r < runs; r++) label_runs[next[labeler.labelOf(r)]++] = r;
+
+            size = image.size();
+            stale = false;
+        }
+
+    public:
+        MagicWand() : stale(true) {}
+
+        // the image changed, the next click labels it again
+        void invalidate() {
+            stale = true;
+        }
+
+        // set the bits of the region around seed in selection, which must have the image's size; returns the region's
+        // bounding box
+        cv::Rect select(const cv::Mat& image, cv::Point seed, const ColorTolerance& tolerance, BitMask& selection) {
+            if (stale || image.size() != size || tolerance.mode != this->tolerance.mode ||
+                tolerance.amount != this->tolerance.amount) {
+                this->tolerance = tolerance;
+                build(image);
+            }
+            int label = labeler.labelAt(seed.x, seed.y);
+            cv::Rect bounds;
+            if (label < 0) return bounds;
+            const std::vector<Span>& runs = labeler.getRuns();
+            for (int i = label_first[label]; i < label_first[label + 1]; i++) {
+                const Span& run = runs[label_runs[i]];
+                selection.setRange(run.y, run.x0, run.x1);
+                cv::Rect rect(run.x0, run.y, run.x1 - run.x0, 1);
+                bounds = (i == label_first[label]) ? rect : (bounds | rect);
+            }
+            return bounds;
+        }
+};
+
+#endif // MAGIC_WAND_H
@@ -0,0 +1,184 @@
+/*******************************************************************************************************************//**
+ * @file operation_log.h
+ * @brief Recording and loading of editor operations so an edit sequence can be replayed on other images
+ **********************************************************************************************************************/
+
+#ifndef OPERATION_LOG_H
+#define OPERATION_LOG_H
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "color_match.h"
+#include "pencil_stroke.h"
+
+#define OPERATION_LOG_HEADER "# homework1 operation log v1"
+
+enum OperationType {op_pick, op_crop, op_fill, op_replace, op_stroke, op_reset, op_undo, op_redo, op_select, op_deselect};
+
+// one recorded ImageState operation, in the image coordinates it was applied at
+struct Operation {
+    OperationType type;
+    cv::Point a;                    // pick, fill, replace and select position, first crop corner
+    cv::Point b;                    // second crop corner
+    int sample_size;                // pick window, 1 for a single pixel
+    bool sample_median;             // pick takes the median instead of the mean
+    bool extend;                    // select adds to the selection instead of replacing it
+    ColorTolerance tolerance;       // fill, replace and select
+    BrushSettings brush;            // stroke
+    std::vector<cv::Point> points;  // stroke samples
+    Operation(OperationType type = op_reset) : type(type), sample_size(1), sample_median(false), extend(false) {}
+};
+
+/*******************************************************************************************************************//**
+ * @class OperationLog
+ *
+ * @brief Text log with one operation per line
+ *
+ * Lines look like "fill 12 40 channel 8" or "stroke 2 255 0 3 10 10 11 12 14 13". Operations are written and flushed
+ * as they happen, so a log survives the editor being killed. Settings a tool depends on, such as the fill tolerance
+ * and brush, are stored with the operation instead of as separate steps, so replay does not depend on the order in
+ * which presets were cycled.
+ **********************************************************************************************************************/
+class OperationLog {
+    private:
+        std::ofstream out;
+
+        static const char* modeName(ToleranceMode mode) {
+            if (mode == tolerance_channel) return "channel";
+            if (mode == tolerance_euclidean) return "euclidean";
+            return "exact";
+        }
+
+        static bool parseMode(const std::string& name, ToleranceMode& mode) {
+            if (name == "exact") mode = tolerance_exact;
+            else if (name == "channel") mode = tolerance_channel;
+            else if (name == "euclidean") mode = tolerance_euclidean;
+            else return false;
+            return true;
+        }
+
+        void finish(std::ostringstream& line) {
+            if (!out.is_open()) return;
+            out << line.str() << "\n";
+            out.flush();
+        }
+
+    public:
+        bool open(const std::string& path) {
+            out.open(path.c_str(), std::ios::out | std::ios::trunc);
+            if (!out.is_open()) return false;
+            out << OPERATION_LOG_HEADER << "\n";
+            return true;
+        }
+
+        void record(const Operation& op) {
+            std::ostringstream line;
+            switch (op.type) {
+                case op_pick:
+                    line << "pick " << op.a.x << " " << op.a.y << " " << op.sample_size << " " << op.sample_median;
+                    break;
+                case op_crop:
+                    line << "crop " << op.a.x << " " << op.a.y << " " << op.b.x << " " << op.b.y;
+                    break;
+                case op_fill:
+                    line << "fill " << op.a.x << " " << op.a.y << " " << modeName(op.tolerance.mode) << " "
+                         << op.tolerance.amount;
+                    break;
+                case op_replace:
+                    line << "replace " << op.a.x << " " << op.a.y << " " << modeName(op.tolerance.mode) << " "
+                         << op.tolerance.amount;
+                    break;
+                case op_stroke:
+                    line << "stroke " << op.brush.radius << " " << op.brush.opacity << " " << op.brush.antialiased
+                         << " " << op.points.size();
+                    for (size_t i = 0; i < op.points.size(); i++) line << " " << op.points[i].x << " " << op.points[i].y;
+                    break;
+                case op_reset:
+                    line << "reset";
+                    break;
+                case op_undo:
+                    line << "undo";
+                    break;
+                case op_redo:
+                    line << "redo";
+                    break;
+                case op_select:
+                    line << "select " << op.a.x << " " << op.a.y << " " << modeName(op.tolerance.mode) << " "
+                         << op.tolerance.amount << " " << op.extend;
+                    break;
+                case op_deselect:
+                    line << "deselect";
+                    break;
+            }
+            finish(line);
+        }
+
+        // read every operation in path, returning false and naming the line on a parse error
+        static bool load(const std::string& path, std::vector<Operation>& ops) {
+            std::ifstream in(path.c_str());
+            if (!in.is_open()) {
+                std::cout << "Error while opening operation log " << path << std::endl;
+                return false;
+            }
+            std::string text;
+            int line_number = 0;
+            while (std::getline(in, text)) {
+                line_number++;
+                if (text.empty() || text[0] == '#') continue;
+                std::istringstream line(text);
+                std::string name;
+                line >> name;
+                Operation op;
+                bool ok = true;
+                if (name == "pick") {
+                    op.type = op_pick;
+                    ok = (bool) (line >> op.a.x >> op.a.y);
+                    // the window was added later, older logs pick single pixels
+                    if (ok && line >> op.sample_size) ok = (bool) (line >> op.sample_median);
+                } else if (name == "crop") {
+                    op.type = op_crop;
+                    ok = (bool) (line >> op.a.x >> op.a.y >> op.b.x >> op.b.y);
+                } else if (name == "fill" || name == "replace") {
+                    op.type = (name == "fill") ? op_fill : op_replace;
+                    std::string mode;
+                    ok = (line >> op.a.x >> op.a.y >> mode >> op.tolerance.amount) && parseMode(mode, op.tolerance.mode);
+                } else if (name == "stroke") {
+                    op.type = op_stroke;
+                    size_t count = 0;
+                    ok = (bool) (line >> op.brush.radius >> op.brush.opacity >> op.brush.antialiased >> count);
+                    for (size_t i = 0; ok && i < count; i++) {
+                        cv::Point p;
+                        ok = (bool) (line >> p.x >> p.y);
+                        op.points.push_back(p);
+                    }
+                } else if (name == "reset") {
+                    op.type = op_reset;
+                } else if (name == "undo") {
+                    op.type = op_undo;
+                } else if (name == "redo") {
+                    op.type = op_redo;
+                } else if (name == "select") {
+                    op.type = op_select;
+                    std::string mode;
+                    ok = (line >> op.a.x >> op.a.y >> mode >> op.tolerance.amount >> op.extend) &&
+                         parseMode(mode, op.tolerance.mode);
+                } else if (name == "deselect") {
+                    op.type = op_deselect;
+                } else {
+                    ok = false;
+                }
+                if (!ok) {
+                    std::cout << "Error in operation log " << path << " at line " << line_number << ": " << text << std::endl;
+                    return false;
+                }
+                ops.push_back(op);
+            }
+            return true;
+        }
+};
+
+#endif // OPERATION_LOG_H
@@ -0,0 +1,94 @@
+/*******************************************************************************************************************//**
+ * @file parallel_fill.h
+ * @brief Multi-threaded tolerance fill for large images
+ **********************************************************************************************************************/
+
+#ifndef PARALLEL_FILL_H
+#define PARALLEL_FILL_H
+
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "bit_mask.h"
+#include "color_match.h"
+#include "run_labeler.h"
+#include "scanline_fill.h"
+
+/*******************************************************************************************************************//**
+ * @class ParallelFill
+ *
+ * @brief Finds the region around a seed by matching every row and labeling the matches on all cores
+ *
+ * Unlike ScanlineFill, which only looks at rows the region reaches, this always tests the whole image. It pays off
+ * when regions are large, because both the color test and the union-find labeling split cleanly by row bands.
+ **********************************************************************************************************************/
+class ParallelFill {
+    private:
+        cv::Mat image;
+        cv::Vec3b target;
+        ColorTolerance tolerance;
+        BitMask matches;
+        RunLabeler labeler;
+        std::vector<Span> spans;
+
+        class MatchRowsBody : public cv::ParallelLoopBody {
+            private:
+                const ParallelFill& fill;
+                BitMask& matches;
+            public:
+                MatchRowsBody(const ParallelFill& fill, BitMask& matches) : fill(fill), matches(matches) {}
+                void operator()(const cv::Range& range) const {
+                    std::vector<uchar> scratch(fill.image.cols);
+                    for (int y = range.start; y < range.end; y++) {
+                        matchRow(fill.image.ptr<cv::Vec3b>(y), fill.image.cols, fill.target, fill.tolerance, &scratch[0]);
+                        matches.packRow(y, &scratch[0]);
+                    }
+                }
+        };
+
+    public:
+        ParallelFill(const cv::Mat& image, const ColorTolerance& tolerance = ColorTolerance())
+            : image(image), tolerance(tolerance) {}
+
+        // collect the spans of the region containing seed, which must lie inside the image; with a clip mask the
+        // region only grows through pixels set in it
+        const std::vector<Span>& findRegion(cv::Point seed, const BitMask* clip = NULL) {
+            target = image.at<cv::Vec3b>(seed.y, seed.x);
+            matches.reset(image.rows, image.cols);
+            cv::parallel_for_(cv::Range(0, image.rows), MatchRowsBody(*this, matches));
+            if (clip) matches.intersect(*clip);
+            labeler.label(matches);
+
+            spans.clear();
+            int component = labeler.labelAt(seed.x, seed.y);
+            if (component >= 0) labeler.collect(component, spans);
+            return spans;
+        }
+
+        const std::vector<Span>& getSpans() const { return spans; }
+};
+
+/*******************************************************************************************************************//**
+ * @brief Write color over a list of spans, splitting long lists across threads
+ *
+ * color is a Scalar so a BGRA layer can be given its alpha along with the color.
+ **********************************************************************************************************************/
+class PaintSpansBody : public cv::ParallelLoopBody {
+    private:
+        cv::Mat& image;
+        const std::vector<Span>& spans;
+        cv::Scalar color;
+    public:
+        PaintSpansBody(cv::Mat& image, const std::vector<Span>& spans, cv::Scalar color)
+            : image(image), spans(spans), color(color) {}
+        void operator()(const cv::Range& range) const {
+            for (int i = range.start; i < range.end; i++) {
+                image.row(spans[i].y).colRange(spans[i].x0, spans[i].x1).setTo(color);
+            }
+        }
+};
+
+inline void paintSpans(cv::Mat& image, const std::vector<Span>& spans, cv::Scalar color) {
+    cv::parallel_for_(cv::Range(0, (int) spans.size()), PaintSpansBody(image, spans, color));
+}
+
+#endif // PARALLEL_FILL_H
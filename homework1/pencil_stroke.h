@@ -0,0 +1,171 @@
+/*******************************************************************************************************************//**
+ * @file pencil_stroke.h
+ * @brief Buffered pencil strokes rasterized as polylines in batches
+ **********************************************************************************************************************/
+
+#ifndef PENCIL_STROKE_H
+#define PENCIL_STROKE_H
+
+#include <vector>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "alpha_blend.h"
+#include "bit_mask.h"
+
+// margin added whenever the coverage mask grows, so a stroke moving steadily in one direction rarely regrows it
+#define STROKE_COVERAGE_MARGIN 256
+
+// shape and strength of the pencil tip
+struct BrushSettings {
+    int radius;         // 0 draws one pixel wide lines
+    int opacity;        // 0 to 255
+    bool antialiased;
+    BrushSettings(int radius = 0, int opacity = 255, bool antialiased = false)
+        : radius(radius), opacity(opacity), antialiased(antialiased) {}
+};
+
+inline std::ostream& operator<<(std::ostream& out, const BrushSettings& brush) {
+    return out << "radius " << brush.radius << ", opacity " << brush.opacity
+               << (brush.antialiased ? ", antialiased" : "");
+}
+
+/*******************************************************************************************************************//**
+ * @class PencilStroke
+ *
+ * @brief Collects mouse samples for one stroke and rasterizes them together
+ *
+ * Samples are only appended while the mouse moves. rasterize() draws every pending segment as one polyline into a
+ * coverage mask, so fast strokes are joined by lines instead of leaving gaps. Coverage is blended with the
+ * vectorized kernel in alpha_blend.h. The stroke remembers how much alpha it has already put on each pixel, so joints
+ * between batches and self-overlaps of a translucent stroke are not darkened twice. That coverage mask only spans the
+ * area the stroke has reached so far, so a stroke on a huge image costs memory in proportion to the stroke.
+ **********************************************************************************************************************/
+class PencilStroke {
+    private:
+        std::vector<cv::Point> pending;
+        bool drawn;
+        cv::Rect bounds;            // the image being drawn on
+        cv::Mat coverage;
+        cv::Rect coverage_area;     // pixels of the image covered by the coverage mask
+        std::vector<uchar> weights;
+
+        // weight that takes a pixel blended at alpha a_old to the result of blending its original at alpha a_new
+        static std::vector<uchar> buildWeightTable() {
+            std::vector<uchar> table(256 * 256, 0);
+            for (int a_old = 0; a_old < 255; a_old++) {
+                for (int a_new = a_old; a_new < 256; a_new++) {
+                    table[a_old * 256 + a_new] = (uchar) ((255 * (a_new - a_old) + (255 - a_old) / 2) / (255 - a_old));
+                }
+            }
+            return table;
+        }
+
+        static const uchar* weightTable() {
+            static const std::vector<uchar> table = buildWeightTable();
+            return &table[0];
+        }
+
+        // make the coverage mask span roi, keeping what the stroke has applied so far
+        void growCoverage(cv::Rect roi) {
+            if (coverage_area.area() > 0 && (roi & coverage_area) == roi) return;
+            cv::Rect grown = (coverage_area.area() > 0) ? (coverage_area | roi) : roi;
+            grown = cv::Rect(grown.x - STROKE_COVERAGE_MARGIN, grown.y - STROKE_COVERAGE_MARGIN,
+                             grown.width + 2 * STROKE_COVERAGE_MARGIN, grown.height + 2 * STROKE_COVERAGE_MARGIN) & bounds;
+            cv::Mat larger = cv::Mat::zeros(grown.size(), CV_8UC1);
+            if (coverage_area.area() > 0) {
+                coverage.copyTo(larger(cv::Rect(coverage_area.tl() - grown.tl(), coverage_area.size())));
+            }
+            coverage = larger;
+            coverage_area = grown;
+        }
+
+    public:
+        PencilStroke() : drawn(false) {}
+
+        void begin(cv::Size size) {
+            bounds = cv::Rect(0, 0, size.width, size.height);
+            coverage.release();
+            coverage_area = cv::Rect();
+            pending.clear();
+            drawn = false;
+        }
+
+        void addSample(cv::Point p) {
+            pending.push_back(p);
+        }
+
+        bool hasPending() const {
+            return drawn ? pending.size() > 1 : !pending.empty();
+        }
+
+        // pixels the next rasterize() call may write, clipped to the image
+        cv::Rect pendingBounds(const BrushSettings& brush) const {
+            if (!hasPending()) return cv::Rect();
+            int x0 = pending[0].x, x1 = pending[0].x, y0 = pending[0].y, y1 = pending[0].y;
+            for (size_t i = 1; i < pending.size(); i++) {
+                x0 = std::min(x0, pending[i].x);
+                x1 = std::max(x1, pending[i].x);
+                y0 = std::min(y0, pending[i].y);
+                y1 = std::max(y1, pending[i].y);
+            }
+            int pad = brush.radius + 2;
+            return cv::Rect(x0 - pad, y0 - pad, x1 - x0 + 2 * pad + 1, y1 - y0 + 2 * pad + 1) & bounds;
+        }
+
+        // draw every pending segment into image within roi, which should come from pendingBounds(); image is either
+        // BGR or a premultiplied BGRA layer, and only pixels set in clip are drawn when it is given. image may be a
+        // window cut out of the stroke's image whose first pixel lies at origin
+        void rasterize(cv::Mat& image, cv::Rect roi, const BrushSettings& brush, cv::Vec3b color,
+                       const BitMask* clip = NULL, cv::Point origin = cv::Point()) {
+            if (!hasPending()) return;
+            if (roi.area() > 0) {
+                cv::Mat batch = cv::Mat::zeros(roi.size(), CV_8UC1);
+                int lineType = brush.antialiased ? cv::LINE_AA : cv::LINE_8;
+                cv::Scalar strength(brush.opacity);
+                std::vector<std::vector<cv::Point> > polyline(1);
+                for (size_t i = 0; i < pending.size(); i++) polyline[0].push_back(pending[i] - roi.tl());
+                if (polyline[0].size() == 1) {
+                    cv::circle(batch, polyline[0][0], brush.radius, strength, cv::FILLED, lineType);
+                } else {
+                    cv::polylines(batch, polyline, false, strength, 2 * brush.radius + 1, lineType);
+                }
+
+                growCoverage(roi);
+                const uchar* table = weightTable();
+                weights.resize(roi.width);
+                for (int y = 0; y < roi.height; y++) {
+                    uchar* add = batch.ptr<uchar>(y);
+                    if (clip) {
+                        for (int x = 0; x < roi.width; x++) {
+                            if (!clip->test(roi.x + x, roi.y + y)) add[x] = 0;
+                        }
+                    }
+                    uchar* applied = coverage.ptr<uchar>(roi.y - coverage_area.y + y) + roi.x - coverage_area.x;
+                    for (int x = 0; x < roi.width; x++) {
+                        int a_new = std::max(applied[x], add[x]);
+                        weights[x] = table[applied[x] * 256 + a_new];
+                        applied[x] = (uchar) a_new;
+                    }
+                    uchar* row = image.ptr<uchar>(roi.y - origin.y + y);
+                    if (image.channels() == 4) {
+                        blendLayerRow(row + 4 * (roi.x - origin.x), &weights[0], color, roi.width);
+                    } else {
+                        blendColorRow(row + 3 * (roi.x - origin.x), &weights[0], color, roi.width);
+                    }
+                }
+            }
+            cv::Point last = pending.back();
+            pending.clear();
+            pending.push_back(last);
+            drawn = true;
+        }
+
+        void end() {
+            coverage.release();
+            coverage_area = cv::Rect();
+            pending.clear();
+            drawn = false;
+        }
+};
+
+#endif // PENCIL_STROKE_H
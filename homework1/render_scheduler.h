@@ -0,0 +1,73 @@
+/*******************************************************************************************************************//**
+ * @file render_scheduler.h
+ * @brief Frame-rate limiting of redraws of the edited image
+ **********************************************************************************************************************/
+
+#ifndef RENDER_SCHEDULER_H
+#define RENDER_SCHEDULER_H
+
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "dirty_region.h"
+
+#define DEFAULT_RENDER_FPS 60.0
+
+/*******************************************************************************************************************//**
+ * @class RenderScheduler
+ *
+ * @brief Decides when the window is redrawn
+ *
+ * Tools only report dirty rectangles; nothing is uploaded from inside a mouse callback. The editing loop asks the
+ * scheduler how long it may wait for input and hands it the dirty region after every wait. frameDue() says whether to
+ * present, which happens at most once per frame interval and only when something changed since the last frame.
+ **********************************************************************************************************************/
+class RenderScheduler {
+    private:
+        double frame_ticks;
+        int64 last_present;
+        DirtyRegion pending;
+        bool force;
+
+    public:
+        explicit RenderScheduler(double fps = DEFAULT_RENDER_FPS) : last_present(0), force(true) {
+            setFrameRate(fps);
+        }
+
+        void setFrameRate(double fps) {
+            frame_ticks = cv::getTickFrequency() / std::max(fps, 1.0);
+        }
+
+        double getFrameRate() const {
+            return cv::getTickFrequency() / frame_ticks;
+        }
+
+        // the next frame should be drawn even if nothing was reported dirty
+        void invalidate() { force = true; }
+
+        // milliseconds the event loop may block before the next frame is due, at least 1, or -1 when nothing is
+        // waiting to be drawn and only new input can make a frame due
+        int waitMillis() const {
+            if (pending.empty() && !force) return -1;
+            double remaining = (last_present + frame_ticks - cv::getTickCount()) * 1000.0 / cv::getTickFrequency();
+            return std::max(1, (int) remaining);
+        }
+
+        // take over the tools' dirty rectangles, returning true when a frame should be presented now
+        bool frameDue(DirtyRegion& dirty) {
+            pending.add(dirty);
+            dirty.clear();
+            if (pending.empty() && !force) return false;
+            return force || cv::getTickCount() - last_present >= frame_ticks;
+        }
+
+        // everything that changed since the last presented frame
+        const DirtyRegion& getPending() const { return pending; }
+
+        void presented() {
+            pending.clear();
+            force = false;
+            last_present = cv::getTickCount();
+        }
+};
+
+#endif // RENDER_SCHEDULER_H
@@ -0,0 +1,226 @@
+/*******************************************************************************************************************//**
+ * @file run_labeler.h
+ * @brief Parallel connected-component labeling of a bit mask or class map by row runs and union-find
+ **********************************************************************************************************************/
+
+#ifndef RUN_LABELER_H
+#define RUN_LABELER_H
+
+#include <vector>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "bit_mask.h"
+#include "scanline_fill.h"
+
+/*******************************************************************************************************************//**
+ * @class RunLabeler
+ *
+ * @brief Labels 4-connected components of the set bits in a BitMask, or of equal values in a class map
+ *
+ * Every maximal run of set bits in a row becomes one union-find node, and runs that overlap a run in the row above
+ * are joined. Given a class map instead, every pixel is in a run: runs are maximal stretches of one class, and only
+ * overlapping runs of the same class are joined, so one pass labels every region of the image at once. The image is
+ * split into horizontal bands that are extracted and joined on all cores, then the band seams are joined in a single
+ * pass. Roots are always the smallest run index of their component, so one forward sweep leaves every run pointing
+ * directly at its label.
+ **********************************************************************************************************************/
+class RunLabeler {
+    private:
+        std::vector<Span> runs;
+        std::vector<int> row_first;
+        std::vector<int> parent;
+        std::vector<int> run_class;     // empty when labeling a BitMask
+        const BitMask* mask;
+        const cv::Mat* classes;
+        int bands;
+
+        int find(int i) {
+            while (parent[i] != i) {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+            }
+            return i;
+        }
+
+        void unite(int a, int b) {
+            a = find(a);
+            b = find(b);
+            if (a < b) parent[b] = a;
+            else if (b < a) parent[a] = b;
+        }
+
+        // join runs of row y with the runs they overlap in row y - 1
+        void uniteRows(int y) {
+            int i = row_first[y - 1], i_end = row_first[y];
+            int j = row_first[y], j_end = row_first[y + 1];
+            while (i < i_end && j < j_end) {
+                if (runs[i].x0 < runs[j].x1 && runs[j].x0 < runs[i].x1 &&
+                    (run_class.empty() || run_class[i] == run_class[j])) {
+                    unite(i, j);
+                }
+                if (runs[i].x1 < runs[j].x1) i++;
+                else if (runs[j].x1 < runs[i].x1) j++;
+                else { i++; j++; }
+            }
+        }
+
+        int rowCount() const {
+            return mask ? mask->rows() : classes->rows;
+        }
+
+        int bandStart(int band) const {
+            return (int) ((long long) rowCount() * band / bands);
+        }
+
+        // end of the run of equal class values starting at x in a row of the class map
+        static int classRunEnd(const int* row, int x, int cols) {
+            int value = row[x];
+            while (++x < cols && row[x] == value) {}
+            return x;
+        }
+
+        void labelRuns() {
+            int rows = rowCount();
+            bands = std::max(1, std::min(rows, cv::getNumThreads() * 4));
+
+            row_first.assign(rows + 1, 0);
+            cv::parallel_for_(cv::Range(0, rows), CountRunsBody(*this));
+            for (int y = 0; y < rows; y++) row_first[y + 1] += row_first[y];
+
+            runs.assign(row_first[rows], Span(0, 0, 0));
+            parent.resize(runs.size());
+            if (classes) run_class.resize(runs.size());
+            cv::parallel_for_(cv::Range(0, bands), LabelBandsBody(*this));
+
+            for (int band = 1; band < bands; band++) {
+                int y = bandStart(band);
+                if (y > 0 && y < rows) uniteRows(y);
+            }
+            for (size_t i = 0; i < parent.size(); i++) parent[i] = parent[parent[i]];
+        }
+
+        class CountRunsBody : public cv::ParallelLoopBody {
+            private:
+                RunLabeler& labeler;
+            public:
+                explicit CountRunsBody(RunLabeler& labeler) : labeler(labeler) {}
+                void operator()(const cv::Range& range) const {
+                    if (labeler.classes) {
+                        const cv::Mat& classes = *labeler.classes;
+                        for (int y = range.start; y < range.end; y++) {
+                            const int* row = classes.ptr<int>(y);
+                            int count = 0;
+                            for (int x = 0; x < classes.cols; x = classRunEnd(row, x, classes.cols)) count++;
+                            labeler.row_first[y + 1] = count;
+                        }
+                        return;
+                    }
+                    const BitMask& mask = *labeler.mask;
+                    for (int y = range.start; y < range.end; y++) {
+                        int count = 0;
+                        int x = mask.findSet(y, 0, mask.cols());
+                        while (x < mask.cols()) {
+                            count++;
+                            x = mask.findSet(y, mask.findClear(y, x, mask.cols()), mask.cols());
+                        }
+                        labeler.row_first[y + 1] = count;
+                    }
+                }
+        };
+
+        class LabelBandsBody : public cv::ParallelLoopBody {
+            private:
+                RunLabeler& labeler;
+            public:
+                explicit LabelBandsBody(RunLabeler& labeler) : labeler(labeler) {}
+                void operator()(const cv::Range& range) const {
+                    for (int band = range.start; band < range.end; band++) {
+                        int y0 = labeler.bandStart(band), y1 = labeler.bandStart(band + 1);
+                        for (int y = y0; y < y1; y++) {
+                            if (labeler.classes) extractClassRuns(y);
+                            else extractRuns(y);
+                            if (y > y0) labeler.uniteRows(y);
+                        }
+                    }
+                }
+
+                void extractRuns(int y) const {
+                    const BitMask& mask = *labeler.mask;
+                    int r = labeler.row_first[y];
+                    int x = mask.findSet(y, 0, mask.cols());
+                    while (x < mask.cols()) {
+                        int end = mask.findClear(y, x, mask.cols());
+                        labeler.runs[r] = Span(y, x, end);
+                        labeler.parent[r] = r;
+                        r++;
+                        x = mask.findSet(y, end, mask.cols());
+                    }
+                }
+
+                void extractClassRuns(int y) const {
+                    const cv::Mat& classes = *labeler.classes;
+                    const int* row = classes.ptr<int>(y);
+                    int r = labeler.row_first[y];
+                    for (int x = 0; x < classes.cols; r++) {
+                        int end = classRunEnd(row, x, classes.cols);
+                        labeler.runs[r] = Span(y, x, end);
+                        labeler.parent[r] = r;
+                        labeler.run_class[r] = row[x];
+                        x = end;
+                    }
+                }
+        };
+
+    public:
+        RunLabeler() : mask(NULL), classes(NULL), bands(1) {}
+
+        void label(const BitMask& source) {
+            mask = &source;
+            run_class.clear();
+            labelRuns();
+            mask = NULL;
+        }
+
+        // label the regions of equal value in a CV_32SC1 class map
+        void label(const cv::Mat& source) {
+            classes = &source;
+            labelRuns();
+            classes = NULL;
+        }
+
+        const std::vector<Span>& getRuns() const { return runs; }
+
+        int runCount() const { return (int) runs.size(); }
+
+        // index of the run covering (x, y), or -1 if the pixel was not set
+        int runAt(int x, int y) const {
+            if (y < 0 || y + 1 >= (int) row_first.size()) return -1;
+            std::vector<Span>::const_iterator first = runs.begin() + row_first[y];
+            std::vector<Span>::const_iterator last = runs.begin() + row_first[y + 1];
+            int lo = 0, hi = (int) (last - first);
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (first[mid].x1 <= x) lo = mid + 1;
+                else hi = mid;
+            }
+            if (first + lo == last || first[lo].x0 > x) return -1;
+            return row_first[y] + lo;
+        }
+
+        // component label of a run, valid once label() has returned
+        int labelOf(int run) const { return parent[run]; }
+
+        int labelAt(int x, int y) const {
+            int run = runAt(x, y);
+            return (run < 0) ? -1 : parent[run];
+        }
+
+        // append every run carrying the given label to out, in row order
+        void collect(int component, std::vector<Span>& out) const {
+            for (size_t i = component; i < runs.size(); i++) {
+                if (parent[i] == component) out.push_back(runs[i]);
+            }
+        }
+};
+
+#endif // RUN_LABELER_H
@@ -0,0 +1,93 @@
+/*******************************************************************************************************************//**
+ * @file scanline_fill.h
+ * @brief Explicit-stack scanline flood fill used by the paint bucket tool
+ **********************************************************************************************************************/
+
+#ifndef SCANLINE_FILL_H
+#define SCANLINE_FILL_H
+
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "bit_mask.h"
+#include "color_match.h"
+
+// a horizontal run of pixels [x0, x1) on row y
+struct Span {
+    int y;
+    int x0;
+    int x1;
+    Span(int y, int x0, int x1) : y(y), x0(x0), x1(x1) {}
+};
+
+/*******************************************************************************************************************//**
+ * @class ScanlineFill
+ *
+ * @brief Finds the 4-connected region of pixels matching the seed pixel, one row run at a time
+ *
+ * Rows are compared against the target color (within a tolerance) lazily, a whole row per call, and packed into a bit
+ * mask of pixels that still need to be visited. Walking the region clears bits as runs are taken, so the mask doubles
+ * as the visited set and every pixel is expanded at most once. No recursion is used, so region size is limited only by memory.
+ **********************************************************************************************************************/
+class ScanlineFill {
+    private:
+        cv::Mat image;
+        cv::Vec3b target;
+        ColorTolerance tolerance;
+        BitMask pending;
+        std::vector<uchar> row_ready;
+        std::vector<uchar> row_scratch;
+        std::vector<Span> spans;
+
+        void prepareRow(int y) {
+            if (row_ready[y]) return;
+            matchRow(image.ptr<cv::Vec3b>(y), image.cols, target, tolerance, &row_scratch[0]);
+            pending.packRow(y, &row_scratch[0]);
+            row_ready[y] = 1;
+        }
+
+    public:
+        ScanlineFill(const cv::Mat& image, const ColorTolerance& tolerance = ColorTolerance())
+            : image(image), tolerance(tolerance) {}
+
+        // collect the spans of the region containing seed, which must lie inside the image
+        const std::vector<Span>& findRegion(cv::Point seed) {
+            target = image.at<cv::Vec3b>(seed.y, seed.x);
+            pending.reset(image.rows, image.cols);
+            row_ready.assign(image.rows, 0);
+            row_scratch.resize(image.cols);
+            spans.clear();
+
+            std::vector<cv::Point> stack;
+            stack.push_back(seed);
+            while (!stack.empty()) {
+                cv::Point p = stack.back();
+                stack.pop_back();
+
+                prepareRow(p.y);
+                if (!pending.test(p.x, p.y)) continue;
+
+                int x0 = pending.findLastClear(p.y, 0, p.x) + 1;
+                int x1 = pending.findClear(p.y, p.x, image.cols);
+                pending.clearRange(p.y, x0, x1);
+                spans.push_back(Span(p.y, x0, x1));
+
+                // queue one seed per run of matching pixels directly above and below
+                for (int ny = p.y - 1; ny <= p.y + 1; ny += 2) {
+                    if (ny < 0 || ny >= image.rows) continue;
+                    prepareRow(ny);
+                    int x = pending.findSet(ny, x0, x1);
+                    while (x < x1) {
+                        stack.push_back(cv::Point(x, ny));
+                        x = pending.findSet(ny, pending.findClear(ny, x, x1), x1);
+                    }
+                }
+            }
+            return spans;
+        }
+
+        const std::vector<Span>& getSpans() const { return spans; }
+
+        cv::Vec3b getTarget() const { return target; }
+};
+
+#endif // SCANLINE_FILL_H
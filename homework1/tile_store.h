@@ -0,0 +1,527 @@
+/*******************************************************************************************************************//**
+ * @file tile_store.h
+ * @brief Memory-mapped backing store for images too large to keep decoded in RAM
+ **********************************************************************************************************************/
+
+#ifndef TILE_STORE_H
+#define TILE_STORE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <string>
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+#define TILE_STORE_MAGIC "UTACVTS1"
+#define TILE_STORE_HEADER_BYTES 4096
+#define TILE_BAND_BYTES (4 << 20)
+#define DEFAULT_TILE_CACHE_BYTES ((size_t) 512 << 20)
+#define TILE_POOL_CHUNK_BYTES ((size_t) 64 << 20)
+#define SCRATCH_TILE_BYTES (64 * 64 * 4)
+#define DEFAULT_SCRATCH_CACHE_BYTES ((size_t) 64 << 20)
+// OpenCV's default CV_IO_MAX_IMAGE_PIXELS; imread refuses anything larger unless OPENCV_IO_MAX_IMAGE_PIXELS is raised
+#define DECODE_MAX_PIXELS ((int64_t) 1 << 30)
+
+/*******************************************************************************************************************//**
+ * @class MappedFile
+ *
+ * @brief A file mapped into memory, unmapped and closed on destruction
+ **********************************************************************************************************************/
+class MappedFile {
+    private:
+        int fd;
+        uchar* data;
+        size_t length;
+
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+
+    public:
+        MappedFile() : fd(-1), data(NULL), length(0) {}
+        ~MappedFile() { close(); }
+
+        // map an existing file, or create one of the given length when length is non-zero
+        bool open(const std::string& path, bool writable, size_t create_length = 0) {
+            close();
+            int mode = writable ? O_RDWR : O_RDONLY;
+            if (create_length > 0) mode |= O_CREAT | O_TRUNC;
+            fd = ::open(path.c_str(), mode, 0644);
+            if (fd < 0) return false;
+            if (create_length > 0 && ftruncate(fd, (off_t) create_length) != 0) {
+                close();
+                return false;
+            }
+            struct stat info;
+            if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+                close();
+                return false;
+            }
+            length = (size_t) info.st_size;
+            int protection = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+            void* mapped = mmap(NULL, length, protection, MAP_SHARED, fd, 0);
+            if (mapped == MAP_FAILED) {
+                close();
+                return false;
+            }
+            data = (uchar*) mapped;
+            return true;
+        }
+
+        void close() {
+            if (data) munmap(data, length);
+            if (fd >= 0) ::close(fd);
+            data = NULL;
+            fd = -1;
+            length = 0;
+        }
+
+        uchar* getData() const { return data; }
+        size_t getLength() const { return length; }
+
+        // let the kernel drop pages of [offset, offset + bytes), written-back data is kept in the file
+        void release(size_t offset, size_t bytes, bool written) {
+            size_t page = (size_t) sysconf(_SC_PAGESIZE);
+            size_t first = (offset + page - 1) / page * page;
+            size_t last = (offset + bytes) / page * page;
+            if (last <= first) return;
+            if (written) msync(data + first, last - first, MS_ASYNC);
+            madvise(data + first, last - first, MADV_DONTNEED);
+        }
+};
+
+/*******************************************************************************************************************//**
+ * @class TilePool
+ *
+ * @brief Small equal-sized tiles handed out from a scratch file, so they page out to disk instead of filling RAM
+ *
+ * The file is unlinked as soon as it is created and grows a chunk of TILE_POOL_CHUNK_BYTES at a time; each chunk is
+ * mapped once and never moved, so a tile is an ordinary cv::Mat header that stays valid until it is freed. Freed
+ * slots are reused before the file grows. Tiles beyond the cache budget are handed back to the kernel least recently
+ * touched first, which keeps their contents in the file. When the file cannot grow, tiles come from the heap instead.
+ **********************************************************************************************************************/
+class TilePool {
+    private:
+        int fd;
+        size_t tile_bytes;
+        size_t tiles_per_chunk;
+        std::vector<uchar*> chunks;
+        std::vector<size_t> free_slots;
+        size_t next_slot;
+        std::list<size_t> recent;   // resident slots, most recently touched first
+        std::vector<std::list<size_t>::iterator> recent_position;
+        std::vector<uchar> resident;
+        size_t cache_tiles;
+
+        TilePool(const TilePool&);
+        TilePool& operator=(const TilePool&);
+
+        uchar* slotData(size_t slot) const {
+            return chunks[slot / tiles_per_chunk] + (slot % tiles_per_chunk) * tile_bytes;
+        }
+
+        // slot holding tile, or -1 when it came from the heap
+        long slotOf(const cv::Mat& tile) const {
+            for (size_t c = 0; c < chunks.size(); c++) {
+                if (tile.data >= chunks[c] && tile.data < chunks[c] + TILE_POOL_CHUNK_BYTES) {
+                    return (long) (c * tiles_per_chunk + (tile.data - chunks[c]) / tile_bytes);
+                }
+            }
+            return -1;
+        }
+
+        bool grow() {
+            off_t length = (off_t) ((chunks.size() + 1) * TILE_POOL_CHUNK_BYTES);
+            if (fd < 0 || ftruncate(fd, length) != 0) return false;
+            void* mapped = mmap(NULL, TILE_POOL_CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                                length - (off_t) TILE_POOL_CHUNK_BYTES);
+            if (mapped == MAP_FAILED) return false;
+            chunks.push_back((uchar*) mapped);
+            recent_position.resize(chunks.size() * tiles_per_chunk, recent.end());
+            resident.resize(chunks.size() * tiles_per_chunk, 0);
+            return true;
+        }
+
+        void forget(size_t slot) {
+            if (!resident[slot]) return;
+            recent.erase(recent_position[slot]);
+            resident[slot] = 0;
+        }
+
+    public:
+        TilePool() : fd(-1), tile_bytes(SCRATCH_TILE_BYTES), tiles_per_chunk(1), next_slot(0), cache_tiles(1) {}
+        ~TilePool() { close(); }
+
+        // create the scratch file at path for tiles of up to tile_bytes, which must be a multiple of the page size
+        bool open(const std::string& path, size_t tile_bytes = SCRATCH_TILE_BYTES,
+                  size_t cache_bytes = DEFAULT_SCRATCH_CACHE_BYTES) {
+            close();
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+            if (fd < 0) return false;
+            unlink(path.c_str());
+            this->tile_bytes = tile_bytes;
+            tiles_per_chunk = TILE_POOL_CHUNK_BYTES / tile_bytes;
+            cache_tiles = std::max<size_t>(1, cache_bytes / tile_bytes);
+            return true;
+        }
+
+        void close() {
+            for (size_t c = 0; c < chunks.size(); c++) munmap(chunks[c], TILE_POOL_CHUNK_BYTES);
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+            chunks.clear();
+            free_slots.clear();
+            next_slot = 0;
+            recent.clear();
+            recent_position.clear();
+            resident.clear();
+        }
+
+        bool isOpen() const { return fd >= 0; }
+
+        // a tile of rows x cols pixels of type, uninitialized
+        cv::Mat allocate(int rows, int cols, int type) {
+            size_t bytes = (size_t) rows * cols * CV_ELEM_SIZE(type);
+            if (bytes > tile_bytes || (free_slots.empty() && next_slot == chunks.size() * tiles_per_chunk && !grow())) {
+                return cv::Mat(rows, cols, type);
+            }
+            size_t slot = next_slot;
+            if (!free_slots.empty()) {
+                slot = free_slots.back();
+                free_slots.pop_back();
+            } else {
+                next_slot++;
+            }
+            cv::Mat tile(rows, cols, type, slotData(slot));
+            touch(tile);
+            return tile;
+        }
+
+        // give back a tile from allocate(), its pixels are gone
+        void free(const cv::Mat& tile) {
+            long slot = slotOf(tile);
+            if (slot < 0) return;
+            forget((size_t) slot);
+            madvise(slotData((size_t) slot), tile_bytes, MADV_REMOVE);
+            free_slots.push_back((size_t) slot);
+        }
+
+        // note that tile is about to be read or written, releasing the least recently touched tiles over the budget
+        void touch(const cv::Mat& tile) {
+            long slot = slotOf(tile);
+            if (slot < 0) return;
+            forget((size_t) slot);
+            recent.push_front((size_t) slot);
+            recent_position[slot] = recent.begin();
+            resident[slot] = 1;
+            while (recent.size() > cache_tiles) {
+                size_t cold = recent.back();
+                forget(cold);
+                msync(slotData(cold), tile_bytes, MS_ASYNC);
+                madvise(slotData(cold), tile_bytes, MADV_DONTNEED);
+            }
+        }
+
+        // tiles handed out and not yet freed
+        size_t allocated() const { return next_slot - free_slots.size(); }
+};
+
+// fixed-size header at the start of a backing file, pixels start at TILE_STORE_HEADER_BYTES
+struct TileStoreHeader {
+    char magic[8];
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+    int32_t reserved;
+    int64_t source_size;
+    int64_t source_mtime;
+};
+
+/*******************************************************************************************************************//**
+ * @class TileStore
+ *
+ * @brief Original and working copies of an image kept in mapped files, with an LRU bound on resident bands
+ *
+ * The image is decoded once into "<path>.tiles", which later runs map directly as long as the source file is unchanged.
+ * A binary PPM or PGM is streamed into that file a band at a time, so even the first open stays within the cache
+ * budget. Any other format goes through imread, which holds the whole decoded image in RAM once and is refused by
+ * OpenCV above DECODE_MAX_PIXELS; such images have to be converted to PPM first. Edits go to "<path>.work", which
+ * starts out sparse; a band is copied from the original the first time a tool asks for it. Tiles are full-width bands
+ * of rows rather than square blocks so that both files stay in plain row-major order and can be wrapped by cv::Mat,
+ * which keeps every existing tool working unchanged, while each band is still one contiguous range that can be handed
+ * back to the kernel. Every tool has to call access() for the pixels it is about to read or write; bands beyond the
+ * cache budget are released least recently used first. Tiles the edits produce on top of the image, such as undo data,
+ * go to a TilePool in "<path>.scratch" so they stay out of RAM too.
+ **********************************************************************************************************************/
+class TileStore {
+    private:
+        MappedFile original_file;
+        MappedFile working_file;
+        cv::Mat original;
+        cv::Mat working;
+        size_t row_bytes;
+        int band_rows;
+        int band_count;
+        std::vector<uchar> materialized;
+        std::list<int> recent;      // resident bands, most recently used first
+        std::vector<std::list<int>::iterator> recent_position;
+        std::vector<uchar> resident;
+        size_t cache_bands;
+        TilePool scratch;
+
+        static bool sourceInfo(const std::string& path, int64_t& size, int64_t& mtime) {
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0) return false;
+            size = (int64_t) info.st_size;
+            mtime = (int64_t) info.st_mtime;
+            return true;
+        }
+
+        bool headerMatches(const TileStoreHeader& header, int64_t size, int64_t mtime) const {
+            return std::memcmp(header.magic, TILE_STORE_MAGIC, 8) == 0 && header.type == CV_8UC3 &&
+                   header.rows > 0 && header.cols > 0 && header.source_size == size && header.source_mtime == mtime;
+        }
+
+        // width and height from the header of a PNG or JPEG, false for other formats or a damaged header
+        static bool headerSize(const std::string& source, int64_t& cols, int64_t& rows) {
+            FILE* in = fopen(source.c_str(), "rb");
+            if (!in) return false;
+            unsigned char bytes[24];
+            size_t read = fread(bytes, 1, 24, in);
+            bool found = false;
+            if (read == 24 && std::memcmp(bytes, "\x89PNG", 4) == 0) {
+                cols = ((int64_t) bytes[16] << 24) | (bytes[17] << 16) | (bytes[18] << 8) | bytes[19];
+                rows = ((int64_t) bytes[20] << 24) | (bytes[21] << 16) | (bytes[22] << 8) | bytes[23];
+                found = true;
+            } else if (read >= 2 && bytes[0] == 0xFF && bytes[1] == 0xD8 && fseek(in, 2, SEEK_SET) == 0) {
+                // walk the markers up to the first start of frame, which holds the size
+                unsigned char marker[9];
+                while (!found && fread(marker, 1, 4, in) == 4 && marker[0] == 0xFF) {
+                    int type = marker[1], length = (marker[2] << 8) | marker[3];
+                    bool frame = type >= 0xC0 && type <= 0xCF && type != 0xC4 && type != 0xC8 && type != 0xCC;
+                    if (frame && fread(marker + 4, 1, 5, in) == 5) {
+                        rows = (marker[5] << 8) | marker[6];
+                        cols = (marker[7] << 8) | marker[8];
+                        found = true;
+                    } else if (frame || length < 2 || fseek(in, length - 2, SEEK_CUR) != 0) {
+                        break;
+                    }
+                }
+            }
+            fclose(in);
+            return found;
+        }
+
+        // next number of a PNM header, skipping whitespace and comments
+        static bool readPnmNumber(FILE* in, int64_t& value) {
+            int c = fgetc(in);
+            while (c == '#' || isspace(c)) {
+                if (c == '#') while (c != '\n' && c != EOF) c = fgetc(in);
+                c = fgetc(in);
+            }
+            if (!isdigit(c)) return false;
+            for (value = 0; isdigit(c); c = fgetc(in)) value = value * 10 + (c - '0');
+            // exactly one whitespace character ends the header's last number
+            return isspace(c);
+        }
+
+        // open a binary 8-bit PPM (P6) or PGM (P5), leaving in at the first pixel; false for anything else
+        static FILE* openPnm(const std::string& source, int& channels, int64_t& cols, int64_t& rows) {
+            FILE* in = fopen(source.c_str(), "rb");
+            if (!in) return NULL;
+            char magic[2];
+            int64_t max_value = 0;
+            bool ok = fread(magic, 1, 2, in) == 2 && magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6') &&
+                      readPnmNumber(in, cols) && readPnmNumber(in, rows) && readPnmNumber(in, max_value) &&
+                      max_value > 0 && max_value < 256 && cols > 0 && rows > 0;
+            if (!ok) {
+                fclose(in);
+                return NULL;
+            }
+            channels = (magic[1] == '6') ? 3 : 1;
+            return in;
+        }
+
+        // create a backing file for a cols x rows image, returning its pixels
+        static bool createBackingFile(MappedFile& file, const std::string& path, int rows, int cols, int64_t size,
+                                      int64_t mtime, cv::Mat& pixels) {
+            if (!file.open(path, true, TILE_STORE_HEADER_BYTES + (size_t) rows * cols * 3)) return false;
+            TileStoreHeader header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, TILE_STORE_MAGIC, 8);
+            header.rows = rows;
+            header.cols = cols;
+            header.type = CV_8UC3;
+            header.source_size = size;
+            header.source_mtime = mtime;
+            std::memcpy(file.getData(), &header, sizeof(header));
+            pixels = cv::Mat(rows, cols, CV_8UC3, file.getData() + TILE_STORE_HEADER_BYTES);
+            return true;
+        }
+
+        // stream the rows of a PNM into a backing file a band at a time, releasing each band once it is written
+        static bool streamPnm(FILE* in, int channels, int rows, int cols, const std::string& path, int64_t size,
+                              int64_t mtime) {
+            MappedFile file;
+            cv::Mat pixels;
+            if (!createBackingFile(file, path, rows, cols, size, mtime, pixels)) return false;
+            size_t row_bytes = (size_t) cols * 3;
+            int band_rows = (int) std::max<size_t>(1, TILE_BAND_BYTES / row_bytes);
+            cv::Mat gray;
+            for (int y = 0; y < rows; y += band_rows) {
+                int height = std::min(band_rows, rows - y);
+                cv::Mat band = pixels.rowRange(y, y + height);
+                if (channels == 3) {
+                    if (fread(band.data, row_bytes, height, in) != (size_t) height) return false;
+                    cv::cvtColor(band, band, cv::COLOR_RGB2BGR);
+                } else {
+                    gray.create(height, cols, CV_8UC1);
+                    if (fread(gray.data, cols, height, in) != (size_t) height) return false;
+                    cv::cvtColor(gray, band, cv::COLOR_GRAY2BGR);
+                }
+                file.release(TILE_STORE_HEADER_BYTES + (size_t) y * row_bytes, (size_t) height * row_bytes, true);
+            }
+            msync(file.getData(), file.getLength(), MS_SYNC);
+            return true;
+        }
+
+        // decode the source image once and write it out as a backing file
+        static bool writeBackingFile(const std::string& source, const std::string& path, int64_t size, int64_t mtime) {
+            std::cout << "Decoding " << source << " into " << path << "..." << std::endl;
+            int channels = 0;
+            int64_t cols = 0, rows = 0;
+            FILE* pnm = openPnm(source, channels, cols, rows);
+            if (pnm) {
+                bool ok = cols * rows * 3 <= (int64_t) SIZE_MAX - TILE_STORE_HEADER_BYTES && cols < INT32_MAX &&
+                          rows < INT32_MAX && streamPnm(pnm, channels, (int) rows, (int) cols, path, size, mtime);
+                fclose(pnm);
+                if (!ok) std::cout << "Error while streaming " << source << ", it is cut short or too big" << std::endl;
+                return ok;
+            }
+            if (headerSize(source, cols, rows) && cols * rows > DECODE_MAX_PIXELS) {
+                std::cout << source << " is " << cols << "x" << rows << ", more pixels than OpenCV decodes at once; "
+                          << "convert it to a binary PPM, which is streamed a band at a time" << std::endl;
+                return false;
+            }
+            // the whole image is in RAM once here, which only the PPM path above avoids
+            cv::Mat decoded = cv::imread(source, cv::IMREAD_COLOR);
+            if (decoded.empty()) {
+                std::cout << "Could not decode " << source << "; images over " << DECODE_MAX_PIXELS << " pixels have "
+                          << "to be converted to a binary PPM first" << std::endl;
+                return false;
+            }
+            MappedFile file;
+            cv::Mat pixels;
+            if (!createBackingFile(file, path, decoded.rows, decoded.cols, size, mtime, pixels)) return false;
+            decoded.copyTo(pixels);
+            msync(file.getData(), file.getLength(), MS_SYNC);
+            return true;
+        }
+
+        void touchBand(int band) {
+            if (resident[band]) {
+                recent.erase(recent_position[band]);
+            } else {
+                resident[band] = 1;
+            }
+            recent.push_front(band);
+            recent_position[band] = recent.begin();
+
+            while (recent.size() > cache_bands) {
+                int cold = recent.back();
+                recent.pop_back();
+                resident[cold] = 0;
+                size_t offset = TILE_STORE_HEADER_BYTES + (size_t) cold * band_rows * row_bytes;
+                size_t bytes = (size_t) bandHeight(cold) * row_bytes;
+                working_file.release(offset, bytes, true);
+                original_file.release(offset, bytes, false);
+            }
+        }
+
+        int bandHeight(int band) const {
+            return std::min(band_rows, original.rows - band * band_rows);
+        }
+
+    public:
+        TileStore() : row_bytes(0), band_rows(1), band_count(0), cache_bands(1) {}
+
+        // map path's backing files, decoding it first if needed; cache_bytes bounds the resident bands
+        bool open(const std::string& path, size_t cache_bytes = DEFAULT_TILE_CACHE_BYTES) {
+            int64_t size = 0, mtime = 0;
+            if (!sourceInfo(path, size, mtime)) return false;
+
+            std::string backing_path = path + ".tiles";
+            bool valid = false;
+            if (original_file.open(backing_path, false) && original_file.getLength() >= TILE_STORE_HEADER_BYTES) {
+                TileStoreHeader header;
+                std::memcpy(&header, original_file.getData(), sizeof(header));
+                valid = headerMatches(header, size, mtime);
+            }
+            if (!valid) {
+                original_file.close();
+                if (!writeBackingFile(path, backing_path, size, mtime)) return false;
+                if (!original_file.open(backing_path, false)) return false;
+            }
+
+            TileStoreHeader header;
+            std::memcpy(&header, original_file.getData(), sizeof(header));
+            size_t pixel_bytes = (size_t) header.rows * header.cols * 3;
+            if (original_file.getLength() < TILE_STORE_HEADER_BYTES + pixel_bytes) return false;
+            if (!working_file.open(path + ".work", true, TILE_STORE_HEADER_BYTES + pixel_bytes)) return false;
+
+            original = cv::Mat(header.rows, header.cols, CV_8UC3, original_file.getData() + TILE_STORE_HEADER_BYTES);
+            working = cv::Mat(header.rows, header.cols, CV_8UC3, working_file.getData() + TILE_STORE_HEADER_BYTES);
+            row_bytes = (size_t) header.cols * 3;
+            band_rows = (int) std::max<size_t>(1, TILE_BAND_BYTES / row_bytes);
+            band_count = (header.rows + band_rows - 1) / band_rows;
+            cache_bands = std::max<size_t>(2, cache_bytes / ((size_t) band_rows * row_bytes));
+            materialized.assign(band_count, 0);
+            resident.assign(band_count, 0);
+            recent_position.assign(band_count, recent.end());
+            recent.clear();
+            // without it, undo data stays on the heap
+            std::string scratch_path = path + ".scratch";
+            if (!scratch.open(scratch_path)) std::cout << "Error while creating " << scratch_path << std::endl;
+            std::cout << "Mapped " << header.cols << "x" << header.rows << " image as " << band_count
+                      << " bands, caching at most " << cache_bands << std::endl;
+            return true;
+        }
+
+        cv::Mat getOriginal() const { return original; }
+        // tiles that belong to the edits rather than the image, undo data and the like, kept out of RAM the same way
+        TilePool& getScratch() { return scratch; }
+        cv::Mat getWorking() const { return working; }
+
+        // make rect of view, which must be the working image or a region of it, safe to read and write
+        void access(const cv::Mat& view, cv::Rect rect) {
+            rect &= cv::Rect(0, 0, view.cols, view.rows);
+            if (rect.area() <= 0) return;
+            cv::Size whole;
+            cv::Point offset;
+            view.locateROI(whole, offset);
+            int first = (offset.y + rect.y) / band_rows;
+            int last = (offset.y + rect.y + rect.height - 1) / band_rows;
+            for (int band = first; band <= last; band++) {
+                if (!materialized[band]) {
+                    cv::Range rows(band * band_rows, band * band_rows + bandHeight(band));
+                    original.rowRange(rows.start, rows.end).copyTo(working.rowRange(rows.start, rows.end));
+                    materialized[band] = 1;
+                }
+                touchBand(band);
+            }
+        }
+
+        // throw away every edit, bands are copied from the original again when next accessed
+        void discardEdits() {
+            materialized.assign(band_count, 0);
+        }
+};
+
+#endif // TILE_STORE_H
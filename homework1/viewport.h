@@ -0,0 +1,352 @@
+/*******************************************************************************************************************//**
+ * @file viewport.h
+ * @brief Zoomable, pannable view of the edited image rendered from a lazily built image pyramid
+ **********************************************************************************************************************/
+
+#ifndef VIEWPORT_H
+#define VIEWPORT_H
+
+#include <list>
+#include <vector>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+#include "dirty_region.h"
+#include "tile_store.h"
+
+// largest frame, both multiples of 2^VIEWPORT_MAX_ZOOM so a zoomed in frame always shows whole image pixels
+#define VIEWPORT_MAX_COLS 1280
+#define VIEWPORT_MAX_ROWS 800
+#define VIEWPORT_MAX_ZOOM 5         // 32 screen pixels per image pixel
+#define PYRAMID_TILE_SIZE 256
+#define PYRAMID_CACHE_TILES 256     // 48 MB of BGR tiles, several frames' worth
+#define PYRAMID_STRIP_ROWS 256      // image rows reduced at a time
+
+/*******************************************************************************************************************//**
+ * @class ImagePyramid
+ *
+ * @brief Successive 2x box-filtered reductions of an image, computed one tile at a time when first needed
+ *
+ * Level k is 2^k times smaller than the image; level 0 is the image itself and is never copied. No coarser level is
+ * ever allocated whole: a tile of level k is reduced straight from the image, PYRAMID_STRIP_ROWS image rows at a time,
+ * the first time a frame reads it, so showing a coarse level never builds the levels in between and a tiled image is
+ * only paged in band by band. At most PYRAMID_CACHE_TILES built tiles are kept, least recently read dropped first.
+ * An edit does not drop the tiles above it; it marks the part of each built tile it covers as stale, and only that
+ * part is reduced again when the tile is next read, so keeping a zoomed out view current costs in proportion to the
+ * edit.
+ **********************************************************************************************************************/
+class ImagePyramid {
+    private:
+        typedef std::pair<int, size_t> TileKey;    // level and tile index
+
+        struct Tile {
+            cv::Mat pixels;                         // empty until built, and again once dropped from the cache
+            DirtyRegion stale;                      // level pixels to reduce again before the tile is read
+            std::list<TileKey>::iterator recent_position;
+        };
+
+        cv::Mat source;
+        std::vector<cv::Size> sizes;                // sizes[0] is the image
+        std::vector<int> tiles_x;
+        std::vector<std::vector<Tile> > tiles;      // tiles[0] is left empty
+        std::list<TileKey> recent;                  // built tiles, most recently read first
+
+        // rect of level k, in level k pixels, covering region of the image
+        static cv::Rect reduce(cv::Rect region, int k) {
+            int x0 = region.x >> k, y0 = region.y >> k;
+            int x1 = ((region.x + region.width - 1) >> k) + 1, y1 = ((region.y + region.height - 1) >> k) + 1;
+            return cv::Rect(x0, y0, x1 - x0, y1 - y0);
+        }
+
+        // average 2^k x 2^k blocks of pixels into out, the last row and column of blocks may be cut short by the
+        // edge of the image and are averaged over the pixels they have
+        static void reduceBlocks(const cv::Mat& pixels, cv::Mat out, int k) {
+            int cols[3] = {0, std::min(out.cols, pixels.cols >> k), out.cols};
+            int rows[3] = {0, std::min(out.rows, pixels.rows >> k), out.rows};
+            for (int r = 0; r < 2; r++) {
+                for (int c = 0; c < 2; c++) {
+                    if (rows[r + 1] <= rows[r] || cols[c + 1] <= cols[c]) continue;
+                    cv::Rect from(cols[c] << k, rows[r] << k, 0, 0);
+                    from.width = std::min(pixels.cols, cols[c + 1] << k) - from.x;
+                    from.height = std::min(pixels.rows, rows[r + 1] << k) - from.y;
+                    cv::Mat to = out(cv::Range(rows[r], rows[r + 1]), cv::Range(cols[c], cols[c + 1]));
+                    cv::resize(pixels(from), to, to.size(), 0, 0, cv::INTER_AREA);
+                }
+            }
+        }
+
+        // reduce rect of level k from the image into out, a strip at a time so only a strip is paged in at once
+        void reduceFromImage(int k, cv::Rect rect, cv::Mat out, TileStore* store) {
+            cv::Rect image(0, 0, source.cols, source.rows);
+            int strip = std::max(1, PYRAMID_STRIP_ROWS >> k);
+            for (int y = 0; y < rect.height; y += strip) {
+                int rows = std::min(strip, rect.height - y);
+                cv::Rect from = cv::Rect(rect.x << k, (rect.y + y) << k, rect.width << k, rows << k) & image;
+                if (store) store->access(source, from);
+                reduceBlocks(source(from), out.rowRange(y, y + rows), k);
+            }
+        }
+
+        cv::Rect tileRect(int k, size_t index) const {
+            int tx = (int) (index % tiles_x[k]), ty = (int) (index / tiles_x[k]);
+            cv::Rect tile(tx * PYRAMID_TILE_SIZE, ty * PYRAMID_TILE_SIZE, PYRAMID_TILE_SIZE, PYRAMID_TILE_SIZE);
+            return tile & cv::Rect(0, 0, sizes[k].width, sizes[k].height);
+        }
+
+        void drop(const TileKey& key) {
+            Tile& tile = tiles[key.first][key.second];
+            recent.erase(tile.recent_position);
+            tile.pixels.release();
+            tile.stale.clear();
+        }
+
+        // up-to-date pixels of a tile of level k, building it or reducing its stale parts again as needed
+        const cv::Mat& build(int k, size_t index, TileStore* store) {
+            Tile& tile = tiles[k][index];
+            cv::Rect rect = tileRect(k, index);
+            if (tile.pixels.empty()) {
+                tile.pixels.create(rect.size(), source.type());
+                reduceFromImage(k, rect, tile.pixels, store);
+                tile.stale.clear();
+                recent.push_front(TileKey(k, index));
+                tile.recent_position = recent.begin();
+                while (recent.size() > PYRAMID_CACHE_TILES) drop(recent.back());
+                return tile.pixels;
+            }
+            const std::vector<cv::Rect>& stale = tile.stale.getRects();
+            for (size_t i = 0; i < stale.size(); i++) {
+                cv::Rect local(stale[i].tl() - rect.tl(), stale[i].size());
+                reduceFromImage(k, stale[i], tile.pixels(local), store);
+            }
+            tile.stale.clear();
+            recent.splice(recent.begin(), recent, tile.recent_position);
+            return tile.pixels;
+        }
+
+    public:
+        // forget the levels unless image is the image they were built from, returning true when they were dropped
+        bool attach(const cv::Mat& image) {
+            if (image.data == source.data && image.rows == source.rows && image.cols == source.cols &&
+                image.step == source.step) {
+                return false;
+            }
+            source = image;
+            sizes.assign(1, image.size());
+            tiles_x.assign(1, 0);
+            tiles.assign(1, std::vector<Tile>());
+            recent.clear();
+            int rows = image.rows, cols = image.cols;
+            // stop at the first level that fits in the viewport, nothing coarser is ever shown
+            while (cols > VIEWPORT_MAX_COLS || rows > VIEWPORT_MAX_ROWS) {
+                rows = (rows + 1) / 2;
+                cols = (cols + 1) / 2;
+                sizes.push_back(cv::Size(cols, rows));
+                tiles_x.push_back((cols + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE);
+                int tiles_y = (rows + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE;
+                tiles.push_back(std::vector<Tile>((size_t) tiles_x.back() * tiles_y));
+            }
+            return true;
+        }
+
+        int levelCount() const { return (int) sizes.size(); }
+
+        cv::Size levelSize(int k) const { return sizes[k]; }
+
+        // mark the parts of every built tile that depend on region of the image as stale
+        void invalidate(cv::Rect region) {
+            region &= cv::Rect(0, 0, source.cols, source.rows);
+            if (region.area() <= 0) return;
+            for (int k = 1; k < (int) sizes.size(); k++) {
+                cv::Rect rect = reduce(region, k);
+                int tx0 = rect.x / PYRAMID_TILE_SIZE, tx1 = (rect.x + rect.width - 1) / PYRAMID_TILE_SIZE;
+                int ty0 = rect.y / PYRAMID_TILE_SIZE, ty1 = (rect.y + rect.height - 1) / PYRAMID_TILE_SIZE;
+                for (int ty = ty0; ty <= ty1; ty++) {
+                    for (int tx = tx0; tx <= tx1; tx++) {
+                        size_t index = (size_t) ty * tiles_x[k] + tx;
+                        Tile& tile = tiles[k][index];
+                        if (!tile.pixels.empty()) tile.stale.add(rect & tileRect(k, index));
+                    }
+                }
+            }
+        }
+
+        // copy the up-to-date pixels of rect in level k, which must lie inside the level, into out of the same size
+        void copyTo(int k, cv::Rect rect, cv::Mat out, TileStore* store) {
+            if (k == 0) {
+                if (store) store->access(source, rect);
+                source(rect).copyTo(out);
+                return;
+            }
+            int tx0 = rect.x / PYRAMID_TILE_SIZE, tx1 = (rect.x + rect.width - 1) / PYRAMID_TILE_SIZE;
+            int ty0 = rect.y / PYRAMID_TILE_SIZE, ty1 = (rect.y + rect.height - 1) / PYRAMID_TILE_SIZE;
+            for (int ty = ty0; ty <= ty1; ty++) {
+                for (int tx = tx0; tx <= tx1; tx++) {
+                    size_t index = (size_t) ty * tiles_x[k] + tx;
+                    cv::Rect tile = tileRect(k, index);
+                    cv::Rect part = tile & rect;
+                    const cv::Mat& pixels = build(k, index, store);
+                    pixels(cv::Rect(part.tl() - tile.tl(), part.size())).copyTo(out(cv::Rect(part.tl() - rect.tl(),
+                                                                                             part.size())));
+                }
+            }
+        }
+
+        // pixels of rect in the image itself, paged in first for a tiled image
+        cv::Mat image(cv::Rect rect, TileStore* store) {
+            rect &= cv::Rect(0, 0, source.cols, source.rows);
+            if (store) store->access(source, rect);
+            return source(rect);
+        }
+};
+
+/*******************************************************************************************************************//**
+ * @class Viewport
+ *
+ * @brief Window-sized view of the image at a power-of-two zoom
+ *
+ * Zoomed out by 2^k the view is a plain copy out of pyramid level k, zoomed in it is a nearest-neighbour enlargement
+ * of the image, so every window pixel maps to exactly one image pixel or block and tools get exact coordinates back.
+ * Only the parts of the frame that changed are redrawn, from the image rectangles reported dirty by the tools, so the
+ * cost of a frame depends on the window size rather than the image size.
+ **********************************************************************************************************************/
+class Viewport {
+    private:
+        ImagePyramid pyramid;
+        cv::Mat frame;
+        int zoom;               // log2 of screen pixels per image pixel
+        cv::Point origin;       // image pixel at the top left corner of the frame
+        bool moved;             // the whole frame has to be redrawn
+
+        cv::Size frameSize() const {
+            cv::Size image = pyramid.levelSize(0);
+            cv::Size scaled = (zoom <= 0) ? pyramid.levelSize(-zoom)
+                                          : cv::Size(image.width << zoom, image.height << zoom);
+            return cv::Size(std::min(scaled.width, VIEWPORT_MAX_COLS), std::min(scaled.height, VIEWPORT_MAX_ROWS));
+        }
+
+        // keep the frame inside the image
+        void clampOrigin() {
+            cv::Size image = pyramid.levelSize(0);
+            cv::Size size = frameSize();
+            int visible_x = (zoom <= 0) ? (size.width << -zoom) : (size.width >> zoom);
+            int visible_y = (zoom <= 0) ? (size.height << -zoom) : (size.height >> zoom);
+            origin.x = std::max(0, std::min(origin.x, image.width - visible_x));
+            origin.y = std::max(0, std::min(origin.y, image.height - visible_y));
+            if (zoom < 0) {
+                origin.x = (origin.x >> -zoom) << -zoom;
+                origin.y = (origin.y >> -zoom) << -zoom;
+            }
+        }
+
+        // window pixel to image pixel without clipping to the image
+        cv::Point unclippedImagePoint(int x, int y) const {
+            if (zoom <= 0) return cv::Point(origin.x + (x << -zoom), origin.y + (y << -zoom));
+            return cv::Point(origin.x + (x >> zoom), origin.y + (y >> zoom));
+        }
+
+        // frame pixels showing region of the image
+        cv::Rect toFrame(cv::Rect region) const {
+            cv::Rect rect;
+            if (zoom <= 0) {
+                int k = -zoom;
+                int x0 = (region.x >> k) - (origin.x >> k), y0 = (region.y >> k) - (origin.y >> k);
+                int x1 = ((region.x + region.width - 1) >> k) + 1 - (origin.x >> k);
+                int y1 = ((region.y + region.height - 1) >> k) + 1 - (origin.y >> k);
+                rect = cv::Rect(x0, y0, x1 - x0, y1 - y0);
+            } else {
+                rect = cv::Rect((region.x - origin.x) << zoom, (region.y - origin.y) << zoom,
+                                region.width << zoom, region.height << zoom);
+            }
+            return rect & cv::Rect(0, 0, frame.cols, frame.rows);
+        }
+
+        void draw(cv::Rect rect, TileStore* store) {
+            if (rect.area() <= 0) return;
+            if (zoom <= 0) {
+                int k = -zoom;
+                cv::Rect source(rect.x + (origin.x >> k), rect.y + (origin.y >> k), rect.width, rect.height);
+                pyramid.copyTo(k, source, frame(rect), store);
+                return;
+            }
+            // enlarge the whole image pixels under rect, then cut out the part that lands inside it
+            int x0 = rect.x >> zoom, y0 = rect.y >> zoom;
+            int x1 = ((rect.x + rect.width - 1) >> zoom) + 1, y1 = ((rect.y + rect.height - 1) >> zoom) + 1;
+            cv::Mat pixels = pyramid.image(cv::Rect(origin.x + x0, origin.y + y0, x1 - x0, y1 - y0), store);
+            cv::Mat enlarged;
+            cv::resize(pixels, enlarged, cv::Size(pixels.cols << zoom, pixels.rows << zoom), 0, 0, cv::INTER_NEAREST);
+            enlarged(cv::Rect(rect.x - (x0 << zoom), rect.y - (y0 << zoom), rect.width, rect.height)).copyTo(frame(rect));
+        }
+
+    public:
+        Viewport() : zoom(0), moved(true) {}
+
+        // the frame reaches VIEWPORT_MAX_ZOOM screen pixels per image pixel and shrinks to the coarsest level
+        void zoomBy(int steps, cv::Point anchor) {
+            int next = std::max(1 - pyramid.levelCount(), std::min(VIEWPORT_MAX_ZOOM, zoom + steps));
+            if (next == zoom) return;
+            cv::Point fixed = unclippedImagePoint(anchor.x, anchor.y);
+            zoom = next;
+            origin = (zoom <= 0) ? cv::Point(fixed.x - (anchor.x << -zoom), fixed.y - (anchor.y << -zoom))
+                                 : cv::Point(fixed.x - (anchor.x >> zoom), fixed.y - (anchor.y >> zoom));
+            clampOrigin();
+            moved = true;
+        }
+
+        // shows the whole image at the largest zoom where it fits
+        void fit() {
+            zoom = 1 - pyramid.levelCount();
+            origin = cv::Point(0, 0);
+            moved = true;
+        }
+
+        // scroll by a distance given in window pixels
+        void pan(int dx, int dy) {
+            origin += (zoom <= 0) ? cv::Point(dx << -zoom, dy << -zoom) : cv::Point(dx >> zoom, dy >> zoom);
+            clampOrigin();
+            moved = true;
+        }
+
+        cv::Size getFrameSize() const { return cv::Size(frame.cols, frame.rows); }
+
+        // image pixel under a window pixel, the centre of the block when zoomed out
+        cv::Point toImage(int x, int y) const {
+            cv::Point p = unclippedImagePoint(x, y);
+            if (zoom < 0) p += cv::Point((1 << -zoom) / 2, (1 << -zoom) / 2);
+            cv::Size image = pyramid.levelSize(0);
+            return cv::Point(std::min(p.x, image.width - 1), std::min(p.y, image.height - 1));
+        }
+
+        // bring the frame up to date with image, adding the frame pixels that were redrawn to frame_dirty
+        const cv::Mat& render(const cv::Mat& image, TileStore* store, const DirtyRegion& changed,
+                              DirtyRegion& frame_dirty) {
+            if (pyramid.attach(image)) {
+                // a different image, usually after a crop, is shown whole when it fits and otherwise keeps the zoom
+                if (zoom < 1 - pyramid.levelCount()) zoom = 1 - pyramid.levelCount();
+                if (frame.empty() && zoom == 0) fit();
+                clampOrigin();
+                moved = true;
+            }
+
+            const std::vector<cv::Rect>& rects = changed.getRects();
+            for (size_t i = 0; i < rects.size(); i++) pyramid.invalidate(rects[i]);
+
+            cv::Size size = frameSize();
+            if (frame.rows != size.height || frame.cols != size.width) {
+                frame.create(size, image.type());
+                moved = true;
+            }
+
+            DirtyRegion redraw;
+            if (moved) {
+                redraw.add(cv::Rect(0, 0, frame.cols, frame.rows));
+            } else {
+                for (size_t i = 0; i < rects.size(); i++) redraw.add(toFrame(rects[i]));
+            }
+            const std::vector<cv::Rect>& frame_rects = redraw.getRects();
+            for (size_t i = 0; i < frame_rects.size(); i++) draw(frame_rects[i], store);
+            frame_dirty.add(redraw);
+            moved = false;
+            return frame;
+        }
+};
+
+#endif // VIEWPORT_H
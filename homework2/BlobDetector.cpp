@@ -0,0 +1,76 @@
+/*******************************************************************************************************************//**
+ * @file BlobDetector.cpp
+ * @brief Implementation of the BlobDetector class
+ *
+ * This class finds coins as round connected components of a thresholded image
+ **********************************************************************************************************************/
+
+#include "BlobDetector.h"
+#include "StageProfiler.h"
+
+#include <vector>
+#include <algorithm>
+
+/*******************************************************************************************************************//**
+ * @brief Class constructor
+ * @param[in] counter counter with its model loaded, whose model gives the sizes of the components kept
+ **********************************************************************************************************************/
+BlobDetector::BlobDetector(const CoinCounter &counter) : CoinDetector(counter)
+{
+}
+
+/*******************************************************************************************************************//**
+ * @brief Name of the engine
+ * @return "blobs"
+ **********************************************************************************************************************/
+const char* BlobDetector::name() const
+{
+    return "blobs";
+}
+
+/*******************************************************************************************************************//**
+ * @brief Find and classify the coins in an image
+ * @param[in] imageIn BGR image of the coins
+ * @return the coins found
+ **********************************************************************************************************************/
+CoinResult BlobDetector::count(const cv::Mat &imageIn) const
+{
+    cv::Mat imageGray;
+    {
+        StageTimer timer(profile_gray);
+        cv::cvtColor(imageIn, imageGray, cv::COLOR_BGR2GRAY);
+    }
+
+    std::vector<cv::RotatedRect> coinEllipses;
+    {
+        StageTimer timer(profile_blobs);
+        cv::Mat imageBlurred;
+        cv::GaussianBlur(imageGray, imageBlurred, cv::Size(5, 5), 0);
+        cv::Mat imageMask;
+        cv::threshold(imageBlurred, imageMask, 0, 255, cv::THRESH_BINARY_INV | cv::THRESH_OTSU);
+        cv::morphologyEx(imageMask, imageMask, cv::MORPH_CLOSE,
+                         cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(7, 7)));
+        cv::morphologyEx(imageMask, imageMask, cv::MORPH_OPEN,
+                         cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(5, 5)));
+
+        cv::Mat labels, stats, centroids;
+        int components = cv::connectedComponentsWithStats(imageMask, labels, stats, centroids, 8, CV_32S);
+        double minDiameter = minCoinDiameter() * 0.7;
+        double maxDiameter = maxCoinDiameter() * 1.3;
+        for(int i = 1; i < components; i++)
+        {
+            int width = stats.at<int>(i, cv::CC_STAT_WIDTH);
+            int height = stats.at<int>(i, cv::CC_STAT_HEIGHT);
+            double diameter = (width + height) / 2.0;
+            if(diameter < minDiameter || diameter > maxDiameter) continue;
+            if(std::max(width, height) > BLOB_MAX_ASPECT * std::min(width, height)) continue;
+            if(stats.at<int>(i, cv::CC_STAT_AREA) < BLOB_MIN_FILL * width * height) continue;
+
+            // pixel centers run from left to left + width - 1
+            cv::Point2f center(stats.at<int>(i, cv::CC_STAT_LEFT) + (width - 1) / 2.0f,
+                               stats.at<int>(i, cv::CC_STAT_TOP) + (height - 1) / 2.0f);
+            coinEllipses.push_back(cv::RotatedRect(center, cv::Size2f(width, height), 0));
+        }
+    }
+    return classify(coinEllipses);
+}
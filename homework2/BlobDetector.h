@@ -0,0 +1,42 @@
+/*******************************************************************************************************************//**
+ * @file BlobDetector.h
+ * @brief Header file for the BlobDetector class
+ *
+ * This class finds coins as round connected components of a thresholded image
+ **********************************************************************************************************************/
+
+#ifndef BLOBDETECTOR_H
+#define BLOBDETECTOR_H
+
+#include "opencv2/opencv.hpp"
+#include "CoinDetector.h"
+
+// least share of its box a component has to fill to be a coin; a disc fills pi / 4 of it
+#define BLOB_MIN_FILL 0.6
+
+// most a component may be longer one way than the other to be a coin
+#define BLOB_MAX_ASPECT 1.3
+
+/*******************************************************************************************************************//**
+ * @class BlobDetector
+ *
+ * @brief Coins are the round components darker than the paper they lie on
+ *
+ * The gray image is split into coins and background with Otsu's threshold, closed to fill glints on the coins and
+ * opened to remove print showing through the paper. Every component of about a coin's size, about as wide as it is
+ * high and filling most of its box is a coin, and its box gives its ellipse. A single pass over the pixels with no
+ * edges or contours, but coins have to stand out from a plain background and must not touch each other.
+ **********************************************************************************************************************/
+class BlobDetector : public CoinDetector
+{
+public:
+
+    // constructors
+    BlobDetector(const CoinCounter &counter);
+
+    // processing
+    const char* name() const;
+    CoinResult count(const cv::Mat &imageIn) const;
+};
+
+#endif // BLOBDETECTOR_H
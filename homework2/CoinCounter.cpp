@@ -0,0 +1,513 @@
+/*******************************************************************************************************************//**
+ * @file CoinCounter.cpp
+ * @brief Implementation of the CoinCounter class
+ *
+ * This class runs the coin counting pipeline of lab2 on one image at a time
+ **********************************************************************************************************************/
+
+#include "CoinCounter.h"
+#include "ContainmentGrid.h"
+#include "CoinPipeline.h"
+#include "StageProfiler.h"
+#include "TiledContourFinder.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+// the full size image is searched around a coarse ellipse out to this fraction of its size, and at least this many
+// pixels, for the error of fitting at reduced size
+#define PYRAMID_REFINE_MARGIN 0.15
+#define PYRAMID_REFINE_MIN_MARGIN 8
+// the image is never halved below this many pixels on its shorter side, however many pyramid levels are asked for
+#define PYRAMID_MIN_SIDE 64
+
+/*******************************************************************************************************************//**
+ * @brief Class constructor
+ *
+ * Creates a counter with no model, which has to be loaded before count() is called
+ **********************************************************************************************************************/
+CoinCounter::CoinCounter() : verbose(false), pyramidLevels(0), tileSize(0)
+{
+}
+
+/*******************************************************************************************************************//**
+ * @brief Read the model file
+ *
+ * The model file holds one expected diameter in pixels per line, in CoinType order; lines past the last CoinType are
+ * ignored
+ *
+ * @param[in] modelPath path of the model file
+ * @return true if the file held a diameter for every CoinType
+ **********************************************************************************************************************/
+bool CoinCounter::loadModel(const std::string &modelPath)
+{
+    std::ifstream in(modelPath.c_str());
+    if(!in) return false;
+
+    model.clear();
+    std::string str;
+    while(std::getline(in, str) && model.size() < NUM_COIN_TYPES) {
+        if(str.empty()) continue;
+        model.push_back(atof(str.c_str()));
+    }
+    return model.size() == NUM_COIN_TYPES;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Report every step of count() on the console
+ * @param[in] verbose true to print every ellipse and classification, only sensible for a single image
+ **********************************************************************************************************************/
+void CoinCounter::setVerbose(bool verbose)
+{
+    this->verbose = verbose;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Look for the coins on a reduced image first
+ *
+ * Each level halves the image, so Canny and findContours see a quarter of the pixels per level. Every coin found there
+ * is fitted again from the full size image, so diameters stay as accurate as without the pyramid. Fewer levels are
+ * used on an image too small to halve that often, see PYRAMID_MIN_SIDE.
+ *
+ * @param[in] levels number of halvings, 0 to work at full size only
+ **********************************************************************************************************************/
+void CoinCounter::setPyramidLevels(int levels)
+{
+    pyramidLevels = std::max(0, levels);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Number of halvings of the image the coins are first looked for at
+ * @return the number of levels, 0 when working at full size only
+ **********************************************************************************************************************/
+int CoinCounter::getPyramidLevels() const
+{
+    return pyramidLevels;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Find edges and contours in tiles, several at once
+ *
+ * Each tile reaches TILE_OVERLAP pixels into its neighbours so the contours of coins across a seam are found whole
+ * once, and the coins come out the same as from the whole image. Has no effect with pyramid levels set.
+ *
+ * @param[in] size side of the tiles in pixels, raised to TILE_MIN_SIZE, or 0 to work on the whole image at once
+ **********************************************************************************************************************/
+void CoinCounter::setTileSize(int size)
+{
+    tileSize = (size > 0) ? std::max(size, TILE_MIN_SIZE) : 0;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Side of the tiles edges and contours are found in
+ * @return the side in pixels, 0 when working on the whole image at once
+ **********************************************************************************************************************/
+int CoinCounter::getTileSize() const
+{
+    return tileSize;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Expected diameter of a coin
+ * @param[in] coinType a CoinType
+ * @return the diameter in pixels from the model
+ **********************************************************************************************************************/
+double CoinCounter::getModelDiameter(int coinType) const
+{
+    return model[coinType];
+}
+
+/*******************************************************************************************************************//**
+ * @brief Find and classify the coins in an image
+ *
+ * Only the steps the coins depend on run, nothing is drawn
+ *
+ * @param[in] imageIn BGR image of the coins
+ * @return the coins found
+ **********************************************************************************************************************/
+CoinResult CoinCounter::count(const cv::Mat &imageIn) const
+{
+    CoinPipeline pipeline(*this, imageIn);
+    return pipeline.getCoins();
+}
+
+/*******************************************************************************************************************//**
+ * @brief Find the edges of a gray image with Canny
+ * @param[in] imageGray gray image of the coins
+ * @param[out] imageEdges binary edge image
+ **********************************************************************************************************************/
+void CoinCounter::findEdges(const cv::Mat &imageGray, cv::Mat &imageEdges) const
+{
+    const double cannyThreshold1 = 100;
+    const double cannyThreshold2 = 200;
+    const int cannyAperture = 3;
+    StageTimer timer(profile_edges);
+    cv::Canny(imageGray, imageEdges, cannyThreshold1, cannyThreshold2, cannyAperture);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Trace the contours of an edge image, with the tree of which contour lies inside which
+ * @param[in,out] imageEdges binary edge image, which findContours may overwrite
+ * @param[out] contours every contour
+ * @param[out] hierarchy next, previous, first child and parent of every contour, -1 where there is none
+ **********************************************************************************************************************/
+void CoinCounter::findContours(cv::Mat &imageEdges, std::vector<std::vector<cv::Point> > &contours,
+                               std::vector<cv::Vec4i> &hierarchy) const
+{
+    StageTimer timer(profile_contours);
+    cv::findContours(imageEdges, contours, hierarchy, cv::RETR_TREE, cv::CHAIN_APPROX_SIMPLE, cv::Point(0, 0));
+    StageProfiler::count(counter_contours, contours.size());
+}
+
+/*******************************************************************************************************************//**
+ * @brief Find the edges and trace the contours of a gray image in tiles, several at once
+ * @param[in] imageGray gray image of the coins
+ * @param[out] contours every contour that can be fitted with a coin, grouped by tile
+ * @param[out] hierarchy next, previous, first child and parent of every contour, -1 where there is none
+ **********************************************************************************************************************/
+void CoinCounter::findContoursTiled(const cv::Mat &imageGray, std::vector<std::vector<cv::Point> > &contours,
+                                    std::vector<cv::Vec4i> &hierarchy) const
+{
+    StageTimer timer(profile_tiles);
+    TiledContourFinder finder(*this, tileSize);
+    finder.find(imageGray, contours, hierarchy);
+    StageProfiler::count(counter_contours, contours.size());
+}
+
+/*******************************************************************************************************************//**
+ * @brief Fit an ellipse to every contour of enough points that is not inside a contour already fitted
+ *
+ * The contour tree is walked once from the outermost contours down. As soon as a contour gives an ellipse that could
+ * be a coin, nothing inside it is fitted: the inner side of the rim, the face, the lettering and reflections would
+ * only give smaller ellipses inside it, which rejectContained drops anyway. Contours of too few points, or whose
+ * ellipse is too large for a coin, do not hide what is inside them.
+ *
+ * @param[in] contours every contour of an edge image, which may be reduced
+ * @param[in] hierarchy tree of the contours, as findContours gives it with RETR_TREE
+ * @param[in] scale full size pixels per pixel of the edge image; the 100 point limit is divided by it
+ * @param[out] ellipses the ellipses that could be coins, in full size coordinates
+ * @return number of contours of enough points that were not fitted for lying inside a coin
+ **********************************************************************************************************************/
+int CoinCounter::fitOutermost(const std::vector<std::vector<cv::Point> > &contours,
+                              const std::vector<cv::Vec4i> &hierarchy, double scale,
+                              std::vector<cv::RotatedRect> &ellipses) const
+{
+    StageTimer timer(profile_fit);
+    ellipses.clear();
+    int skipped = 0;
+    int fittable = 0;
+    int fitted = 0;
+
+    // contours still to visit, each with whether a contour around it was fitted
+    std::vector<std::pair<int, bool> > pending;
+    for(int i = (int) contours.size() - 1; i >= 0; i--)
+    {
+        if(hierarchy[i][3] < 0) pending.push_back(std::make_pair(i, false));
+    }
+    while(!pending.empty())
+    {
+        int i = pending.back().first;
+        bool insideCoin = pending.back().second;
+        pending.pop_back();
+
+        bool enoughPoints = contours[i].size() >= 5 && contours[i].size() > 100 / scale;
+        if(enoughPoints) fittable++;
+        if(insideCoin)
+        {
+            if(enoughPoints) skipped++;
+        }
+        else if(enoughPoints)
+        {
+            cv::RotatedRect fittedEllipse = cv::fitEllipse(contours[i]);
+            fitted++;
+            if(scale != 1)
+            {
+                // pixel x of the reduced image covers full size pixels x * scale to (x + 1) * scale - 1
+                fittedEllipse.center.x = (fittedEllipse.center.x + 0.5) * scale - 0.5;
+                fittedEllipse.center.y = (fittedEllipse.center.y + 0.5) * scale - 0.5;
+                fittedEllipse.size.width *= scale;
+                fittedEllipse.size.height *= scale;
+            }
+            if(fittedEllipse.size.height < 1000 && fittedEllipse.size.width < 1000)
+            {
+                ellipses.push_back(fittedEllipse);
+                insideCoin = true;
+            }
+        }
+        for(int child = hierarchy[i][2]; child >= 0; child = hierarchy[child][0])
+        {
+            pending.push_back(std::make_pair(child, insideCoin));
+        }
+    }
+    StageProfiler::count(counter_contours_fittable, fittable);
+    StageProfiler::count(counter_ellipses_fitted, fitted);
+    StageProfiler::count(counter_ellipses_rejected, fitted - (int) ellipses.size());
+    return skipped;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Fit an ellipse to every outermost contour of more than 100 points, keeping those smaller than 1000 pixels
+ * both ways
+ * @param[in] contours every contour
+ * @param[in] hierarchy tree of the contours
+ * @param[out] ellipses the ellipses that could be coins
+ * @return number of contours of more than 100 points that were not fitted for lying inside a coin
+ **********************************************************************************************************************/
+int CoinCounter::fitEllipses(const std::vector<std::vector<cv::Point> > &contours,
+                             const std::vector<cv::Vec4i> &hierarchy, std::vector<cv::RotatedRect> &ellipses) const
+{
+    int skipped = fitOutermost(contours, hierarchy, 1, ellipses);
+    if(verbose)
+    {
+        for(size_t i = 0; i < ellipses.size(); i++)
+        {
+            std::cout << "Ellipse found with size: " << ellipses[i].size << std::endl;
+        }
+    }
+    return skipped;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Find the ellipses that could be coins on a reduced image, then fit each again at full size
+ *
+ * The reduced image goes through the same Canny and ellipse fitting, with the 100 point and 1000 pixel limits scaled
+ * to its size, so nothing inside a fitted contour is fitted. Of overlapping candidates only the largest is kept, as
+ * rejectContained would drop the others anyway, and each is fitted again from a contour of the full size image found
+ * in a box around it.
+ *
+ * @param[in] imageGray gray image of the coins
+ * @param[out] ellipses the ellipses that could be coins, in full size coordinates
+ * @return number of contours of the reduced image that were not fitted for lying inside a coin
+ **********************************************************************************************************************/
+int CoinCounter::fitEllipsesPyramid(const cv::Mat &imageGray, std::vector<cv::RotatedRect> &ellipses) const
+{
+    ellipses.clear();
+    int levels = 0;
+    while(levels < pyramidLevels && std::min(imageGray.rows, imageGray.cols) >> (levels + 1) >= PYRAMID_MIN_SIDE)
+    {
+        levels++;
+    }
+    if(verbose && levels < pyramidLevels)
+    {
+        std::cout << "Only " << levels << " of " << pyramidLevels << " pyramid levels fit a " << imageGray.cols << "x"
+                  << imageGray.rows << " image" << std::endl;
+    }
+    double scale = 1 << levels;
+    cv::Mat reduced = imageGray;
+    {
+        StageTimer timer(profile_pyramid);
+        for(int k = 0; k < levels; k++)
+        {
+            cv::Mat next;
+            cv::pyrDown(reduced, next);
+            reduced = next;
+        }
+    }
+
+    cv::Mat edges;
+    findEdges(reduced, edges);
+    std::vector<std::vector<cv::Point> > contours;
+    std::vector<cv::Vec4i> hierarchy;
+    findContours(edges, contours, hierarchy);
+    std::vector<cv::RotatedRect> candidates;
+    int skipped = fitOutermost(contours, hierarchy, scale, candidates);
+
+    ContainmentGrid grid;
+    grid.build(candidates);
+    std::vector<int> containers;
+    for(int i = 0; i < candidates.size(); i++)
+    {
+        double size_i = candidates[i].size.height * candidates[i].size.width;
+        grid.containers(i, containers);
+        bool isInsideOtherEllipse = false;
+        for(size_t k = 0; k < containers.size(); k++)
+        {
+            int j = containers[k];
+            if(size_i < candidates[j].size.height * candidates[j].size.width) isInsideOtherEllipse = true;
+        }
+        if(isInsideOtherEllipse)
+        {
+            StageProfiler::count(counter_ellipses_rejected);
+            continue;
+        }
+
+        cv::RotatedRect refined;
+        if(refineEllipse(imageGray, candidates[i], refined))
+        {
+            if(verbose) std::cout << "Ellipse found with size: " << refined.size << std::endl;
+            ellipses.push_back(refined);
+        }
+        else
+        {
+            StageProfiler::count(counter_ellipses_rejected);
+            if(verbose) std::cout << "Ellipse at " << candidates[i].center << " not found at full size" << std::endl;
+        }
+    }
+    return skipped;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Fit an ellipse found on a reduced image, or predicted from an earlier frame, again from the full size image
+ *
+ * Contours of more than 100 points are traced in a box around the coarse ellipse. Of the ellipses fitted to them,
+ * those centered near the coarse one and of about its area qualify, and the largest wins, the outer rim of the coin
+ * rather than anything on its face.
+ *
+ * @param[in] imageGray full size gray image of the coins
+ * @param[in] coarse approximate ellipse, in full size coordinates
+ * @param[out] refined the ellipse fitted at full size
+ * @return true if a full size contour matched the coarse ellipse
+ **********************************************************************************************************************/
+bool CoinCounter::refineEllipse(const cv::Mat &imageGray, const cv::RotatedRect &coarse, cv::RotatedRect &refined) const
+{
+    double extent = std::max(coarse.size.width, coarse.size.height);
+    double margin = std::max((double) PYRAMID_REFINE_MIN_MARGIN, extent * PYRAMID_REFINE_MARGIN);
+    int x0 = cvFloor(coarse.center.x - extent / 2 - margin), y0 = cvFloor(coarse.center.y - extent / 2 - margin);
+    int x1 = cvCeil(coarse.center.x + extent / 2 + margin), y1 = cvCeil(coarse.center.y + extent / 2 + margin);
+    cv::Rect roi = cv::Rect(x0, y0, x1 - x0, y1 - y0) & cv::Rect(0, 0, imageGray.cols, imageGray.rows);
+    if(roi.area() <= 0) return false;
+
+    cv::Mat edges;
+    findEdges(imageGray(roi), edges);
+    std::vector<std::vector<cv::Point> > contours;
+    {
+        StageTimer timer(profile_contours);
+        cv::findContours(edges, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE, roi.tl());
+        StageProfiler::count(counter_contours, contours.size());
+    }
+
+    StageTimer timer(profile_fit);
+    double coarseArea = coarse.size.width * coarse.size.height;
+    double bestArea = 0;
+    for(int i = 0; i < contours.size(); i++)
+    {
+        if(contours[i].size() <= 100) continue;
+        StageProfiler::count(counter_contours_fittable);
+        StageProfiler::count(counter_ellipses_fitted);
+        cv::RotatedRect fittedEllipse = cv::fitEllipse(contours[i]);
+        if(fittedEllipse.size.height >= 1000 || fittedEllipse.size.width >= 1000) continue;
+
+        cv::Point2f offset = fittedEllipse.center - coarse.center;
+        double area = fittedEllipse.size.width * fittedEllipse.size.height;
+        if(std::sqrt(offset.x * offset.x + offset.y * offset.y) > extent / 4) continue;
+        if(area < coarseArea * 0.6 || area > coarseArea * 1.6) continue;
+        if(area > bestArea)
+        {
+            refined = fittedEllipse;
+            bestArea = area;
+        }
+    }
+    return bestArea > 0;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Keep the ellipses that are not inside a larger one
+ *
+ * An ellipse whose center lies within half the box diagonal of a larger ellipse is inside it
+ *
+ * @param[in] ellipses the ellipses that could be coins
+ * @param[out] result result whose coinEllipses are set
+ **********************************************************************************************************************/
+void CoinCounter::rejectContained(const std::vector<cv::RotatedRect> &ellipses, CoinResult &result) const
+{
+    StageTimer timer(profile_reject);
+    std::vector<cv::RotatedRect>& coinEllipses = result.coinEllipses;
+    coinEllipses.clear();
+    ContainmentGrid grid;
+    grid.build(ellipses);
+    std::vector<int> containers;
+    for(int i = 0; i < ellipses.size(); i++) {
+        bool isInsideOtherEllipse = false;
+
+        if(verbose) std::cout << "Ellipse " << i << " has center " << ellipses[i].center << std::endl;
+        double size_i = ellipses[i].size.height * ellipses[i].size.width;
+        grid.containers(i, containers);
+        for(size_t k = 0; k < containers.size(); k++) {
+            int j = containers[k];
+            double size_j = ellipses[j].size.height * ellipses[j].size.width;
+
+            if(size_i < size_j)
+            {
+                if(verbose) std::cout << "Eliminating contained ellipse " << i << std::endl;
+                isInsideOtherEllipse = true;
+            }
+        }
+
+        if(!isInsideOtherEllipse) coinEllipses.push_back(ellipses[i]);
+    }
+    StageProfiler::count(counter_ellipses_rejected, ellipses.size() - coinEllipses.size());
+}
+
+/*******************************************************************************************************************//**
+ * @brief Assign every coin ellipse the coin whose model diameter is closest, and total the coins
+ * @param[in,out] result result whose coinEllipses are classified
+ **********************************************************************************************************************/
+void CoinCounter::classify(CoinResult &result) const
+{
+    StageTimer timer(profile_classify);
+    StageProfiler::count(counter_coins, result.coinEllipses.size());
+    const std::vector<cv::RotatedRect>& coinEllipses = result.coinEllipses;
+    std::vector<double> ellipseDiameters;
+    for(int i = 0; i < coinEllipses.size(); i++) {
+        cv::Point2f pts[4];
+        coinEllipses[i].points(pts);
+        double diameter = sqrt( pow((pts[2].x - pts[0].x), 2) + pow((pts[0].y - pts[2].y), 2) );
+        if(verbose) std::cout << "Ellipse Diameter: " << diameter << std::endl;
+        ellipseDiameters.push_back(diameter);
+    }
+
+    std::fill(result.coinCount, result.coinCount + NUM_COIN_TYPES, 0);
+    result.ellipseAssignments.resize(ellipseDiameters.size());
+    for(int i = 0; i < ellipseDiameters.size(); i++) {
+        double currentDiameter = ellipseDiameters[i];
+        std::vector<double> sumOfSquaresError(NUM_COIN_TYPES);
+        for(int coinInt = penny; coinInt != quarter+1; coinInt++) {
+            sumOfSquaresError.at(coinInt) = pow(model[coinInt] - currentDiameter, 2);
+            if(verbose) std::cout << "Error from " << coinInt << " is " << sumOfSquaresError.at(coinInt) << std::endl;
+        }
+        result.ellipseAssignments[i] = std::distance( sumOfSquaresError.begin(),
+                                           std::min_element(sumOfSquaresError.begin(), sumOfSquaresError.end()));
+        if(verbose) std::cout << "Ellipse assigned to coin: " << result.ellipseAssignments[i] << std::endl;
+        result.coinCount[result.ellipseAssignments[i]]++;
+    }
+
+    result.total = 0;
+    for(int coinInt = penny; coinInt != quarter+1; coinInt++) {
+        result.total += coinValue(coinInt) * result.coinCount[coinInt];
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Plural name of a coin, as printed in the counts
+ * @param[in] coinType a CoinType
+ * @return the name, or an empty string for an unknown type
+ **********************************************************************************************************************/
+const char* CoinCounter::coinName(int coinType)
+{
+    switch(static_cast<CoinType>(coinType)) {
+        case penny: return "pennies";
+        case nickel: return "nickels";
+        case dime: return "dimes";
+        case quarter: return "quarters";
+        default: return "";
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Value of a coin in dollars
+ * @param[in] coinType a CoinType
+ * @return the value, or 0 for an unknown type
+ **********************************************************************************************************************/
+double CoinCounter::coinValue(int coinType)
+{
+    switch(static_cast<CoinType>(coinType)) {
+        case penny: return 0.01;
+        case nickel: return 0.05;
+        case dime: return 0.1;
+        case quarter: return 0.25;
+        default: return 0;
+    }
+}
@@ -0,0 +1,88 @@
+/*******************************************************************************************************************//**
+ * @file CoinCounter.h
+ * @brief Header file for the CoinCounter class
+ *
+ * This class runs the coin counting pipeline of lab2 on one image at a time
+ **********************************************************************************************************************/
+
+#ifndef COINCOUNTER_H
+#define COINCOUNTER_H
+
+#include <string>
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+enum CoinType {penny, nickel, dime, quarter};
+#define NUM_COIN_TYPES 4
+
+// the coins found in one image
+struct CoinResult
+{
+    std::vector<cv::RotatedRect> coinEllipses;
+    std::vector<int> ellipseAssignments;        // CoinType of each of coinEllipses
+    int coinCount[NUM_COIN_TYPES];
+    double total;                               // dollars
+    int skippedFits;                            // contours never fitted for lying inside a coin
+};
+
+/*******************************************************************************************************************//**
+ * @class CoinCounter
+ *
+ * @brief Finds the coins in an image and classifies them by their diameter in pixels
+ *
+ * Edges are found with Canny, every contour of more than 100 points that is not inside a contour already fitted gets an
+ * ellipse fitted, ellipses inside a larger one are dropped, and each remaining ellipse is assigned the coin whose model
+ * diameter is closest. Each step is a method of its own so CoinPipeline can run only the ones an output needs. With
+ * pyramid levels set, the ellipses are instead found on a reduced image and each one is fitted again from the full
+ * size image around where it was found. With a tile size set, Canny and findContours run on overlapping tiles in
+ * parallel, for images too large to go through them on one thread.
+ * A CoinCounter is never changed by its steps, so one instance can be shared by any number of threads.
+ **********************************************************************************************************************/
+class CoinCounter
+{
+private:
+
+    std::vector<double> model;      // expected diameter of each CoinType, in pixels
+    bool verbose;
+    int pyramidLevels;              // halvings of the image the coins are first looked for at, 0 for full size only
+    int tileSize;                   // side of the tiles edges and contours are found in, 0 for the whole image at once
+
+    int fitOutermost(const std::vector<std::vector<cv::Point> > &contours, const std::vector<cv::Vec4i> &hierarchy,
+                     double scale, std::vector<cv::RotatedRect> &ellipses) const;
+
+public:
+
+    // constructors
+    CoinCounter();
+
+    // configuration
+    bool loadModel(const std::string &modelPath);
+    void setVerbose(bool verbose);
+    void setPyramidLevels(int levels);
+    int getPyramidLevels() const;
+    void setTileSize(int size);
+    int getTileSize() const;
+    double getModelDiameter(int coinType) const;
+
+    // processing
+    CoinResult count(const cv::Mat &imageIn) const;
+
+    // pipeline steps, in the order count() runs them
+    void findEdges(const cv::Mat &imageGray, cv::Mat &imageEdges) const;
+    void findContours(cv::Mat &imageEdges, std::vector<std::vector<cv::Point> > &contours,
+                      std::vector<cv::Vec4i> &hierarchy) const;
+    void findContoursTiled(const cv::Mat &imageGray, std::vector<std::vector<cv::Point> > &contours,
+                           std::vector<cv::Vec4i> &hierarchy) const;
+    int fitEllipses(const std::vector<std::vector<cv::Point> > &contours, const std::vector<cv::Vec4i> &hierarchy,
+                    std::vector<cv::RotatedRect> &ellipses) const;
+    int fitEllipsesPyramid(const cv::Mat &imageGray, std::vector<cv::RotatedRect> &ellipses) const;
+    bool refineEllipse(const cv::Mat &imageGray, const cv::RotatedRect &coarse, cv::RotatedRect &refined) const;
+    void rejectContained(const std::vector<cv::RotatedRect> &ellipses, CoinResult &result) const;
+    void classify(CoinResult &result) const;
+
+    // coin names and values
+    static const char* coinName(int coinType);
+    static double coinValue(int coinType);
+};
+
+#endif // COINCOUNTER_H
@@ -0,0 +1,133 @@
+/*******************************************************************************************************************//**
+ * @file CoinDetector.cpp
+ * @brief Implementation of the CoinDetector and ContourDetector classes
+ *
+ * These classes are the interface every coin detection engine of lab2 implements, and the contour engine behind it
+ **********************************************************************************************************************/
+
+#include "CoinDetector.h"
+#include "HoughDetector.h"
+#include "BlobDetector.h"
+
+#include <cmath>
+#include <algorithm>
+
+/*******************************************************************************************************************//**
+ * @brief Class constructor
+ * @param[in] counter counter with its model loaded, which has to outlive the detector
+ **********************************************************************************************************************/
+CoinDetector::CoinDetector(const CoinCounter &counter) : counter(counter)
+{
+}
+
+/*******************************************************************************************************************//**
+ * @brief Class destructor
+ **********************************************************************************************************************/
+CoinDetector::~CoinDetector()
+{
+}
+
+/*******************************************************************************************************************//**
+ * @brief Create an engine by name
+ * @param[in] engine "contours", "hough" or "blobs"
+ * @param[in] counter counter with its model loaded, which has to outlive the detector
+ * @return the engine, to be deleted by the caller, or NULL for an unknown name
+ **********************************************************************************************************************/
+CoinDetector* CoinDetector::create(const std::string &engine, const CoinCounter &counter)
+{
+    if(engine == "contours") return new ContourDetector(counter);
+    if(engine == "hough") return new HoughDetector(counter);
+    if(engine == "blobs") return new BlobDetector(counter);
+    return NULL;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Name of an engine, as create() takes it
+ * @param[in] engine index of the engine, from 0 to NUM_DETECTOR_ENGINES - 1
+ * @return the name, or an empty string for an unknown index
+ **********************************************************************************************************************/
+const char* CoinDetector::engineName(int engine)
+{
+    switch(engine) {
+        case 0: return "contours";
+        case 1: return "hough";
+        case 2: return "blobs";
+        default: return "";
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Classify the coins an engine found against the model
+ * @param[in] coinEllipses an ellipse around every coin
+ * @return the classified coins
+ **********************************************************************************************************************/
+CoinResult CoinDetector::classify(const std::vector<cv::RotatedRect> &coinEllipses) const
+{
+    CoinResult result;
+    result.coinEllipses = coinEllipses;
+    result.skippedFits = 0;
+    counter.classify(result);
+    return result;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Expected width of a coin across
+ *
+ * CoinCounter::classify measures the diagonal of the box around a coin, so the model holds that rather than the width
+ *
+ * @param[in] coinType a CoinType
+ * @return the width in pixels
+ **********************************************************************************************************************/
+double CoinDetector::coinDiameter(int coinType) const
+{
+    return counter.getModelDiameter(coinType) / std::sqrt(2.0);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Expected width of the smallest coin
+ * @return the width in pixels
+ **********************************************************************************************************************/
+double CoinDetector::minCoinDiameter() const
+{
+    double diameter = coinDiameter(penny);
+    for(int coinInt = penny; coinInt != quarter+1; coinInt++) diameter = std::min(diameter, coinDiameter(coinInt));
+    return diameter;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Expected width of the largest coin
+ * @return the width in pixels
+ **********************************************************************************************************************/
+double CoinDetector::maxCoinDiameter() const
+{
+    double diameter = coinDiameter(penny);
+    for(int coinInt = penny; coinInt != quarter+1; coinInt++) diameter = std::max(diameter, coinDiameter(coinInt));
+    return diameter;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Class constructor
+ * @param[in] counter counter with its model loaded, whose pipeline finds the coins
+ **********************************************************************************************************************/
+ContourDetector::ContourDetector(const CoinCounter &counter) : CoinDetector(counter)
+{
+}
+
+/*******************************************************************************************************************//**
+ * @brief Name of the engine
+ * @return "contours"
+ **********************************************************************************************************************/
+const char* ContourDetector::name() const
+{
+    return "contours";
+}
+
+/*******************************************************************************************************************//**
+ * @brief Find and classify the coins in an image
+ * @param[in] imageIn BGR image of the coins
+ * @return the coins found
+ **********************************************************************************************************************/
+CoinResult ContourDetector::count(const cv::Mat &imageIn) const
+{
+    return counter.count(imageIn);
+}
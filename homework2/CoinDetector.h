@@ -0,0 +1,71 @@
+/*******************************************************************************************************************//**
+ * @file CoinDetector.h
+ * @brief Header file for the CoinDetector and ContourDetector classes
+ *
+ * These classes are the interface every coin detection engine of lab2 implements, and the contour engine behind it
+ **********************************************************************************************************************/
+
+#ifndef COINDETECTOR_H
+#define COINDETECTOR_H
+
+#include <string>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "CoinCounter.h"
+
+// every engine create() knows, in the order the benchmark runs them
+#define NUM_DETECTOR_ENGINES 3
+
+/*******************************************************************************************************************//**
+ * @class CoinDetector
+ *
+ * @brief A way of finding the coins in an image, classified against the model of a CoinCounter
+ *
+ * Engines differ only in how they find the coin outlines. Every engine classifies the ellipses it finds with the same
+ * CoinCounter::classify, so their counts differ only where they found different coins, and an engine is picked by
+ * name at run time through create().
+ **********************************************************************************************************************/
+class CoinDetector
+{
+protected:
+
+    const CoinCounter &counter;
+
+    CoinResult classify(const std::vector<cv::RotatedRect> &coinEllipses) const;
+    double coinDiameter(int coinType) const;
+    double minCoinDiameter() const;
+    double maxCoinDiameter() const;
+
+public:
+
+    // constructors
+    CoinDetector(const CoinCounter &counter);
+    virtual ~CoinDetector();
+    static CoinDetector* create(const std::string &engine, const CoinCounter &counter);
+    static const char* engineName(int engine);
+
+    // processing
+    virtual const char* name() const = 0;
+    virtual CoinResult count(const cv::Mat &imageIn) const = 0;
+};
+
+/*******************************************************************************************************************//**
+ * @class ContourDetector
+ *
+ * @brief The coin counter's own pipeline: Canny, contours, an ellipse fitted to each outermost contour
+ *
+ * Honors the pyramid levels and tile size set on the counter.
+ **********************************************************************************************************************/
+class ContourDetector : public CoinDetector
+{
+public:
+
+    // constructors
+    ContourDetector(const CoinCounter &counter);
+
+    // processing
+    const char* name() const;
+    CoinResult count(const cv::Mat &imageIn) const;
+};
+
+#endif // COINDETECTOR_H
@@ -0,0 +1,221 @@
+/*******************************************************************************************************************//**
+ * @file CoinPipeline.cpp
+ * @brief Implementation of the CoinPipeline class
+ *
+ * This class evaluates the stages of lab2 for one image lazily, running only what the requested outputs depend on
+ **********************************************************************************************************************/
+
+#include "CoinPipeline.h"
+#include "StageProfiler.h"
+
+#include <algorithm>
+
+// the stages each stage is computed from, -1 where there are fewer than two
+static const int stageInputs[NUM_PIPELINE_STAGES][2] = {
+    {-1, -1},                               // stage_gray, from the input image
+    {stage_gray, -1},                       // stage_normalized
+    {stage_normalized, -1},                 // stage_equalized
+    {stage_gray, -1},                       // stage_edges
+    {stage_edges, -1},                      // stage_contours, from stage_gray instead with a tile size set
+    {stage_contours, -1},                   // stage_contour_image
+    {stage_contours, -1},                   // stage_rectangles
+    {stage_rectangles, -1},                 // stage_rectangle_image
+    {stage_contours, -1},                   // stage_ellipses, from stage_gray instead with pyramid levels set
+    {stage_ellipses, -1},                   // stage_coins
+    {stage_coins, -1},                      // stage_ellipse_image
+};
+
+/*******************************************************************************************************************//**
+ * @brief Class constructor
+ *
+ * Nothing runs until an output is asked for
+ *
+ * @param[in] counter counter whose steps and model the stages use
+ * @param[in] imageIn BGR image of the coins
+ **********************************************************************************************************************/
+CoinPipeline::CoinPipeline(const CoinCounter &counter, const cv::Mat &imageIn) : counter(counter), imageIn(imageIn),
+    skippedFits(0)
+{
+    std::fill(done, done + NUM_PIPELINE_STAGES, false);
+    std::fill(wanted, wanted + NUM_PIPELINE_STAGES, false);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Run a stage after the stages it depends on, unless it already ran
+ * @param[in] stage the stage
+ **********************************************************************************************************************/
+void CoinPipeline::run(PipelineStage stage)
+{
+    if(done[stage]) return;
+    if(stage == stage_ellipses && counter.getPyramidLevels() > 0) run(stage_gray);
+    else if(stage == stage_contours && counter.getTileSize() > 0) run(stage_gray);
+    else
+    {
+        for(int i = 0; i < 2; i++)
+        {
+            if(stageInputs[stage][i] >= 0) run(static_cast<PipelineStage>(stageInputs[stage][i]));
+        }
+    }
+    compute(stage);
+    done[stage] = true;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Compute one stage from its inputs, which have all run
+ * @param[in] stage the stage
+ **********************************************************************************************************************/
+void CoinPipeline::compute(PipelineStage stage)
+{
+    switch(stage) {
+        case stage_gray:
+        {
+            StageTimer timer(profile_gray);
+            cv::cvtColor(imageIn, images[stage_gray], cv::COLOR_BGR2GRAY);
+            break;
+        }
+        case stage_normalized:
+            cv::normalize(images[stage_gray], images[stage_normalized], 0, 255);
+            break;
+        case stage_equalized:
+            cv::equalizeHist(images[stage_normalized], images[stage_equalized]);
+            break;
+        case stage_edges:
+            counter.findEdges(images[stage_gray], images[stage_edges]);
+            break;
+        case stage_contours:
+            if(counter.getTileSize() > 0)
+            {
+                counter.findContoursTiled(images[stage_gray], contours, hierarchy);
+            }
+            else if(wanted[stage_edges])
+            {
+                cv::Mat edges = images[stage_edges].clone();
+                counter.findContours(edges, contours, hierarchy);
+            }
+            else
+            {
+                // nobody reads the edges, findContours can have them; asking for them later runs Canny again
+                counter.findContours(images[stage_edges], contours, hierarchy);
+                images[stage_edges].release();
+                done[stage_edges] = false;
+            }
+            break;
+        case stage_contour_image:
+        {
+            cv::Mat& imageContours = images[stage_contour_image];
+            imageContours = cv::Mat::zeros(imageIn.size(), CV_8UC3);
+            cv::RNG rand(12345);
+            for(int i = 0; i < contours.size(); i++)
+            {
+                cv::Scalar color = cv::Scalar(rand.uniform(0, 256), rand.uniform(0,256), rand.uniform(0,256));
+                cv::drawContours(imageContours, contours, i, color);
+            }
+            break;
+        }
+        case stage_rectangles:
+            rectangles.resize(contours.size());
+            for(int i = 0; i < contours.size(); i++)
+            {
+                rectangles[i] = cv::minAreaRect(contours[i]);
+            }
+            break;
+        case stage_rectangle_image:
+        {
+            cv::Mat& imageRectangles = images[stage_rectangle_image];
+            imageRectangles = cv::Mat::zeros(imageIn.size(), CV_8UC3);
+            cv::RNG rand(12345);
+            for(int i = 0; i < rectangles.size(); i++)
+            {
+                cv::Scalar color = cv::Scalar(rand.uniform(0, 256), rand.uniform(0,256), rand.uniform(0,256));
+                cv::Point2f rectanglePoints[4];
+                rectangles[i].points(rectanglePoints);
+                for(int j = 0; j < 4; j++)
+                {
+                    cv::line(imageRectangles, rectanglePoints[j], rectanglePoints[(j+1) % 4], color);
+                }
+            }
+            break;
+        }
+        case stage_ellipses:
+            if(counter.getPyramidLevels() > 0) skippedFits = counter.fitEllipsesPyramid(images[stage_gray], ellipses);
+            else skippedFits = counter.fitEllipses(contours, hierarchy, ellipses);
+            break;
+        case stage_coins:
+            counter.rejectContained(ellipses, coins);
+            counter.classify(coins);
+            coins.skippedFits = skippedFits;
+            break;
+        case stage_ellipse_image:
+        {
+            cv::Mat& imageEllipse = images[stage_ellipse_image];
+            imageEllipse = cv::Mat::zeros(imageIn.size(), CV_8UC3);
+            for(int i = 0; i < coins.coinEllipses.size(); i++)
+            {
+                cv::Scalar color;
+                switch(static_cast<CoinType>(coins.ellipseAssignments[i])) {
+                    case penny:
+                        color = cv::Scalar(0,0,256);
+                        break;
+                    case nickel:
+                        color = cv::Scalar(0,256,256);
+                        break;
+                    case dime:
+                        color = cv::Scalar(256,0,0);
+                        break;
+                    case quarter:
+                        color = cv::Scalar(0,256,0);
+                        break;
+                    default:
+                        continue;
+                }
+                cv::ellipse(imageEllipse, coins.coinEllipses[i], color, 2);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Mark a stage as an output the caller will read, so other stages leave its result intact
+ *
+ * Only needed for stages another stage could consume, which is the edge image
+ *
+ * @param[in] stage the stage
+ **********************************************************************************************************************/
+void CoinPipeline::want(PipelineStage stage)
+{
+    wanted[stage] = true;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Image produced by a stage, running it first if needed
+ * @param[in] stage a stage that produces an image
+ * @return the image, empty for a stage that does not produce one
+ **********************************************************************************************************************/
+const cv::Mat& CoinPipeline::getImage(PipelineStage stage)
+{
+    run(stage);
+    return images[stage];
+}
+
+/*******************************************************************************************************************//**
+ * @brief Every contour of the edge image, tracing them first if needed
+ * @return the contours
+ **********************************************************************************************************************/
+const std::vector<std::vector<cv::Point> >& CoinPipeline::getContours()
+{
+    run(stage_contours);
+    return contours;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Coins in the image, running the stages up to classification first if needed
+ * @return the coins
+ **********************************************************************************************************************/
+const CoinResult& CoinPipeline::getCoins()
+{
+    run(stage_coins);
+    return coins;
+}
@@ -0,0 +1,62 @@
+/*******************************************************************************************************************//**
+ * @file CoinPipeline.h
+ * @brief Header file for the CoinPipeline class
+ *
+ * This class evaluates the stages of lab2 for one image lazily, running only what the requested outputs depend on
+ **********************************************************************************************************************/
+
+#ifndef COINPIPELINE_H
+#define COINPIPELINE_H
+
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "CoinCounter.h"
+
+// every result the pipeline can produce, each computed from the stages listed for it in CoinPipeline.cpp
+enum PipelineStage {stage_gray, stage_normalized, stage_equalized, stage_edges, stage_contours, stage_contour_image,
+                    stage_rectangles, stage_rectangle_image, stage_ellipses, stage_coins, stage_ellipse_image};
+#define NUM_PIPELINE_STAGES 11
+
+/*******************************************************************************************************************//**
+ * @class CoinPipeline
+ *
+ * @brief Stage graph of the coin counter for one image, where each stage runs the first time something needs it
+ *
+ * Asking for a stage runs the stages it depends on that have not run yet, then the stage itself, and keeps the
+ * result. Counting coins therefore never normalizes, equalizes or draws anything, while the interactive mode asks for
+ * the images it shows and gets the stages behind them too. Stages a caller means to read are kept intact: the edge
+ * image is only copied before findContours when the edges themselves were asked for.
+ **********************************************************************************************************************/
+class CoinPipeline
+{
+private:
+
+    const CoinCounter &counter;
+    cv::Mat imageIn;
+    bool done[NUM_PIPELINE_STAGES];
+    bool wanted[NUM_PIPELINE_STAGES];
+
+    cv::Mat images[NUM_PIPELINE_STAGES];    // results of the stages that produce an image
+    std::vector<std::vector<cv::Point> > contours;
+    std::vector<cv::Vec4i> hierarchy;       // tree of contours
+    std::vector<cv::RotatedRect> rectangles;
+    std::vector<cv::RotatedRect> ellipses;
+    int skippedFits;                        // contours inside a coin that stage_ellipses did not fit
+    CoinResult coins;
+
+    void run(PipelineStage stage);
+    void compute(PipelineStage stage);
+
+public:
+
+    // constructors
+    CoinPipeline(const CoinCounter &counter, const cv::Mat &imageIn);
+
+    // outputs
+    void want(PipelineStage stage);
+    const cv::Mat& getImage(PipelineStage stage);
+    const std::vector<std::vector<cv::Point> >& getContours();
+    const CoinResult& getCoins();
+};
+
+#endif // COINPIPELINE_H
@@ -0,0 +1,102 @@
+/*******************************************************************************************************************//**
+ * @file CoinTracker.cpp
+ * @brief Implementation of the CoinTracker class
+ *
+ * This class counts the coins in a video, following coins from frame to frame instead of searching every frame
+ **********************************************************************************************************************/
+
+#include "CoinTracker.h"
+#include "CoinPipeline.h"
+#include "StageProfiler.h"
+
+/*******************************************************************************************************************//**
+ * @brief Class constructor
+ *
+ * The first frame processed always gets a full detection
+ *
+ * @param[in] counter counter with its model loaded, used for detection, refitting and classification
+ **********************************************************************************************************************/
+CoinTracker::CoinTracker(const CoinCounter &counter) : counter(counter), framesSinceDetection(0), lost(true),
+    detections(0)
+{
+    coins.skippedFits = 0;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Run the full coin counter on a frame and start a track at every coin it finds
+ * @param[in] frame BGR video frame
+ **********************************************************************************************************************/
+void CoinTracker::detect(const cv::Mat &frame)
+{
+    CoinPipeline pipeline(counter, frame);
+    const std::vector<cv::RotatedRect>& found = pipeline.getCoins().coinEllipses;
+    tracks.resize(found.size());
+    for(size_t i = 0; i < found.size(); i++)
+    {
+        tracks[i].ellipse = found[i];
+        tracks[i].velocity = cv::Point2f(0, 0);
+    }
+    framesSinceDetection = 0;
+    lost = false;
+    detections++;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Fit every tracked coin again around where its last motion puts it, dropping the ones that are not found
+ **********************************************************************************************************************/
+void CoinTracker::track()
+{
+    size_t kept = 0;
+    for(size_t i = 0; i < tracks.size(); i++)
+    {
+        Track& t = tracks[i];
+        cv::RotatedRect predicted = t.ellipse;
+        predicted.center += t.velocity;
+        cv::RotatedRect refined;
+        if(!counter.refineEllipse(imageGray, predicted, refined))
+        {
+            lost = true;
+            continue;
+        }
+        t.velocity = refined.center - t.ellipse.center;
+        t.ellipse = refined;
+        tracks[kept++] = t;
+    }
+    tracks.resize(kept);
+    framesSinceDetection++;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Count the coins in the next frame of the video
+ * @param[in] frame BGR video frame, the same size as the frames before it
+ * @return the coins in the frame
+ **********************************************************************************************************************/
+const CoinResult& CoinTracker::process(const cv::Mat &frame)
+{
+    if(lost || framesSinceDetection >= TRACKER_REDETECT_FRAMES)
+    {
+        detect(frame);
+    }
+    else
+    {
+        {
+            StageTimer timer(profile_gray);
+            cv::cvtColor(frame, imageGray, cv::COLOR_BGR2GRAY);
+        }
+        track();
+    }
+
+    coins.coinEllipses.resize(tracks.size());
+    for(size_t i = 0; i < tracks.size(); i++) coins.coinEllipses[i] = tracks[i].ellipse;
+    counter.classify(coins);
+    return coins;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Number of frames that went through the full coin counter
+ * @return the number of full detections so far
+ **********************************************************************************************************************/
+int CoinTracker::getDetections() const
+{
+    return detections;
+}
@@ -0,0 +1,62 @@
+/*******************************************************************************************************************//**
+ * @file CoinTracker.h
+ * @brief Header file for the CoinTracker class
+ *
+ * This class counts the coins in a video, following coins from frame to frame instead of searching every frame
+ **********************************************************************************************************************/
+
+#ifndef COINTRACKER_H
+#define COINTRACKER_H
+
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "CoinCounter.h"
+
+// frames between full detections, which pick up coins that entered the view since the last one
+#define TRACKER_REDETECT_FRAMES 30
+
+/*******************************************************************************************************************//**
+ * @class CoinTracker
+ *
+ * @brief Follows the coins of a video, running the full pipeline only every so often
+ *
+ * The first frame goes through the whole coin counter. After that every coin is predicted to move as far as it did
+ * the frame before, and its ellipse is fitted again only in a box around the prediction, so a frame costs Canny and
+ * findContours over the coins rather than over the whole image. The full pipeline runs again every
+ * TRACKER_REDETECT_FRAMES frames, and right away on the frame after any coin could not be found around its
+ * prediction.
+ **********************************************************************************************************************/
+class CoinTracker
+{
+private:
+
+    struct Track
+    {
+        cv::RotatedRect ellipse;
+        cv::Point2f velocity;       // pixels per frame
+    };
+
+    const CoinCounter &counter;
+    std::vector<Track> tracks;
+    cv::Mat imageGray;
+    CoinResult coins;
+    int framesSinceDetection;
+    bool lost;
+    int detections;
+
+    void detect(const cv::Mat &frame);
+    void track();
+
+public:
+
+    // constructors
+    CoinTracker(const CoinCounter &counter);
+
+    // processing
+    const CoinResult& process(const cv::Mat &frame);
+
+    // statistics
+    int getDetections() const;
+};
+
+#endif // COINTRACKER_H
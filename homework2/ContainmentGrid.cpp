@@ -0,0 +1,127 @@
+/*******************************************************************************************************************//**
+ * @file ContainmentGrid.cpp
+ * @brief Implementation of the ContainmentGrid class
+ *
+ * This class finds which ellipses reach over the center of another without comparing every pair
+ **********************************************************************************************************************/
+
+#include "ContainmentGrid.h"
+
+#include <cmath>
+#include <algorithm>
+
+/*******************************************************************************************************************//**
+ * @brief Class constructor
+ *
+ * Creates an empty grid, build() has to be called before any query
+ **********************************************************************************************************************/
+ContainmentGrid::ContainmentGrid() : ellipses(NULL), cellSize(1), cellsX(0), cellsY(0)
+{
+}
+
+/*******************************************************************************************************************//**
+ * @brief Column of the cell under an x coordinate, clamped to the grid
+ * @param[in] x image x coordinate
+ * @return the column
+ **********************************************************************************************************************/
+int ContainmentGrid::cellX(double x) const
+{
+    double cell = std::floor((x - origin.x) / cellSize);
+    return (int) std::max(0.0, std::min(cell, (double) (cellsX - 1)));
+}
+
+/*******************************************************************************************************************//**
+ * @brief Row of the cell under a y coordinate, clamped to the grid
+ * @param[in] y image y coordinate
+ * @return the row
+ **********************************************************************************************************************/
+int ContainmentGrid::cellY(double y) const
+{
+    double cell = std::floor((y - origin.y) / cellSize);
+    return (int) std::max(0.0, std::min(cell, (double) (cellsY - 1)));
+}
+
+/*******************************************************************************************************************//**
+ * @brief Index a set of ellipses
+ *
+ * The grid covers the bounding box of the centers, the only places queries are made. Cells are as wide as the median
+ * disc, widened when needed so there are at most about four cells per ellipse.
+ *
+ * @param[in] ellipses the ellipses, which must outlive the grid or the next build
+ **********************************************************************************************************************/
+void ContainmentGrid::build(const std::vector<cv::RotatedRect> &ellipses)
+{
+    this->ellipses = &ellipses;
+    int n = (int) ellipses.size();
+    radius.resize(n);
+    cellsX = cellsY = 0;
+    cellFirst.assign(1, 0);
+    cellEllipses.clear();
+    if(n == 0) return;
+
+    float minX = ellipses[0].center.x, maxX = minX;
+    float minY = ellipses[0].center.y, maxY = minY;
+    for(int j = 0; j < n; j++) {
+        cv::Point2f pts[4];
+        ellipses[j].points(pts);
+        radius[j] = sqrt( pow((pts[2].x - pts[0].x), 2) + pow((pts[0].y - pts[2].y), 2) ) / 2.0;
+        minX = std::min(minX, ellipses[j].center.x);
+        maxX = std::max(maxX, ellipses[j].center.x);
+        minY = std::min(minY, ellipses[j].center.y);
+        maxY = std::max(maxY, ellipses[j].center.y);
+    }
+
+    std::vector<double> radii(radius.begin(), radius.end());
+    std::nth_element(radii.begin(), radii.begin() + n / 2, radii.end());
+    double width = maxX - minX, height = maxY - minY;
+    cellSize = std::max(1.0, 2 * radii[n / 2]);
+    cellSize = std::max(cellSize, std::sqrt(width * height / (4.0 * n)));
+    origin = cv::Point2f(minX, minY);
+    cellsX = (int) (width / cellSize) + 1;
+    cellsY = (int) (height / cellSize) + 1;
+
+    // the float subtraction in the distance test can be off by a fraction of a pixel, one pixel of margin covers it
+    std::vector<cv::Rect> spans(n);
+    cellFirst.assign((size_t) cellsX * cellsY + 1, 0);
+    for(int j = 0; j < n; j++) {
+        const cv::Point2f& c = ellipses[j].center;
+        double reach = radius[j] + 1;
+        int x0 = cellX(c.x - reach), x1 = cellX(c.x + reach);
+        int y0 = cellY(c.y - reach), y1 = cellY(c.y + reach);
+        spans[j] = cv::Rect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+        for(int y = y0; y <= y1; y++) {
+            for(int x = x0; x <= x1; x++) cellFirst[(size_t) y * cellsX + x + 1]++;
+        }
+    }
+    for(size_t c = 1; c < cellFirst.size(); c++) cellFirst[c] += cellFirst[c - 1];
+
+    // filled in ascending order, so every cell lists its ellipses in index order
+    cellEllipses.resize(cellFirst.back());
+    std::vector<int> next(cellFirst.begin(), cellFirst.end() - 1);
+    for(int j = 0; j < n; j++) {
+        const cv::Rect& s = spans[j];
+        for(int y = s.y; y < s.y + s.height; y++) {
+            for(int x = s.x; x < s.x + s.width; x++) cellEllipses[next[(size_t) y * cellsX + x]++] = j;
+        }
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Find every other ellipse whose disc holds the center of ellipse i
+ * @param[in] i index of the ellipse
+ * @param[out] out indices of the containing ellipses, in ascending order
+ **********************************************************************************************************************/
+void ContainmentGrid::containers(int i, std::vector<int> &out) const
+{
+    out.clear();
+    const cv::Point2f& center_i = (*ellipses)[i].center;
+    size_t cell = (size_t) cellY(center_i.y) * cellsX + cellX(center_i.x);
+    for(int k = cellFirst[cell]; k < cellFirst[cell + 1]; k++) {
+        int j = cellEllipses[k];
+        if (i == j) continue;
+
+        cv::Point2f center_j = (*ellipses)[j].center;
+        double distance = sqrt( pow((center_i.x - center_j.x), 2) + pow((center_i.y - center_j.y), 2) );
+        if(distance < radius[j]) out.push_back(j);
+    }
+}
@@ -0,0 +1,53 @@
+/*******************************************************************************************************************//**
+ * @file ContainmentGrid.h
+ * @brief Header file for the ContainmentGrid class
+ *
+ * This class finds which ellipses reach over the center of another without comparing every pair
+ **********************************************************************************************************************/
+
+#ifndef CONTAINMENTGRID_H
+#define CONTAINMENTGRID_H
+
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+/*******************************************************************************************************************//**
+ * @class ContainmentGrid
+ *
+ * @brief Uniform grid over ellipse centers, where each ellipse is listed in every cell its bounding disc overlaps
+ *
+ * The disc of an ellipse is centered on it with half the diagonal of its box as radius, the test the coin filter uses
+ * for containment. To find the ellipses whose disc holds a center only the one cell under that center is read, and
+ * the exact distance test runs on the few ellipses listed there. Cells are about as wide as a typical disc, so each
+ * ellipse lands in a handful of cells and building and querying the grid are close to linear in the number of
+ * ellipses. Radii and distances are computed exactly as the pairwise test computed them, so the answers are the same.
+ **********************************************************************************************************************/
+class ContainmentGrid
+{
+private:
+
+    const std::vector<cv::RotatedRect>* ellipses;
+    std::vector<double> radius;             // half the box diagonal of each ellipse
+    cv::Point2f origin;                     // corner of the cell (0, 0)
+    double cellSize;
+    int cellsX;
+    int cellsY;
+    std::vector<int> cellFirst;             // ellipses of cell c are cellEllipses[cellFirst[c] .. cellFirst[c + 1])
+    std::vector<int> cellEllipses;
+
+    int cellX(double x) const;
+    int cellY(double y) const;
+
+public:
+
+    // constructors
+    ContainmentGrid();
+
+    // indexing
+    void build(const std::vector<cv::RotatedRect> &ellipses);
+
+    // queries
+    void containers(int i, std::vector<int> &out) const;
+};
+
+#endif // CONTAINMENTGRID_H
@@ -0,0 +1,65 @@
+/*******************************************************************************************************************//**
+ * @file HoughDetector.cpp
+ * @brief Implementation of the HoughDetector class
+ *
+ * This class finds coins as circles with the Hough transform
+ **********************************************************************************************************************/
+
+#include "HoughDetector.h"
+#include "StageProfiler.h"
+
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @brief Class constructor
+ * @param[in] counter counter with its model loaded, whose model gives the sizes of the circles searched
+ **********************************************************************************************************************/
+HoughDetector::HoughDetector(const CoinCounter &counter) : CoinDetector(counter)
+{
+}
+
+/*******************************************************************************************************************//**
+ * @brief Name of the engine
+ * @return "hough"
+ **********************************************************************************************************************/
+const char* HoughDetector::name() const
+{
+    return "hough";
+}
+
+/*******************************************************************************************************************//**
+ * @brief Find and classify the coins in an image
+ * @param[in] imageIn BGR image of the coins
+ * @return the coins found
+ **********************************************************************************************************************/
+CoinResult HoughDetector::count(const cv::Mat &imageIn) const
+{
+    cv::Mat imageGray;
+    {
+        StageTimer timer(profile_gray);
+        cv::cvtColor(imageIn, imageGray, cv::COLOR_BGR2GRAY);
+    }
+
+    std::vector<cv::RotatedRect> coinEllipses;
+    {
+        StageTimer timer(profile_hough);
+        cv::Mat imageBlurred;
+        cv::medianBlur(imageGray, imageBlurred, 5);
+
+        // the same upper Canny threshold as CoinCounter::findEdges
+        const double cannyThreshold2 = 200;
+        double minDiameter = minCoinDiameter();
+        double maxDiameter = maxCoinDiameter();
+        std::vector<cv::Vec3f> circles;
+        cv::HoughCircles(imageBlurred, circles, cv::HOUGH_GRADIENT, 1, minDiameter * 0.8, cannyThreshold2,
+                         HOUGH_ACCUMULATOR_THRESHOLD, cvFloor(minDiameter * 0.35), cvCeil(maxDiameter * 0.65));
+
+        for(size_t i = 0; i < circles.size(); i++)
+        {
+            float diameter = 2 * circles[i][2];
+            coinEllipses.push_back(cv::RotatedRect(cv::Point2f(circles[i][0], circles[i][1]),
+                                                   cv::Size2f(diameter, diameter), 0));
+        }
+    }
+    return classify(coinEllipses);
+}
@@ -0,0 +1,39 @@
+/*******************************************************************************************************************//**
+ * @file HoughDetector.h
+ * @brief Header file for the HoughDetector class
+ *
+ * This class finds coins as circles with the Hough transform
+ **********************************************************************************************************************/
+
+#ifndef HOUGHDETECTOR_H
+#define HOUGHDETECTOR_H
+
+#include "opencv2/opencv.hpp"
+#include "CoinDetector.h"
+
+// votes a circle center needs, out of about one per pixel of its rim
+#define HOUGH_ACCUMULATOR_THRESHOLD 40
+
+/*******************************************************************************************************************//**
+ * @class HoughDetector
+ *
+ * @brief Coins are the circles HoughCircles finds, within the sizes the model allows
+ *
+ * The gray image is median filtered first so the detail on the coin faces does not vote for centers of its own. The
+ * radii searched reach from well below the smallest coin of the model to well above the largest, and two centers
+ * closer than most of the smallest coin are taken as one coin, since coins do not overlap. Circles need no contour
+ * tracing and ignore gaps in the rim, but only work for coins seen from straight above.
+ **********************************************************************************************************************/
+class HoughDetector : public CoinDetector
+{
+public:
+
+    // constructors
+    HoughDetector(const CoinCounter &counter);
+
+    // processing
+    const char* name() const;
+    CoinResult count(const cv::Mat &imageIn) const;
+};
+
+#endif // HOUGHDETECTOR_H
@@ -0,0 +1,129 @@
+/*******************************************************************************************************************//**
+ * @file StageProfiler.cpp
+ * @brief Implementation of the StageProfiler class
+ *
+ * This class times the stages of lab2 and counts what each stage produced, for a JSON summary or a Chrome trace
+ **********************************************************************************************************************/
+
+#include "StageProfiler.h"
+
+#include <algorithm>
+#include <iomanip>
+
+// names of the stages and counters in the summary and trace
+static const char* stageNames[NUM_PROFILE_STAGES] = {"decode", "gray", "pyramid", "canny", "find_contours",
+                                                     "tiled_canny_contours", "fit_ellipse", "reject_contained",
+                                                     "hough_circles", "connected_components", "classify"};
+static const char* counterNames[NUM_PROFILE_COUNTERS] = {"images", "contours_found", "contours_over_100_points",
+                                                         "ellipses_fitted", "ellipses_rejected", "coins_classified"};
+
+thread_local StageProfiler* StageProfiler::currentProfiler = 0;
+
+/*******************************************************************************************************************//**
+ * @brief Class constructor
+ * @param[in] origin tick count the trace starts at, the same for every profiler of a run
+ * @param[in] tracing true to keep an event for every timed stage, for writeTrace()
+ * @param[in] thread id of the thread in the trace
+ **********************************************************************************************************************/
+StageProfiler::StageProfiler(int64 origin, bool tracing, int thread) : origin(origin), tracing(tracing), thread(thread)
+{
+    std::fill(calls, calls + NUM_PROFILE_STAGES, 0);
+    std::fill(ticks, ticks + NUM_PROFILE_STAGES, 0);
+    std::fill(maxTicks, maxTicks + NUM_PROFILE_STAGES, 0);
+    std::fill(counters, counters + NUM_PROFILE_COUNTERS, 0);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Empty profiler for another thread of the same run, to be merged back into this one
+ * @param[in] thread id of the thread in the trace
+ * @return a profiler with the same trace origin and tracing setting as this one
+ **********************************************************************************************************************/
+StageProfiler StageProfiler::forThread(int thread) const
+{
+    return StageProfiler(origin, tracing, thread);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Make a profiler the one the calling thread's timers and counts go to
+ * @param[in] profiler the profiler, which has to outlive its use, or NULL to stop profiling
+ **********************************************************************************************************************/
+void StageProfiler::setCurrent(StageProfiler* profiler)
+{
+    currentProfiler = profiler;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Add one run of a stage
+ * @param[in] stage the stage
+ * @param[in] start tick count when it started
+ * @param[in] end tick count when it ended
+ **********************************************************************************************************************/
+void StageProfiler::record(ProfileStage stage, int64 start, int64 end)
+{
+    calls[stage]++;
+    ticks[stage] += end - start;
+    maxTicks[stage] = std::max(maxTicks[stage], end - start);
+    if(tracing)
+    {
+        Event event = {stage, thread, start, end};
+        events.push_back(event);
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Add the times, counts and events of another profiler to this one
+ * @param[in] other profiler of another thread of the same run
+ **********************************************************************************************************************/
+void StageProfiler::merge(const StageProfiler &other)
+{
+    for(int i = 0; i < NUM_PROFILE_STAGES; i++)
+    {
+        calls[i] += other.calls[i];
+        ticks[i] += other.ticks[i];
+        maxTicks[i] = std::max(maxTicks[i], other.maxTicks[i]);
+    }
+    for(int i = 0; i < NUM_PROFILE_COUNTERS; i++) counters[i] += other.counters[i];
+    events.insert(events.end(), other.events.begin(), other.events.end());
+}
+
+/*******************************************************************************************************************//**
+ * @brief Write the calls, total, mean and longest time of every stage and every counter as one JSON document
+ * @param[out] out stream to write to
+ **********************************************************************************************************************/
+void StageProfiler::writeJson(std::ostream& out) const
+{
+    double msPerTick = 1000.0 / cv::getTickFrequency();
+    out << "{\n  \"stages\": {\n";
+    for(int i = 0; i < NUM_PROFILE_STAGES; i++)
+    {
+        out << "    \"" << stageNames[i] << "\": {\"calls\": " << calls[i] << ", \"total_ms\": " << ticks[i] * msPerTick
+            << ", \"mean_ms\": " << (calls[i] > 0 ? ticks[i] * msPerTick / calls[i] : 0) << ", \"max_ms\": "
+            << maxTicks[i] * msPerTick << "}" << (i + 1 < NUM_PROFILE_STAGES ? "," : "") << "\n";
+    }
+    out << "  },\n  \"counters\": {\n";
+    for(int i = 0; i < NUM_PROFILE_COUNTERS; i++)
+    {
+        out << "    \"" << counterNames[i] << "\": " << counters[i] << (i + 1 < NUM_PROFILE_COUNTERS ? "," : "")
+            << "\n";
+    }
+    out << "  }\n}\n";
+}
+
+/*******************************************************************************************************************//**
+ * @brief Write every kept event in the Chrome trace event format, for chrome://tracing or Perfetto
+ * @param[out] out stream to write to
+ **********************************************************************************************************************/
+void StageProfiler::writeTrace(std::ostream& out) const
+{
+    double usPerTick = 1000000.0 / cv::getTickFrequency();
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    for(size_t i = 0; i < events.size(); i++)
+    {
+        const Event& e = events[i];
+        out << "  {\"name\": \"" << stageNames[e.stage] << "\", \"cat\": \"lab2\", \"ph\": \"X\", \"pid\": 1, "
+            << "\"tid\": " << e.thread << ", \"ts\": " << (e.start - origin) * usPerTick << ", \"dur\": "
+            << (e.end - e.start) * usPerTick << "}" << (i + 1 < events.size() ? "," : "") << "\n";
+    }
+    out << "]}\n";
+}
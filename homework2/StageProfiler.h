@@ -0,0 +1,121 @@
+/*******************************************************************************************************************//**
+ * @file StageProfiler.h
+ * @brief Header file for the StageProfiler and StageTimer classes
+ *
+ * These classes time the stages of lab2 and count what each stage produced, for a JSON summary or a Chrome trace
+ **********************************************************************************************************************/
+
+#ifndef STAGEPROFILER_H
+#define STAGEPROFILER_H
+
+#include <ostream>
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+// the timed stages, each named in StageProfiler.cpp
+enum ProfileStage {profile_decode, profile_gray, profile_pyramid, profile_edges, profile_contours, profile_tiles,
+                   profile_fit, profile_reject, profile_hough, profile_blobs, profile_classify};
+#define NUM_PROFILE_STAGES 11
+
+// the counted results
+enum ProfileCounter {counter_images, counter_contours, counter_contours_fittable, counter_ellipses_fitted,
+                     counter_ellipses_rejected, counter_coins};
+#define NUM_PROFILE_COUNTERS 6
+
+/*******************************************************************************************************************//**
+ * @class StageProfiler
+ *
+ * @brief Time spent in every stage and counts of what the stages produced, for the images of one thread
+ *
+ * A thread profiles by making its profiler current. The StageTimers and counts in the pipeline then go to it, while
+ * with no profiler current they cost a check of a thread local pointer and nothing else. Each thread has a profiler
+ * of its own, so nothing is locked, and the profilers of a batch are merged once every thread is done. Trace events,
+ * one per timed stage, are only kept when asked for.
+ **********************************************************************************************************************/
+class StageProfiler
+{
+private:
+
+    struct Event
+    {
+        int stage;
+        int thread;
+        int64 start;
+        int64 end;
+    };
+
+    int64 origin;                   // tick count trace times are measured from, shared by the profilers of a run
+    bool tracing;
+    int thread;                     // trace thread id
+    int calls[NUM_PROFILE_STAGES];
+    int64 ticks[NUM_PROFILE_STAGES];
+    int64 maxTicks[NUM_PROFILE_STAGES];
+    long counters[NUM_PROFILE_COUNTERS];
+    std::vector<Event> events;
+
+    static thread_local StageProfiler* currentProfiler;
+
+public:
+
+    // constructors
+    StageProfiler(int64 origin, bool tracing, int thread);
+    StageProfiler forThread(int thread) const;
+
+    // profiling
+    static StageProfiler* current();
+    static void setCurrent(StageProfiler* profiler);
+    static void count(ProfileCounter counter, long n = 1);
+    void record(ProfileStage stage, int64 start, int64 end);
+    void merge(const StageProfiler &other);
+
+    // output
+    void writeJson(std::ostream& out) const;
+    void writeTrace(std::ostream& out) const;
+};
+
+/*******************************************************************************************************************//**
+ * @class StageTimer
+ *
+ * @brief Times the scope it is declared in as one stage, for the current profiler if there is one
+ **********************************************************************************************************************/
+class StageTimer
+{
+private:
+
+    StageProfiler* profiler;
+    ProfileStage stage;
+    int64 start;
+
+public:
+
+    StageTimer(ProfileStage stage) : profiler(StageProfiler::current()), stage(stage),
+        start(profiler ? cv::getTickCount() : 0)
+    {
+    }
+
+    ~StageTimer()
+    {
+        if(profiler) profiler->record(stage, start, cv::getTickCount());
+    }
+};
+
+/*******************************************************************************************************************//**
+ * @brief Profiler of the calling thread
+ * @return the profiler, or NULL when the thread is not profiling
+ **********************************************************************************************************************/
+inline StageProfiler* StageProfiler::current()
+{
+    return currentProfiler;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Add to a counter of the calling thread's profiler, if it has one
+ * @param[in] counter the counter
+ * @param[in] n amount to add
+ **********************************************************************************************************************/
+inline void StageProfiler::count(ProfileCounter counter, long n)
+{
+    if(currentProfiler) currentProfiler->counters[counter] += n;
+}
+
+#endif // STAGEPROFILER_H
@@ -0,0 +1,99 @@
+/*******************************************************************************************************************//**
+ * @file SyntheticCoinVideo.cpp
+ * @brief Implementation of the SyntheticCoinVideo class
+ *
+ * This class draws video frames of moving coins whose true count is known, for testing the video mode
+ **********************************************************************************************************************/
+
+#include "SyntheticCoinVideo.h"
+
+#include <cmath>
+#include <algorithm>
+
+/*******************************************************************************************************************//**
+ * @brief Class constructor
+ *
+ * Places two coins of random type in as many lanes as fit, each lane moving at its own random speed
+ *
+ * @param[in] size size of every frame
+ * @param[in] counter counter whose model gives the size of each coin
+ * @param[in] frames number of frames before read() reports the end of the video
+ **********************************************************************************************************************/
+SyntheticCoinVideo::SyntheticCoinVideo(const cv::Size &size, const CoinCounter &counter, int frames) : size(size),
+    frames(frames), frameIndex(0)
+{
+    // the model holds the diagonal of the box around each coin, as CoinCounter::classify measures it
+    double diameters[NUM_COIN_TYPES];
+    double maxDiameter = 0;
+    for(int coinInt = penny; coinInt != quarter+1; coinInt++) {
+        diameters[coinInt] = counter.getModelDiameter(coinInt) / std::sqrt(2.0);
+        maxDiameter = std::max(maxDiameter, diameters[coinInt]);
+    }
+    int laneHeight = std::max(1, (int) (maxDiameter * 1.3));
+    int lanes = std::max(1, size.height / laneHeight);
+
+    std::fill(coinCount, coinCount + NUM_COIN_TYPES, 0);
+    cv::RNG rand(12345);
+    for(int lane = 0; lane < lanes; lane++)
+    {
+        float velocity = rand.uniform(2.f, 8.f) * (lane % 2 ? -1 : 1);
+        for(int k = 0; k < 2; k++)
+        {
+            Coin coin;
+            coin.coinType = rand.uniform(penny, quarter+1);
+            coin.diameter = diameters[coin.coinType];
+            coin.center = cv::Point2f(size.width * (0.25f + 0.5f * k), laneHeight * (lane + 0.5f));
+            coin.velocity = velocity;
+            coins.push_back(coin);
+            coinCount[coin.coinType]++;
+        }
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Draw the next frame and move the coins on
+ * @param[out] frame BGR frame
+ * @return false once every frame has been read
+ **********************************************************************************************************************/
+bool SyntheticCoinVideo::read(cv::Mat &frame)
+{
+    if(frameIndex >= frames) return false;
+    frameIndex++;
+
+    frame.create(size, CV_8UC3);
+    frame.setTo(cv::Scalar(70, 80, 90));
+    for(size_t i = 0; i < coins.size(); i++)
+    {
+        const Coin& coin = coins[i];
+        cv::Scalar color = (coin.coinType == penny) ? cv::Scalar(60, 100, 180) : cv::Scalar(175, 175, 170);
+        cv::Point center(cvRound(coin.center.x), cvRound(coin.center.y));
+        cv::circle(frame, center, cvRound(coin.diameter / 2), color, -1, cv::LINE_AA);
+        cv::circle(frame, center, cvRound(coin.diameter * 0.38), color * 0.6, 3, cv::LINE_AA);
+    }
+
+    // the two coins of a lane turn around together as soon as either would leave the frame
+    for(size_t i = 0; i + 1 < coins.size(); i += 2)
+    {
+        Coin& a = coins[i];
+        Coin& b = coins[i + 1];
+        float left = std::min(a.center.x - a.diameter / 2, b.center.x - b.diameter / 2);
+        float right = std::max(a.center.x + a.diameter / 2, b.center.x + b.diameter / 2);
+        if(left + a.velocity < 0 || right + a.velocity > size.width) a.velocity = b.velocity = -a.velocity;
+        a.center.x += a.velocity;
+        b.center.x += b.velocity;
+    }
+    return true;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Dollar value of the coins in every frame
+ * @return the true total
+ **********************************************************************************************************************/
+double SyntheticCoinVideo::getTotal() const
+{
+    double total = 0;
+    for(int coinInt = penny; coinInt != quarter+1; coinInt++) {
+        total += CoinCounter::coinValue(coinInt) * coinCount[coinInt];
+    }
+    return total;
+}
@@ -0,0 +1,54 @@
+/*******************************************************************************************************************//**
+ * @file SyntheticCoinVideo.h
+ * @brief Header file for the SyntheticCoinVideo class
+ *
+ * This class draws video frames of moving coins whose true count is known, for testing the video mode
+ **********************************************************************************************************************/
+
+#ifndef SYNTHETICCOINVIDEO_H
+#define SYNTHETICCOINVIDEO_H
+
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "CoinCounter.h"
+
+/*******************************************************************************************************************//**
+ * @class SyntheticCoinVideo
+ *
+ * @brief Coins of the model's sizes sliding back and forth across a plain background
+ *
+ * The coins move in horizontal lanes, two to a lane, and each lane moves as one and bounces off the sides, so coins
+ * never overlap or leave the frame and every frame holds every coin. Each coin has a darker ring inside its rim, like
+ * the relief of a real coin, which the counter has to recognize as inside the coin.
+ **********************************************************************************************************************/
+class SyntheticCoinVideo
+{
+private:
+
+    struct Coin
+    {
+        cv::Point2f center;
+        float velocity;             // pixels per frame, along x
+        int coinType;
+        double diameter;
+    };
+
+    cv::Size size;
+    std::vector<Coin> coins;
+    int frames;
+    int frameIndex;
+    int coinCount[NUM_COIN_TYPES];
+
+public:
+
+    // constructors
+    SyntheticCoinVideo(const cv::Size &size, const CoinCounter &counter, int frames);
+
+    // frames
+    bool read(cv::Mat &frame);
+
+    // ground truth
+    double getTotal() const;
+};
+
+#endif // SYNTHETICCOINVIDEO_H
@@ -0,0 +1,181 @@
+/*******************************************************************************************************************//**
+ * @file TiledContourFinder.cpp
+ * @brief Implementation of the TiledContourFinder class
+ *
+ * This class finds the edges and contours of a large image in overlapping tiles, several tiles at once
+ **********************************************************************************************************************/
+
+#include "TiledContourFinder.h"
+#include "StageProfiler.h"
+
+#include <map>
+#include <algorithm>
+
+/*******************************************************************************************************************//**
+ * @class TiledContourFinder::TileBody
+ *
+ * @brief Finds the contours of a range of tiles, one parallel_for_ stripe
+ **********************************************************************************************************************/
+class TiledContourFinder::TileBody : public cv::ParallelLoopBody
+{
+private:
+
+    TiledContourFinder &finder;
+
+public:
+
+    explicit TileBody(TiledContourFinder &finder) : finder(finder)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        // the tiles are timed as a whole by the caller, not stripe by stripe on whichever thread is profiling
+        StageProfiler* profiler = StageProfiler::current();
+        StageProfiler::setCurrent(NULL);
+        for(int t = range.start; t < range.end; t++) finder.findInTile(finder.tiles[t]);
+        StageProfiler::setCurrent(profiler);
+    }
+};
+
+/*******************************************************************************************************************//**
+ * @brief Order contour keys, so they can index a map
+ * @param[in] other another key
+ * @return true if this key comes first
+ **********************************************************************************************************************/
+bool TiledContourFinder::ContourKey::operator<(const ContourKey &other) const
+{
+    const int a[7] = {x, y, width, height, points, startX, startY};
+    const int b[7] = {other.x, other.y, other.width, other.height, other.points, other.startX, other.startY};
+    return std::lexicographical_compare(a, a + 7, b, b + 7);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Class constructor
+ * @param[in] counter counter whose edge detection the tiles use
+ * @param[in] tileSize width and height of the share of the image each tile keeps the contours of
+ **********************************************************************************************************************/
+TiledContourFinder::TiledContourFinder(const CoinCounter &counter, int tileSize) : counter(counter),
+    tileSize(std::max(1, tileSize))
+{
+}
+
+/*******************************************************************************************************************//**
+ * @brief Key of a contour, the same in every tile the contour is complete in
+ * @param[in] contour the contour, in image coordinates
+ * @param[in] box its bounding box
+ * @return the key
+ **********************************************************************************************************************/
+TiledContourFinder::ContourKey TiledContourFinder::keyOf(const std::vector<cv::Point> &contour, const cv::Rect &box)
+{
+    ContourKey key = {box.x, box.y, box.width, box.height, (int) contour.size(), contour[0].x, contour[0].y};
+    return key;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Find the edges and contours of one tile, keeping the complete contours centered in its core
+ * @param[in,out] tile tile whose contours, keys and parent keys are set
+ **********************************************************************************************************************/
+void TiledContourFinder::findInTile(Tile &tile) const
+{
+    cv::Mat edges;
+    counter.findEdges(imageGray(tile.area), edges);
+    std::vector<std::vector<cv::Point> > contours;
+    std::vector<cv::Vec4i> hierarchy;
+    cv::findContours(edges, contours, hierarchy, cv::RETR_TREE, cv::CHAIN_APPROX_SIMPLE, tile.area.tl());
+
+    // a contour touching a side of the tile that is not a side of the image may go on in the next tile
+    int left = tile.area.x > 0 ? tile.area.x : -1;
+    int top = tile.area.y > 0 ? tile.area.y : -1;
+    int right = tile.area.br().x < imageGray.cols ? tile.area.br().x : imageGray.cols + 1;
+    int bottom = tile.area.br().y < imageGray.rows ? tile.area.br().y : imageGray.rows + 1;
+    std::vector<cv::Rect> boxes(contours.size());
+    std::vector<bool> complete(contours.size());
+    for(size_t i = 0; i < contours.size(); i++)
+    {
+        cv::Rect& box = boxes[i];
+        box = cv::boundingRect(contours[i]);
+        complete[i] = box.x > left && box.y > top && box.br().x < right && box.br().y < bottom;
+    }
+
+    for(size_t i = 0; i < contours.size(); i++)
+    {
+        const cv::Rect& box = boxes[i];
+        if(!complete[i] || !tile.core.contains(cv::Point(box.x + box.width / 2, box.y + box.height / 2))) continue;
+
+        // a parent of a complete contour is cut only if every contour around it is too
+        int parent = hierarchy[i][3];
+        bool hasParent = parent >= 0 && complete[parent];
+        tile.contours.push_back(contours[i]);
+        tile.keys.push_back(keyOf(contours[i], box));
+        tile.parentKeys.push_back(hasParent ? keyOf(contours[parent], boxes[parent]) : ContourKey());
+        tile.hasParent.push_back(hasParent);
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Find the contours of a gray image as CoinCounter::findEdges and CoinCounter::findContours would
+ *
+ * The contours come out grouped by tile rather than in the order findContours gives, and the tree links each contour
+ * to its parent as seen in the tile that kept it.
+ *
+ * @param[in] imageGray gray image of the coins
+ * @param[out] contours every contour that can be fitted with a coin
+ * @param[out] hierarchy next, previous, first child and parent of every contour, -1 where there is none
+ **********************************************************************************************************************/
+void TiledContourFinder::find(const cv::Mat &imageGray, std::vector<std::vector<cv::Point> > &contours,
+                              std::vector<cv::Vec4i> &hierarchy)
+{
+    this->imageGray = imageGray;
+    tiles.clear();
+    cv::Rect image(0, 0, imageGray.cols, imageGray.rows);
+    for(int y = 0; y < imageGray.rows; y += tileSize)
+    {
+        for(int x = 0; x < imageGray.cols; x += tileSize)
+        {
+            Tile tile;
+            tile.core = cv::Rect(x, y, tileSize, tileSize) & image;
+            tile.area = cv::Rect(x - TILE_OVERLAP, y - TILE_OVERLAP, tileSize + 2 * TILE_OVERLAP,
+                                 tileSize + 2 * TILE_OVERLAP) & image;
+            tiles.push_back(tile);
+        }
+    }
+    cv::parallel_for_(cv::Range(0, (int) tiles.size()), TileBody(*this));
+
+    contours.clear();
+    std::map<ContourKey, int> index;
+    for(size_t t = 0; t < tiles.size(); t++)
+    {
+        for(size_t i = 0; i < tiles[t].contours.size(); i++)
+        {
+            index[tiles[t].keys[i]] = (int) contours.size();
+            contours.push_back(std::vector<cv::Point>());
+            contours.back().swap(tiles[t].contours[i]);
+        }
+    }
+
+    std::vector<int> parents;
+    for(size_t t = 0; t < tiles.size(); t++)
+    {
+        for(size_t i = 0; i < tiles[t].keys.size(); i++)
+        {
+            std::map<ContourKey, int>::const_iterator found = index.end();
+            if(tiles[t].hasParent[i]) found = index.find(tiles[t].parentKeys[i]);
+            parents.push_back(found != index.end() ? found->second : -1);
+        }
+    }
+
+    // children are linked in reverse so each list ends up in contour order
+    hierarchy.assign(contours.size(), cv::Vec4i(-1, -1, -1, -1));
+    int firstRoot = -1;
+    for(int i = (int) contours.size() - 1; i >= 0; i--)
+    {
+        int parent = parents[i];
+        int& first = parent >= 0 ? hierarchy[parent][2] : firstRoot;
+        hierarchy[i][0] = first;
+        if(first >= 0) hierarchy[first][1] = i;
+        hierarchy[i][3] = parent;
+        first = i;
+    }
+    tiles.clear();
+}
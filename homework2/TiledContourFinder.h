@@ -0,0 +1,82 @@
+/*******************************************************************************************************************//**
+ * @file TiledContourFinder.h
+ * @brief Header file for the TiledContourFinder class
+ *
+ * This class finds the edges and contours of a large image in overlapping tiles, several tiles at once
+ **********************************************************************************************************************/
+
+#ifndef TILEDCONTOURFINDER_H
+#define TILEDCONTOURFINDER_H
+
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "CoinCounter.h"
+
+// pixels each tile reaches past its share of the image on every side, the largest ellipse that can be a coin
+#define TILE_OVERLAP 1000
+// smallest tile side, as a smaller core would leave a tile with more than nine times the pixels it keeps contours of
+#define TILE_MIN_SIZE TILE_OVERLAP
+
+/*******************************************************************************************************************//**
+ * @class TiledContourFinder
+ *
+ * @brief Canny and findContours run per tile on a thread pool, with the contours of all tiles stitched into one tree
+ *
+ * The image is split into a grid of square cores, and each tile is its core grown by TILE_OVERLAP on every side. A
+ * tile keeps only its complete contours, the ones not touching a side where it was cut from the image, and of those
+ * only the ones whose bounding box is centered in its core. Every contour less than twice TILE_OVERLAP across is
+ * therefore complete in exactly one tile that keeps it. That is twice the 1000 pixel limit on a coin's ellipse, which
+ * leaves room for a contour reaching past the ellipse fitted to it. It is traced there from the same edges as in the
+ * whole image, as long as Canny's hysteresis does not connect it to edges further than TILE_OVERLAP away.
+ *
+ * A contour's parent may be kept by another tile, so each tile notes the parent it saw by its bounding box, length and
+ * first point, and the parents are looked up among all the kept contours once every tile is done. A parent that is
+ * kept nowhere is too large to be kept, at least twice TILE_OVERLAP across, so a closed parent is far too large to be
+ * fitted with a coin and does not hide what is inside it in the whole image either. Its child becomes a root and is
+ * fitted just as it is without tiles. A parent cut in the child's tile but kept by another is still found by its key.
+ **********************************************************************************************************************/
+class TiledContourFinder
+{
+private:
+
+    // identifies the same contour traced in two tiles
+    struct ContourKey
+    {
+        int x, y, width, height;
+        int points;
+        int startX, startY;
+
+        bool operator<(const ContourKey &other) const;
+    };
+
+    struct Tile
+    {
+        cv::Rect core;
+        cv::Rect area;                          // core grown by TILE_OVERLAP, within the image
+        std::vector<std::vector<cv::Point> > contours;
+        std::vector<ContourKey> keys;
+        std::vector<ContourKey> parentKeys;
+        std::vector<bool> hasParent;
+    };
+
+    class TileBody;
+
+    const CoinCounter &counter;
+    int tileSize;
+    cv::Mat imageGray;
+    std::vector<Tile> tiles;
+
+    static ContourKey keyOf(const std::vector<cv::Point> &contour, const cv::Rect &box);
+    void findInTile(Tile &tile) const;
+
+public:
+
+    // constructors
+    TiledContourFinder(const CoinCounter &counter, int tileSize);
+
+    // processing
+    void find(const cv::Mat &imageGray, std::vector<std::vector<cv::Point> > &contours,
+              std::vector<cv::Vec4i> &hierarchy);
+};
+
+#endif // TILEDCONTOURFINDER_H
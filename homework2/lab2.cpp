@@ -1,220 +1,639 @@
 //
 //    Copyright 2018 Christopher D. McMurrough
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 #include "opencv2/opencv.hpp"
+#include "CoinCounter.h"
+#include "CoinDetector.h"
+#include "CoinPipeline.h"
+#include "CoinTracker.h"
+#include "SyntheticCoinVideo.h"
+#include "StageProfiler.h"
 
 #define NUM_COMNMAND_LINE_ARGUMENTS 1
 
-int main(int argc, char **argv)
-{
-    cv::Mat imageIn;
-    double model[5];
+// passes over the images the benchmark times every engine for
+#define BENCHMARK_RUNS 5
+
+// one line of the batch report
+struct BatchResult {
+    std::string path;
+    bool ok;
+    cv::Size size;
+    int coinCount[NUM_COIN_TYPES];
+    double total;
+    int skippedFits;
+    double decodeMs;
+    double countMs;
+};
+
+// work shared by the batch threads
+struct BatchJob {
+    const CoinDetector* detector;
+    std::vector<std::string> inputs;
+    std::vector<BatchResult> results;       // one per input, each written only by the thread that claimed it
+    std::atomic<size_t> next;
+};
 
-    if(argc != NUM_COMNMAND_LINE_ARGUMENTS + 2)
+/*******************************************************************************************************************//**
+ * @brief batch thread, takes the next unclaimed image until none are left
+ *
+ * Each thread decodes and counts its own image, so decoding one image overlaps counting another without any hand-off
+ * between threads.
+ *
+ * @param[in] job images to count and the slots their results go to
+ * @param[in] profiler profiler of this thread, NULL when not profiling
+ **********************************************************************************************************************/
+static void batchWorker(BatchJob* job, StageProfiler* profiler)
+{
+    StageProfiler::setCurrent(profiler);
+    for(size_t i = job->next++; i < job->inputs.size(); i = job->next++)
     {
-        std::printf("USAGE: %s <image_path> <model>\n", argv[0]);
-        return 0;
+        BatchResult& result = job->results[i];
+        result.path = job->inputs[i];
+        result.ok = false;
+        std::fill(result.coinCount, result.coinCount + NUM_COIN_TYPES, 0);
+        result.total = 0;
+        result.skippedFits = 0;
+        result.countMs = 0;
+
+        int64 start = cv::getTickCount();
+        cv::Mat imageIn = cv::imread(result.path, CV_LOAD_IMAGE_COLOR);
+        int64 decoded = cv::getTickCount();
+        result.decodeMs = (decoded - start) * 1000.0 / cv::getTickFrequency();
+        if(profiler) profiler->record(profile_decode, start, decoded);
+        if(!imageIn.data) continue;
+        StageProfiler::count(counter_images);
+
+        CoinResult coins = job->detector->count(imageIn);
+        result.countMs = (cv::getTickCount() - decoded) * 1000.0 / cv::getTickFrequency();
+        result.ok = true;
+        result.size = imageIn.size();
+        std::copy(coins.coinCount, coins.coinCount + NUM_COIN_TYPES, result.coinCount);
+        result.total = coins.total;
+        result.skippedFits = coins.skippedFits;
     }
-    else
+}
+
+/*******************************************************************************************************************//**
+ * @brief writes the batch results as CSV, one row per image
+ * @param[out] out stream to write to
+ * @param[in] results results in input order
+ **********************************************************************************************************************/
+static void writeCsv(std::ostream& out, const std::vector<BatchResult>& results)
+{
+    out << "path,ok,width,height";
+    for(int coinInt = penny; coinInt != quarter+1; coinInt++) out << "," << CoinCounter::coinName(coinInt);
+    out << ",total,skipped_fits,decode_ms,count_ms\n";
+    for(size_t i = 0; i < results.size(); i++)
     {
-        imageIn = cv::imread(argv[1], CV_LOAD_IMAGE_COLOR);
+        const BatchResult& r = results[i];
+        out << r.path << "," << (r.ok ? 1 : 0) << "," << r.size.width << "," << r.size.height;
+        for(int coinInt = penny; coinInt != quarter+1; coinInt++) out << "," << r.coinCount[coinInt];
+        out << "," << r.total << "," << r.skippedFits << "," << r.decodeMs << "," << r.countMs << "\n";
+    }
+}
 
-        if(!imageIn.data)
+/*******************************************************************************************************************//**
+ * @brief quotes a string for JSON, escaping quotes, backslashes and control characters
+ * @param[in] text string to quote, written byte for byte otherwise, so UTF-8 paths stay UTF-8
+ * @return the quoted string
+ **********************************************************************************************************************/
+static std::string jsonString(const std::string& text)
+{
+    std::string quoted = "\"";
+    for(size_t i = 0; i < text.size(); i++)
+    {
+        unsigned char c = text[i];
+        if(c == '"' || c == '\\') quoted += std::string("\\") + (char) c;
+        else if(c == '\n') quoted += "\\n";
+        else if(c == '\t') quoted += "\\t";
+        else if(c == '\r') quoted += "\\r";
+        else if(c < 0x20)
         {
-            std::cout << "Error while opening file " << argv[1] << std::endl;
-            return 0;
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
         }
+        else quoted += (char) c;
+    }
+    return quoted + "\"";
+}
 
-        std::ifstream in(argv[2]);
-
-        if(!in) {
-            std::cout << "Error opening model file " << argv[2] << std::endl;
-            return 0;
-        }
-        
-        std::string str;
-        int iter = 0;
-        while(std::getline(in, str)) {
-            model[iter] = stod(str);
-            iter++;
+/*******************************************************************************************************************//**
+ * @brief writes the batch results and overall throughput as one JSON document
+ * @param[out] out stream to write to
+ * @param[in] results results in input order
+ * @param[in] threads number of batch threads
+ * @param[in] seconds wall time of the whole batch
+ **********************************************************************************************************************/
+static void writeJson(std::ostream& out, const std::vector<BatchResult>& results, int threads, double seconds)
+{
+    out << "{\n  \"threads\": " << threads << ",\n  \"seconds\": " << seconds << ",\n  \"images_per_second\": "
+        << (seconds > 0 ? results.size() / seconds : 0) << ",\n  \"images\": [\n";
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const BatchResult& r = results[i];
+        out << "    {\"path\": " << jsonString(r.path) << ", \"ok\": " << (r.ok ? "true" : "false") << ", "
+            << "\"width\": " << r.size.width << ", \"height\": " << r.size.height << ", \"coins\": {";
+        for(int coinInt = penny; coinInt != quarter+1; coinInt++)
+        {
+            out << (coinInt == penny ? "" : ", ") << "\"" << CoinCounter::coinName(coinInt) << "\": "
+                << r.coinCount[coinInt];
         }
+        out << "}, \"total\": " << r.total << ", \"skipped_fits\": " << r.skippedFits << ", \"decode_ms\": "
+            << r.decodeMs << ", \"count_ms\": " << r.countMs << "}" << (i + 1 < results.size() ? "," : "") << "\n";
     }
+    out << "  ]\n}\n";
+}
 
-    std::cout << "image width: " << imageIn.size().width << std::endl;
-    std::cout << "image height: " << imageIn.size().height << std::endl;
-    std::cout << "image channels: " << imageIn.channels() << std::endl;
+/*******************************************************************************************************************//**
+ * @brief lists the images of a batch
+ * @param[in] source a directory, whose every file is taken, or a text file with one image path per line
+ * @param[out] inputs the image paths, sorted for a directory and in file order for a list
+ * @return true if the directory or list could be read
+ **********************************************************************************************************************/
+static bool listInputs(const std::string& source, std::vector<std::string>& inputs)
+{
+    struct stat info;
+    if(stat(source.c_str(), &info) != 0) return false;
+    if(S_ISDIR(info.st_mode))
+    {
+        std::vector<cv::String> files;
+        cv::glob(source + "/*", files, false);
+        inputs.assign(files.begin(), files.end());
+        return true;
+    }
+    std::ifstream in(source.c_str());
+    std::string line;
+    while(std::getline(in, line))
+    {
+        if(!line.empty()) inputs.push_back(line);
+    }
+    return true;
+}
+
+/*******************************************************************************************************************//**
+ * @brief counts the coins in every image of a directory or list without opening any windows
+ * @param[in] source directory of images or file listing one image per line
+ * @param[in] detector engine that finds the coins, shared by every thread
+ * @param[in] threads number of images counted at once, 0 for one per core
+ * @param[in] format "csv" or "json"
+ * @param[in] outPath file the report is written to, standard output when empty
+ * @param[in,out] profile profiler the threads' profiles are merged into, NULL when not profiling
+ * @return return code (0 when every image was counted)
+ **********************************************************************************************************************/
+static int runBatch(const std::string& source, const CoinDetector& detector, int threads, const std::string& format,
+                    const std::string& outPath, StageProfiler* profile)
+{
+    BatchJob job;
+    if(!listInputs(source, job.inputs))
+    {
+        std::cout << "Error opening batch input " << source << std::endl;
+        return 1;
+    }
+    if(job.inputs.empty())
+    {
+        std::cout << "No images found in " << source << std::endl;
+        return 1;
+    }
+    job.detector = &detector;
+    job.results.resize(job.inputs.size());
+    job.next = 0;
 
-    cv::Mat imageGray;
-    cv::cvtColor(imageIn, imageGray, cv::COLOR_BGR2GRAY);
+    if(threads <= 0) threads = cv::getNumberOfCPUs();
+    threads = std::max(1, std::min(threads, (int) job.inputs.size()));
+    // the pool already keeps every core busy, OpenCV's own loops only get what is left over
+    cv::setNumThreads(std::max(1, cv::getNumberOfCPUs() / threads));
 
-    cv::Mat imageNormalized;
-    cv::normalize(imageGray, imageNormalized, 0, 255);
+    // each thread profiles on its own and the profiles are added up once they are all done
+    std::vector<StageProfiler> profilers;
+    for(int i = 0; i < threads && profile; i++) profilers.push_back(profile->forThread(i + 1));
 
-    cv::Mat imageEqualized;
-    cv::equalizeHist(imageNormalized, imageEqualized);
+    int64 start = cv::getTickCount();
+    std::vector<std::thread> pool;
+    for(int i = 0; i < threads; i++) pool.push_back(std::thread(batchWorker, &job, profile ? &profilers[i] : NULL));
+    for(size_t i = 0; i < pool.size(); i++) pool[i].join();
+    double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    for(size_t i = 0; i < profilers.size(); i++) profile->merge(profilers[i]);
 
-    cv::Mat imageEdges;
-    const double cannyThreshold1 = 100;
-    const double cannyThreshold2 = 200;
-    const int cannyAperture = 3;
-    cv::Canny(imageGray, imageEdges, cannyThreshold1, cannyThreshold2, cannyAperture);
+    std::ofstream file;
+    if(!outPath.empty())
+    {
+        file.open(outPath.c_str());
+        if(!file)
+        {
+            std::cout << "Error opening output file " << outPath << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = outPath.empty() ? std::cout : file;
+    if(format == "json") writeJson(out, job.results, threads, seconds);
+    else writeCsv(out, job.results);
 
-    std::vector<std::vector<cv::Point> > contours;
-    cv::findContours(imageEdges, contours, cv::RETR_TREE, cv::CHAIN_APPROX_SIMPLE, cv::Point(0, 0));
+    int failures = 0;
+    for(size_t i = 0; i < job.results.size(); i++)
+    {
+        if(!job.results[i].ok)
+        {
+            std::cerr << "Error while opening file " << job.results[i].path << std::endl;
+            failures++;
+        }
+    }
+    std::cerr << "Counted " << job.results.size() - failures << " of " << job.results.size() << " images in " << seconds
+              << " s (" << job.results.size() / seconds << " images/s) with " << threads << " threads" << std::endl;
+    return failures > 0 ? 1 : 0;
+}
 
-    cv::Mat imageContours = cv::Mat::zeros(imageEdges.size(), CV_8UC3);
-    cv::RNG rand(12345);
-    for(int i = 0; i < contours.size(); i++)
+/*******************************************************************************************************************//**
+ * @brief reads the known coin counts of the benchmark images
+ *
+ * Each line holds an image file name followed by its number of pennies, nickels, dimes and quarters
+ *
+ * @param[in] path the truth file
+ * @param[out] truth the counts of every image, by file name
+ * @return true if the file could be read
+ **********************************************************************************************************************/
+static bool loadTruth(const std::string& path, std::map<std::string, std::vector<int> >& truth)
+{
+    std::ifstream in(path.c_str());
+    if(!in) return false;
+    std::string line;
+    while(std::getline(in, line))
     {
-        cv::Scalar color = cv::Scalar(rand.uniform(0, 256), rand.uniform(0,256), rand.uniform(0,256));
-        cv::drawContours(imageContours, contours, i, color);
+        std::istringstream fields(line);
+        std::string name;
+        std::vector<int> counts(NUM_COIN_TYPES);
+        if(!(fields >> name)) continue;
+        for(int coinInt = penny; coinInt != quarter+1; coinInt++) fields >> counts[coinInt];
+        if(fields) truth[name] = counts;
     }
+    return true;
+}
 
-    std::vector<cv::RotatedRect> minAreaRectangles(contours.size());
-    for(int i = 0; i < contours.size(); i++)
+/*******************************************************************************************************************//**
+ * @brief times every engine on the same images and scores its counts against the known ones
+ *
+ * The images are decoded once up front, so only the engines are timed, and each engine counts every image once
+ * untimed before BENCHMARK_RUNS timed passes. An image's coin count is right when the engine found as many coins as it
+ * holds, and exact when every coin type was counted right.
+ *
+ * @param[in] source directory of images or file listing one image per line
+ * @param[in] counter counter with its model loaded, shared by the engines
+ * @param[in] engine the engine to benchmark, every engine when empty
+ * @param[in] truthPath file with the known counts of the images, no scoring when empty
+ * @return return code (0 when the images and truth could be read)
+ **********************************************************************************************************************/
+static int runBenchmark(const std::string& source, const CoinCounter& counter, const std::string& engine,
+                        const std::string& truthPath)
+{
+    std::vector<std::string> inputs;
+    if(!listInputs(source, inputs))
     {
-        minAreaRectangles[i] = cv::minAreaRect(contours[i]);
+        std::cout << "Error opening benchmark input " << source << std::endl;
+        return 1;
     }
-    
-    cv::Mat imageRectangles = cv::Mat::zeros(imageEdges.size(), CV_8UC3);
-    for(int i = 0; i < contours.size(); i++)
+    std::map<std::string, std::vector<int> > truth;
+    if(!truthPath.empty() && !loadTruth(truthPath, truth))
     {
-        cv::Scalar color = cv::Scalar(rand.uniform(0, 256), rand.uniform(0,256), rand.uniform(0,256));
-        cv::Point2f rectanglePoints[4];
-        minAreaRectangles[i].points(rectanglePoints);
-        for(int j = 0; j < 4; j++)
-        {
-            cv::line(imageRectangles, rectanglePoints[j], rectanglePoints[(j+1) % 4], color);
-        }
+        std::cout << "Error opening truth file " << truthPath << std::endl;
+        return 1;
     }
 
-    std::vector<cv::RotatedRect> fittedEllipses;
-    for(int i = 0; i < contours.size(); i++)
+    std::vector<cv::Mat> images;
+    std::vector<const std::vector<int>*> expected;
+    for(size_t i = 0; i < inputs.size(); i++)
     {
-        if(contours.at(i).size() > 100)
+        cv::Mat imageIn = cv::imread(inputs[i], CV_LOAD_IMAGE_COLOR);
+        if(!imageIn.data)
         {
-            fittedEllipses.push_back(cv::fitEllipse(contours[i]));
+            std::cerr << "Error while opening file " << inputs[i] << std::endl;
+            continue;
         }
+        std::string name = inputs[i].substr(inputs[i].find_last_of('/') + 1);
+        std::map<std::string, std::vector<int> >::const_iterator found = truth.find(name);
+        images.push_back(imageIn);
+        expected.push_back(found != truth.end() ? &found->second : NULL);
+    }
+    if(images.empty())
+    {
+        std::cout << "No images found in " << source << std::endl;
+        return 1;
     }
+    int scored = 0;
+    for(size_t i = 0; i < expected.size(); i++) if(expected[i]) scored++;
 
-    std::vector<cv::RotatedRect> normalEllipses;
-    for(int i = 0; i < fittedEllipses.size(); i++) {
-        if(fittedEllipses[i].size.height < 1000 && fittedEllipses[i].size.width < 1000) 
+    std::printf("%-10s %10s %10s %12s %12s %12s\n", "engine", "ms/image", "images/s", "count right", "exact",
+                "coin error");
+    for(int e = 0; e < NUM_DETECTOR_ENGINES; e++)
+    {
+        if(!engine.empty() && engine != CoinDetector::engineName(e)) continue;
+        CoinDetector* detector = CoinDetector::create(CoinDetector::engineName(e), counter);
+
+        int countRight = 0;
+        int exact = 0;
+        int coinError = 0;
+        for(size_t i = 0; i < images.size(); i++)
         {
-            std::cout << "Ellipse found with size: " << fittedEllipses[i].size << std::endl;
-            normalEllipses.push_back(fittedEllipses[i]);
-        }
-    }  
-
-    std::vector<cv::RotatedRect> coinEllipses;
-    for(int i = 0; i < normalEllipses.size(); i++) {
-        bool isInsideOtherEllipse = false;
-
-        cv::Point2f center_i = normalEllipses[i].center;
-        std::cout << "Ellipse " << i << " has center " << center_i << std::endl;
-        double size_i = normalEllipses[i].size.height * normalEllipses[i].size.width;
-        for(int j = 0; j < normalEllipses.size(); j++) {
-            if (i == j) continue;
-
-            cv::Point2f center_j = normalEllipses[j].center;
-            cv::Point2f pts[4];
-            normalEllipses[j].points(pts);
-            double distance = sqrt( pow((center_i.x - center_j.x), 2) + pow((center_i.y - center_j.y), 2) );
-            double radius = sqrt( pow((pts[2].x - pts[0].x), 2) + pow((pts[0].y - pts[2].y), 2) ) / 2.0;
-            double size_j = normalEllipses[j].size.height * normalEllipses[j].size.width;
-
-            if((distance < radius) && (size_i < size_j))
+            CoinResult coins = detector->count(images[i]);
+            if(!expected[i]) continue;
+            int found = 0, held = 0;
+            bool allRight = true;
+            for(int coinInt = penny; coinInt != quarter+1; coinInt++)
             {
-                std::cout << "Eliminating contained ellipse " << i << std::endl;
-                isInsideOtherEllipse = true;
+                found += coins.coinCount[coinInt];
+                held += (*expected[i])[coinInt];
+                if(coins.coinCount[coinInt] != (*expected[i])[coinInt]) allRight = false;
             }
+            if(found == held) countRight++;
+            if(allRight) exact++;
+            coinError += std::abs(found - held);
+        }
+
+        int64 start = cv::getTickCount();
+        for(int run = 0; run < BENCHMARK_RUNS; run++)
+        {
+            for(size_t i = 0; i < images.size(); i++) detector->count(images[i]);
+        }
+        double ms = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency() / (BENCHMARK_RUNS * images.size());
+
+        std::ostringstream countColumn, exactColumn, errorColumn;
+        if(scored > 0)
+        {
+            countColumn << countRight << "/" << scored;
+            exactColumn << exact << "/" << scored;
+            errorColumn << (double) coinError / scored;
         }
+        std::printf("%-10s %10.2f %10.1f %12s %12s %12s\n", detector->name(), ms, ms > 0 ? 1000.0 / ms : 0,
+                    countColumn.str().c_str(), exactColumn.str().c_str(), errorColumn.str().c_str());
+        delete detector;
+    }
+    return 0;
+}
 
-        if(!isInsideOtherEllipse) coinEllipses.push_back(normalEllipses[i]);
+/*******************************************************************************************************************//**
+ * @brief draws the coins over a frame in the colors of the ellipse window
+ * @param[in,out] frame BGR frame
+ * @param[in] coins coins found in the frame
+ **********************************************************************************************************************/
+static void drawCoins(cv::Mat& frame, const CoinResult& coins)
+{
+    static const cv::Scalar colors[NUM_COIN_TYPES] = {cv::Scalar(0,0,256), cv::Scalar(0,256,256), cv::Scalar(256,0,0),
+                                                      cv::Scalar(0,256,0)};
+    for(size_t i = 0; i < coins.coinEllipses.size(); i++)
+    {
+        cv::ellipse(frame, coins.coinEllipses[i], colors[coins.ellipseAssignments[i]], 2);
     }
+    std::ostringstream total;
+    total << "$" << coins.total;
+    cv::putText(frame, total.str(), cv::Point(20, 40), cv::FONT_HERSHEY_SIMPLEX, 1.2, cv::Scalar(255,255,255), 2);
+}
 
-    std::vector<double> ellipseDiameters;
-    for(int i = 0; i < coinEllipses.size(); i++) {
-        cv::Point2f pts[4];
-        coinEllipses[i].points(pts);
-        double diameter = sqrt( pow((pts[2].x - pts[0].x), 2) + pow((pts[0].y - pts[2].y), 2) );
-        std::cout << "Ellipse Diameter: " << diameter << std::endl;
-        ellipseDiameters.push_back(diameter);
+/*******************************************************************************************************************//**
+ * @brief counts the coins in every frame of a video, tracking them between full detections
+ * @param[in] source video file, camera index, or "synthetic" for generated 1080p frames with a known total
+ * @param[in] counter counter with its model loaded
+ * @param[in] display show every frame with its coins, 'q' or escape stops early
+ * @return return code (0 when the video could be read)
+ **********************************************************************************************************************/
+static int runVideo(const std::string& source, const CoinCounter& counter, bool display)
+{
+    cv::VideoCapture capture;
+    SyntheticCoinVideo* synthetic = NULL;
+    if(source == "synthetic") synthetic = new SyntheticCoinVideo(cv::Size(1920, 1080), counter, 300);
+    else if(source.find_first_not_of("0123456789") == std::string::npos) capture.open(atoi(source.c_str()));
+    else capture.open(source);
+    if(!synthetic && !capture.isOpened())
+    {
+        std::cout << "Error while opening video " << source << std::endl;
+        return 1;
     }
 
-    enum CoinType {penny, nickel, dime, quarter};
-    int coinCount[4] = {0,0,0,0};
-    int ellipseAssignments[ellipseDiameters.size()];
-    for(int i = 0; i < ellipseDiameters.size(); i++) {
-        double currentDiameter = ellipseDiameters[i];
-        std::vector<double> sumOfSquaresError(4);
-        for(int coinInt = penny; coinInt != quarter+1; coinInt++) {
-            sumOfSquaresError.at(coinInt) = pow(model[coinInt] - currentDiameter, 2);
-            std::cout << "Error from " << coinInt << " is " << sumOfSquaresError.at(coinInt) << std::endl;
+    CoinTracker tracker(counter);
+    cv::Mat frame;
+    int frames = 0;
+    int correct = 0;
+    double totalMs = 0;
+    while(synthetic ? synthetic->read(frame) : capture.read(frame))
+    {
+        int64 start = cv::getTickCount();
+        const CoinResult& coins = tracker.process(frame);
+        totalMs += (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+        StageProfiler::count(counter_images);
+        frames++;
+        // totals are sums of cents, so they match to well within a tenth of a cent when the counts match
+        if(synthetic && std::abs(coins.total - synthetic->getTotal()) < 0.001) correct++;
+
+        if(display)
+        {
+            drawCoins(frame, coins);
+            cv::imshow("video", frame);
+            int key = cv::waitKey(1);
+            if(key == 27 || key == 'q') break;
         }
-        ellipseAssignments[i] = std::distance( sumOfSquaresError.begin(), 
-                                    std::min_element(sumOfSquaresError.begin(), sumOfSquaresError.end()));
-        std::cout << "Ellipse assigned to coin: " << ellipseAssignments[i] << std::endl;
-        coinCount[ellipseAssignments[i]]++;
     }
 
-    double total = 0;
-    for(int coinInt = penny; coinInt != quarter+1; coinInt++) {
-        switch(static_cast<CoinType>(coinInt)) {
-            case penny:
-                std::cout << "There are " << coinCount[coinInt] << " pennies" << std::endl;
-                total += 0.01 * coinCount[coinInt];
-                break;
-            case nickel:
-                std::cout << "There are " << coinCount[coinInt] << " nickels" << std::endl;
-                total += 0.05 * coinCount[coinInt];
-                break;
-            case dime:
-                std::cout << "There are " << coinCount[coinInt] << " dimes" << std::endl;
-                total += 0.1 * coinCount[coinInt];
-                break;
-            case quarter:
-                std::cout << "There are " << coinCount[coinInt] << " quarters" << std::endl;
-                total += 0.25 * coinCount[coinInt];
-                break;
-            default:
-                break;      
-        }
+    double meanMs = frames > 0 ? totalMs / frames : 0;
+    std::cout << "Counted " << frames << " frames at " << meanMs << " ms per frame ("
+              << (meanMs > 0 ? 1000.0 / meanMs : 0) << " frames/s), " << tracker.getDetections() << " full detections"
+              << std::endl;
+    if(synthetic)
+    {
+        std::cout << "The total of $" << synthetic->getTotal() << " was right in " << correct << " of " << frames
+                  << " frames" << std::endl;
     }
-    std::cout << "There is $" << total << " shown in the image!" << std::endl;
-
-    cv::Mat imageEllipse = cv::Mat::zeros(imageEdges.size(), CV_8UC3);
-    for(int i = 0; i < coinEllipses.size(); i++)
-    {
-        cv::Scalar color;
-        switch(static_cast<CoinType>(ellipseAssignments[i])) {
-            case penny:
-                color = cv::Scalar(0,0,256);
-                cv::ellipse(imageEllipse, coinEllipses[i], color, 2);
-                break;
-            case nickel:
-                color = cv::Scalar(0,256,256);
-                cv::ellipse(imageEllipse, coinEllipses[i], color, 2);
-                break;
-            case dime:
-                color = cv::Scalar(256,0,0);
-                cv::ellipse(imageEllipse, coinEllipses[i], color, 2);
-                break;
-            case quarter:
-                color = cv::Scalar(0,256,0);
-                cv::ellipse(imageEllipse, coinEllipses[i], color, 2);
-                break;
-            default:
-                break;
-        }
+    delete synthetic;
+    return 0;
+}
+
+/*******************************************************************************************************************//**
+ * @brief writes the stage profile of a run to the files asked for
+ * @param[in] profile times and counts of the run
+ * @param[in] profilePath file the JSON summary goes to, none when empty
+ * @param[in] tracePath file the Chrome trace goes to, none when empty
+ **********************************************************************************************************************/
+static void writeProfile(const StageProfiler& profile, const std::string& profilePath, const std::string& tracePath)
+{
+    if(!profilePath.empty())
+    {
+        std::ofstream file(profilePath.c_str());
+        if(file) profile.writeJson(file);
+        else std::cerr << "Error opening profile file " << profilePath << std::endl;
+    }
+    if(!tracePath.empty())
+    {
+        std::ofstream file(tracePath.c_str());
+        if(file) profile.writeTrace(file);
+        else std::cerr << "Error opening trace file " << tracePath << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // ./lab2 <image_path> <model> shows the pipeline for one image
+    // ./lab2 --batch <directory_or_list> <model> [--threads N] [--format csv|json] [--out report] counts every image
+    // headlessly, one image per thread
+    // --pyramid N looks for the coins at 1/2^N size first and fits each again at full size, e.g. --pyramid 2
+    // --tiles N finds edges and contours in overlapping tiles of N pixels a side (at least 1000) on every core, for
+    // very large scans
+    // ./lab2 --video <file|camera|synthetic> <model> [--headless] counts the coins of every frame, tracking them
+    // --profile summary.json times every stage and counts contours and ellipses, --trace trace.json also writes every
+    // timed stage for chrome://tracing
+    // --engine contours|hough|blobs picks how images and batches find the coins
+    // ./lab2 --benchmark <directory_or_list> <model> [--truth truth.txt] [--engine name] times every engine and scores
+    // its counts against the known ones
+    std::vector<std::string> args;
+    std::string batchSource;
+    int threads = 0;
+    std::string format = "csv";
+    std::string outPath;
+    int pyramidLevels = 0;
+    int tileSize = 0;
+    std::string videoSource;
+    bool headless = false;
+    std::string profilePath;
+    std::string tracePath;
+    std::string engine;
+    std::string benchmarkSource;
+    std::string truthPath;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if(arg == "--batch" && i + 1 < argc) batchSource = argv[++i];
+        else if(arg == "--threads" && i + 1 < argc) threads = atoi(argv[++i]);
+        else if(arg == "--format" && i + 1 < argc) format = argv[++i];
+        else if(arg == "--out" && i + 1 < argc) outPath = argv[++i];
+        else if(arg == "--pyramid" && i + 1 < argc) pyramidLevels = atoi(argv[++i]);
+        else if(arg == "--tiles" && i + 1 < argc) tileSize = atoi(argv[++i]);
+        else if(arg == "--video" && i + 1 < argc) videoSource = argv[++i];
+        else if(arg == "--headless") headless = true;
+        else if(arg == "--profile" && i + 1 < argc) profilePath = argv[++i];
+        else if(arg == "--trace" && i + 1 < argc) tracePath = argv[++i];
+        else if(arg == "--engine" && i + 1 < argc) engine = argv[++i];
+        else if(arg == "--benchmark" && i + 1 < argc) benchmarkSource = argv[++i];
+        else if(arg == "--truth" && i + 1 < argc) truthPath = argv[++i];
+        else args.push_back(arg);
     }
 
+    cv::Mat imageIn;
+    CoinCounter counter;
+
+    bool imageMode = batchSource.empty() && videoSource.empty() && benchmarkSource.empty();
+    if(args.size() != NUM_COMNMAND_LINE_ARGUMENTS + (imageMode ? 1 : 0))
+    {
+        std::printf("USAGE: %s <image_path> <model> [--pyramid N | --tiles N] [--engine contours|hough|blobs]\n",
+                    argv[0]);
+        std::printf("       %s --batch <directory_or_list> <model> [--threads N] [--format csv|json] [--out path]\n",
+                    argv[0]);
+        std::printf("       %s --video <file|camera|synthetic> <model> [--headless]\n", argv[0]);
+        std::printf("       %s --benchmark <directory_or_list> <model> [--truth truth.txt] [--engine name]\n", argv[0]);
+        std::printf("       any of them with [--profile summary.json] [--trace trace.json]\n");
+        return 0;
+    }
+    // tracking refits the ellipses of the contour engine at full size, so video takes no detection options
+    if(!videoSource.empty() && (!engine.empty() || pyramidLevels != 0 || tileSize != 0))
+    {
+        std::cout << "--engine, --pyramid and --tiles cannot be used with --video" << std::endl;
+        return 1;
+    }
+    const std::string& modelPath = args.back();
+    if(!counter.loadModel(modelPath)) {
+        std::cout << "Error opening model file " << modelPath << std::endl;
+        return 0;
+    }
+    counter.setPyramidLevels(pyramidLevels);
+    counter.setTileSize(tileSize);
+
+    // checked before the benchmark too, which would otherwise skip every engine and print an empty table
+    CoinDetector* detector = CoinDetector::create(engine.empty() ? "contours" : engine, counter);
+    if(!detector)
+    {
+        std::cout << "Unknown engine " << engine << std::endl;
+        return 1;
+    }
+    if(!benchmarkSource.empty())
+    {
+        delete detector;
+        return runBenchmark(benchmarkSource, counter, engine, truthPath);
+    }
+
+    bool profiling = !profilePath.empty() || !tracePath.empty();
+    StageProfiler profile(cv::getTickCount(), !tracePath.empty(), 0);
+    if(!batchSource.empty())
+    {
+        int code = runBatch(batchSource, *detector, threads, format, outPath, profiling ? &profile : NULL);
+        if(profiling) writeProfile(profile, profilePath, tracePath);
+        delete detector;
+        return code;
+    }
+    StageProfiler::setCurrent(profiling ? &profile : NULL);
+    if(!videoSource.empty())
+    {
+        int code = runVideo(videoSource, counter, !headless);
+        if(profiling) writeProfile(profile, profilePath, tracePath);
+        delete detector;
+        return code;
+    }
+
+    {
+        StageTimer timer(profile_decode);
+        imageIn = cv::imread(args[0], CV_LOAD_IMAGE_COLOR);
+    }
+    if(!imageIn.data)
+    {
+        std::cout << "Error while opening file " << args[0] << std::endl;
+        delete detector;
+        return 0;
+    }
+
+    std::cout << "image width: " << imageIn.size().width << std::endl;
+    std::cout << "image height: " << imageIn.size().height << std::endl;
+    std::cout << "image channels: " << imageIn.channels() << std::endl;
+
+    // only the stages behind the windows below run; the normalized and equalized images are never shown
+    counter.setVerbose(true);
+    CoinPipeline pipeline(counter, imageIn);
+    pipeline.want(stage_edges);
+    bool contourEngine = std::string(detector->name()) == "contours";
+    CoinResult result = contourEngine ? pipeline.getCoins() : detector->count(imageIn);
+    delete detector;
+
+    for(int coinInt = penny; coinInt != quarter+1; coinInt++) {
+        std::cout << "There are " << result.coinCount[coinInt] << " " << CoinCounter::coinName(coinInt) << std::endl;
+    }
+    std::cout << "There is $" << result.total << " shown in the image!" << std::endl;
+    std::cout << "Skipped " << result.skippedFits << " ellipse fits inside coins" << std::endl;
+
+    // only counting is profiled, not the drawing for the windows
+    StageProfiler::count(counter_images);
+    StageProfiler::setCurrent(NULL);
+    if(profiling) writeProfile(profile, profilePath, tracePath);
+
     cv::imshow("imageIn", imageIn);
-    cv::imshow("imageGray", imageGray);
-    cv::imshow("imageEdges", imageEdges);
-    cv::imshow("imageContours", imageContours);
-    cv::imshow("imageRectangles", imageRectangles);
-    cv::imshow("imageEllipse", imageEllipse);
+    if(!contourEngine)
+    {
+        // the other engines have no edge or contour images, only the coins they found
+        cv::Mat imageCoins = imageIn.clone();
+        drawCoins(imageCoins, result);
+        cv::imshow("imageCoins", imageCoins);
+        cv::waitKey();
+        return 0;
+    }
+    cv::imshow("imageGray", pipeline.getImage(stage_gray));
+    cv::imshow("imageEdges", pipeline.getImage(stage_edges));
+    cv::imshow("imageContours", pipeline.getImage(stage_contour_image));
+    cv::imshow("imageRectangles", pipeline.getImage(stage_rectangle_image));
+    cv::imshow("imageEllipse", pipeline.getImage(stage_ellipse_image));
     cv::waitKey();
 }